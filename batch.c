@@ -0,0 +1,196 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <wait.h>
+#include "reap.h"
+#include "metrics.h"
+#include "trace.h"
+#include "launch.h"
+#include "batch.h"
+
+#define BATCH_EVENTS 64
+/* left for the auxiliary vector and the executable's path, like xargs does */
+#define ARG_HEADROOM 4096
+
+extern char **environ;
+
+typedef struct {
+    /* the command and the options every chunk starts with */
+    char **fixed;
+    int fixedCount;
+    char **items;
+    int itemCount;
+    int nextItem;
+    /* the bytes a chunk's items may take */
+    size_t budget;
+    int slots;
+    int running;
+    int status;
+    Reaper *reaper;
+    const LaunchOptions *launch;
+} Batch;
+
+/**
+ * The function returns what an argument costs in the exec'd process's
+ * argument area: its bytes and its pointer.
+ */
+static size_t argCost(const char *arg) { return strlen(arg) + 1 + sizeof(char *); }
+
+/**
+ * The function keeps the worst exit status.
+ */
+static void mergeStatus(Batch *batch, int status) {
+    int code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    if (code > batch->status) batch->status = code;
+}
+
+/**
+ * The function builds the next chunk's argv, taking as many items as fit.
+ * @return The argv, which shares the strings of args, or NULL on bad alloc.
+ */
+static char **nextChunk(Batch *batch) {
+    size_t used = 0;
+    int count = 0;
+    while (batch->nextItem + count < batch->itemCount) {
+        size_t cost = argCost(batch->items[batch->nextItem + count]);
+        // an item too big for a chunk of its own goes alone, and exec fails
+        if (count > 0 && used + cost > batch->budget) break;
+        used += cost;
+        count++;
+    }
+    char **argv = (char **)malloc((batch->fixedCount + count + 1) * sizeof(char *));
+    if (!argv) return NULL;
+    memcpy(argv, batch->fixed, batch->fixedCount * sizeof(char *));
+    memcpy(argv + batch->fixedCount, batch->items + batch->nextItem, count * sizeof(char *));
+    argv[batch->fixedCount + count] = NULL;
+    batch->nextItem += count;
+    return argv;
+}
+
+/**
+ * The function starts the next chunk.
+ * @return 0 if it started or -1 if it failed to.
+ */
+static int startChunk(Batch *batch) {
+    char **argv = nextChunk(batch);
+    if (!argv) {
+        perror("batch");
+        return -1;
+    }
+    long long started = nowNs();
+    pid_t pid = fork();
+    if (pid == 0) {
+        int devNull = open("/dev/null", O_RDONLY);
+        if (devNull >= 0) dup2(devNull, 0);
+        if (applyLaunchOptions(batch->launch) < 0) _exit(126);
+        execvp(argv[0], argv);
+        perror(argv[0]);
+        _exit(errno == ENOENT ? 127 : 126);
+    }
+    free(argv);
+    if (pid < 0) {
+        metrics.forkFailures++;
+        perror("batch");
+        return -1;
+    }
+    metrics.commandsLaunched++;
+    TRACE_AT(TRACE_FORK, started, pid, 0);
+    if (watchChild(batch->reaper, pid, NULL) < 0) {
+        int status;
+        while (waitpid(pid, &status, 0) < 0 && errno == EINTR);
+        mergeStatus(batch, status);
+        return 0;
+    }
+    batch->running++;
+    return 0;
+}
+
+int parseSlots(const char *word) {
+    char *end;
+    errno = 0;
+    long slots = strtol(word, &end, 10);
+    if (*end || end == word || errno || slots < 1 || slots > INT_MAX) return 0;
+    return (int)slots;
+}
+
+int runBatch(char **args, const LaunchOptions *launch) {
+    Batch batch;
+    memset(&batch, 0, sizeof(batch));
+    batch.launch = launch;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int i = 1;
+    batch.slots = cpus < 1 ? 1 : cpus > INT_MAX ? INT_MAX : (int)cpus;
+    if (args[i] && strcmp(args[i], "-j") == 0 && args[i + 1]) {
+        // a bad count is 0, which is rejected below
+        batch.slots = parseSlots(args[i + 1]);
+        i += 2;
+    }
+    if (!args[i] || batch.slots < 1) {
+        fprintf(stderr, BATCH_USAGE);
+        return 2;
+    }
+    // every chunk repeats the words up to a --, or without one the leading
+    // options
+    batch.fixed = args + i;
+    int end = i + 1;
+    while (args[end] && strcmp(args[end], "--") != 0) end++;
+    if (args[end]) {
+        i = end + 1;
+    } else {
+        for (i++; args[i] && args[i][0] == '-'; i++);
+    }
+    batch.fixedCount = args + i - batch.fixed;
+    batch.items = args + i;
+    while (args[i]) i++;
+    batch.itemCount = args + i - batch.items;
+
+    // the budget is what ARG_MAX leaves after the environment, the fixed
+    // arguments and the terminating NULL pointers
+    size_t used = ARG_HEADROOM + 2 * sizeof(char *);
+    for (i = 0; environ[i]; i++) used += argCost(environ[i]);
+    for (i = 0; i < batch.fixedCount; i++) used += argCost(batch.fixed[i]);
+    long argMax = sysconf(_SC_ARG_MAX);
+    if (argMax <= 0 || (size_t)argMax <= used) {
+        fprintf(stderr, "batch: the environment and options leave no room for arguments\n");
+        return 126;
+    }
+    batch.budget = argMax - used;
+
+    batch.reaper = createReaper(REAP_AUTO);
+    if (!batch.reaper) {
+        perror("batch");
+        return 1;
+    }
+    fflush(stdout);
+    // with no arguments the command still runs once, like without batch
+    int first = 1;
+    while ((first || batch.nextItem < batch.itemCount) && batch.running < batch.slots) {
+        if (startChunk(&batch) < 0) batch.nextItem = batch.itemCount;
+        first = 0;
+    }
+    ReapEvent events[BATCH_EVENTS];
+    while (batch.running > 0) {
+        flushReaper(batch.reaper);
+        int n = reapEvents(batch.reaper, events, BATCH_EVENTS, -1);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            perror("batch");
+            break;
+        }
+        for (i = 0; i < n; i++) {
+            if (events[i].kind != REAP_EXITED) continue;
+            TRACE(TRACE_CHILD_EXIT, events[i].pid, events[i].status);
+            mergeStatus(&batch, events[i].status);
+            batch.running--;
+        }
+        while (batch.nextItem < batch.itemCount && batch.running < batch.slots) {
+            if (startChunk(&batch) < 0) batch.nextItem = batch.itemCount;
+        }
+    }
+    freeReaper(batch.reaper);
+    return batch.status;
+}
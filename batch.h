@@ -0,0 +1,31 @@
+#ifndef EX2_BATCH_H
+#define EX2_BATCH_H
+
+#include "jobs.h"
+
+#define BATCH_USAGE "usage: batch [-j N] CMD [-OPTIONS...] ARGS...\n" \
+                    "       batch [-j N] CMD [WORDS...] -- ARGS...\n"
+
+/**
+ * The function parses the count of -j, which batch and map share.
+ * @param word The count.
+ * @return The count, or 0 if the word isn't a whole number between 1 and
+ * INT_MAX.
+ */
+int parseSlots(const char *word);
+/**
+ * The function runs the batch builtin, which runs the command with its
+ * arguments split into chunks that each fit ARG_MAX (less the environment),
+ * so a huge expanded argument list doesn't fail with E2BIG. Every chunk
+ * repeats the words up to and including the first --, or the command's
+ * leading options when there is no --.
+ * Up to N (the number of CPUs by default) chunks run at once.
+ * @param args The builtin's NULL terminated argv, starting with "batch".
+ * @param launch The priorities and limits every chunk runs with.
+ * @return The worst exit status of the chunks (128 + the signal for a
+ * killed chunk, 126 if the arguments can't be split small enough), or 2 on
+ * a usage error.
+ */
+int runBatch(char **args, const LaunchOptions *launch);
+
+#endif
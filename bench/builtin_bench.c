@@ -0,0 +1,99 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <time.h>
+#include <unistd.h>
+#include <wait.h>
+
+/*
+ * Runs a script of common utility calls through ex2 with the in-process
+ * builtins and again with EX2_EXTERNAL_BUILTINS set, and reports the cost
+ * per command of each mode.
+ * usage: builtin_bench [-n COMMANDS] [-s SHELL]
+ */
+
+extern char **environ;
+
+static const char *commands[] = {
+    "true",
+    "echo hello world",
+    "printf %s-%d\\n item 42",
+    "test -d /tmp",
+    "[ 3 -lt 5 ]",
+    "cat /etc/hostname",
+};
+
+/**
+ * The function runs the script once.
+ * @return The seconds it took or -1 on failure.
+ */
+static double runScript(const char *shell, const char *script, int external) {
+    char **env = environ;
+    size_t count = 0, i;
+    while (env[count]) count++;
+    char **childEnv = (char **)malloc((count + 2) * sizeof(char *));
+    if (!childEnv) return -1;
+    size_t kept = 0;
+    for (i = 0; i < count; i++) {
+        if (strncmp(env[i], "EX2_EXTERNAL_BUILTINS=", 22) != 0) childEnv[kept++] = env[i];
+    }
+    if (external) childEnv[kept++] = "EX2_EXTERNAL_BUILTINS=1";
+    childEnv[kept] = NULL;
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, 1, "/dev/null", O_WRONLY, 0);
+    char *argv[] = {(char *)shell, (char *)script, NULL};
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pid_t pid;
+    int err = posix_spawn(&pid, shell, &actions, NULL, argv, childEnv);
+    posix_spawn_file_actions_destroy(&actions);
+    free(childEnv);
+    if (err) return -1;
+    int status;
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status)) return -1;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+int main(int argc, char *argv[]) {
+    long n = 3000;
+    const char *shell = "./ex2";
+    int opt;
+    while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+        if (opt == 'n') n = atol(optarg);
+        else if (opt == 's') shell = optarg;
+        else {
+            fprintf(stderr, "usage: builtin_bench [-n COMMANDS] [-s SHELL]\n");
+            return 2;
+        }
+    }
+    char script[] = "/tmp/builtin_bench.XXXXXX";
+    int fd = mkstemp(script);
+    FILE *file = fd >= 0 ? fdopen(fd, "w") : NULL;
+    if (!file) {
+        perror("mkstemp");
+        return 1;
+    }
+    long i;
+    size_t kinds = sizeof(commands) / sizeof(commands[0]);
+    for (i = 0; i < n; i++) fprintf(file, "%s\n", commands[i % kinds]);
+    fclose(file);
+    const char *modes[2] = {"in-process", "external"};
+    int mode, failed = 0;
+    for (mode = 0; mode < 2; mode++) {
+        // the first run parses the script into the cache
+        double seconds = runScript(shell, script, mode);
+        if (seconds >= 0) seconds = runScript(shell, script, mode);
+        if (seconds < 0) {
+            fprintf(stderr, "%s: failed to run %s\n", modes[mode], shell);
+            failed = 1;
+            break;
+        }
+        printf("%-10s %ld commands in %.3fs: %.2f us/command\n", modes[mode], n, seconds, seconds * 1e6 / n);
+    }
+    unlink(script);
+    return failed;
+}
@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include "../jobs.h"
+
+/*
+ * Lists a table of fake jobs to /dev/null, once with one printf per word
+ * like jobs used to, then through printJobs, unfiltered, by name and by
+ * state.
+ * usage: jobs_bench [-n JOBS]
+ */
+
+static const char *names[] = {"sleep", "make", "python3", "rsync", "tar", "ssh", "find", "curl"};
+
+static double seconds(const struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main(int argc, char *argv[]) {
+    int count = 100000, opt;
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        if (opt == 'n') count = atoi(optarg);
+        else {
+            fprintf(stderr, "usage: jobs_bench [-n JOBS]\n");
+            return 2;
+        }
+    }
+    JobsQueue *jobsQueue = createJobsQueue();
+    int i;
+    for (i = 0; jobsQueue && i < count; i++) {
+        char **args = (char **)malloc(4 * sizeof(char *));
+        char arg[32];
+        snprintf(arg, sizeof(arg), "--item=%d", i);
+        args[0] = strdup(names[i % 8]);
+        args[1] = strdup(arg);
+        args[2] = strdup("/var/tmp/some/longer/path");
+        args[3] = NULL;
+        Job *job = newJob(args, 3);
+        // pids nobody has, so the state checks find no stopped child
+        job->pid = 4000000 + i;
+        job->started = 1;
+        jobsQueue = addJob(jobsQueue, job);
+    }
+    if (!jobsQueue) return 1;
+    int devNull = open("/dev/null", O_WRONLY);
+    int out = dup(STDOUT_FILENO);
+    dup2(devNull, STDOUT_FILENO);
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    Job *job;
+    for (job = jobsQueue->first; job; job = job->next) {
+        printf("%d\t", job->pid);
+        int j = 0;
+        while (job->args[j]) printf("%s ", job->args[j++]);
+        printf("\n");
+    }
+    fflush(stdout);
+    double naive = seconds(&start);
+    setvbuf(stdout, NULL, _IONBF, 0);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (job = jobsQueue->first; job; job = job->next) {
+        printf("%d\t", job->pid);
+        int j = 0;
+        while (job->args[j]) printf("%s ", job->args[j++]);
+        printf("\n");
+    }
+    double unbuffered = seconds(&start);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    printJobs(jobsQueue, NULL);
+    double all = seconds(&start);
+    JobsFilter byName = {0, 0, 0, "rsync"};
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    printJobs(jobsQueue, &byName);
+    double matched = seconds(&start);
+    JobsFilter running = {1, 0, 1, NULL};
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    printJobs(jobsQueue, &running);
+    double states = seconds(&start);
+    dup2(out, STDOUT_FILENO);
+    printf("%d jobs: printf per word %.1f ms (%.1f ms unbuffered), jobs %.1f ms, --match %.1f ms, -r -p %.1f ms\n",
+           count, naive * 1e3, unbuffered * 1e3, all * 1e3, matched * 1e3, states * 1e3);
+    freeJobsQueue(jobsQueue);
+    return 0;
+}
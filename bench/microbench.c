@@ -0,0 +1,280 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../expand.h"
+#include "../jobs.h"
+#include "../builtins.h"
+
+/*
+ * Times the shell's hot data structures alone, each in ns and allocations
+ * per op: splitting prompt lines into a job like getPromptJob does, over
+ * several line lengths and a mix of them, the job table's insert, iterate,
+ * find and remove at 10, 10k and 1M jobs, builtin lookups that hit and
+ * miss, and removeCompletedJobs sweeps. Allocations are counted by
+ * replacing malloc, calloc and realloc, which glibc lets a program do, so
+ * the ones libc makes for the shell, like strdup's, count too.
+ * usage: microbench [FILTER], FILTER runs the benchmarks whose name has it
+ */
+
+#define BATCH 256
+/* how long each benchmark runs for */
+#define RUN_NS 200000000LL
+#define MIXED_LINES 64
+/* the most findJob calls a round makes, which walks the table */
+#define MAX_FINDS 100
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *data, size_t size);
+
+static unsigned long allocations = 0;
+
+void *malloc(size_t size) {
+    allocations++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    allocations++;
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *data, size_t size) {
+    allocations++;
+    return __libc_realloc(data, size);
+}
+
+typedef struct {
+    long long ns;
+    unsigned long allocations;
+    long ops;
+    /* when the running part started, and the allocations until then */
+    long long startedAt;
+    unsigned long allocatedBefore;
+} Meter;
+
+static const char *filter = NULL;
+static const char *names[] = {"sleep", "make", "python3", "rsync", "tar", "ssh", "find", "curl"};
+
+static long long nowNs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static void startMeter(Meter *meter) {
+    meter->allocatedBefore = allocations;
+    meter->startedAt = nowNs();
+}
+
+/**
+ * The function stops a meter, which adds the time and allocations since it
+ * was started.
+ * @param ops The number of ops done since then.
+ */
+static void stopMeter(Meter *meter, long ops) {
+    meter->ns += nowNs() - meter->startedAt;
+    meter->allocations += allocations - meter->allocatedBefore;
+    meter->ops += ops;
+}
+
+static void report(const char *name, const Meter *meter) {
+    long ops = meter->ops ? meter->ops : 1;
+    printf("%-40s %12.1f ns/op %8.2f allocs/op %12ld ops\n", name, (double)meter->ns / ops,
+           (double)meter->allocations / ops, meter->ops);
+    fflush(stdout);
+}
+
+static int selected(const char *name) {
+    return !filter || strstr(name, filter);
+}
+
+/**
+ * The function makes a prompt line of about len characters.
+ */
+static char *makeLine(int len, int seed) {
+    char *line = (char *)malloc(len + 32);
+    int at = sprintf(line, "%s", names[seed % 8]);
+    int word = 0;
+    while (at < len) at += sprintf(line + at, " --opt%d=value%d", word++, seed);
+    return line;
+}
+
+/**
+ * The function splits a line into a job and frees it, like getPromptJob.
+ * @param buf A copy of the line, it is modified.
+ */
+static void tokenize(char *buf) {
+    ArgList list;
+    initArgList(&list);
+    if (splitWords(buf, &list) < 0 || appendArg(&list, NULL) < 0) {
+        freeArgList(&list);
+        return;
+    }
+    deleteJob(newJob(list.args, list.size - 1));
+}
+
+/**
+ * The function tokenizes lines in turns until RUN_NS passed.
+ */
+static void benchTokenize(const char *name, char **lines, int count) {
+    if (!selected(name)) return;
+    char buf[1100];
+    size_t lens[MIXED_LINES];
+    int i, next = 0;
+    for (i = 0; i < count; i++) lens[i] = strlen(lines[i]) + 1;
+    Meter meter = {0, 0, 0, 0, 0};
+    long long until = nowNs() + RUN_NS;
+    while (nowNs() < until) {
+        startMeter(&meter);
+        for (i = 0; i < BATCH; i++) {
+            memcpy(buf, lines[next], lens[next]);
+            tokenize(buf);
+            if (++next == count) next = 0;
+        }
+        stopMeter(&meter, BATCH);
+    }
+    report(name, &meter);
+}
+
+static void benchTokenizer() {
+    int lens[] = {16, 80, 900};
+    const char *lenNames[] = {"tokenize 16 chars", "tokenize 80 chars", "tokenize 900 chars"};
+    char *lines[MIXED_LINES];
+    int i;
+    for (i = 0; i < 3; i++) {
+        lines[0] = makeLine(lens[i], i);
+        benchTokenize(lenNames[i], lines, 1);
+        free(lines[0]);
+    }
+    // mostly short commands, some with a few options and a long one now
+    // and then, like the lines typed at a prompt
+    srand(1);
+    for (i = 0; i < MIXED_LINES; i++) {
+        int pick = rand() % 100;
+        lines[i] = makeLine(pick < 70 ? 8 + rand() % 24 : pick < 95 ? 40 + rand() % 120 : 300 + rand() % 700, i);
+    }
+    benchTokenize("tokenize mixed lengths", lines, MIXED_LINES);
+    for (i = 0; i < MIXED_LINES; i++) free(lines[i]);
+}
+
+/**
+ * The function makes running jobs with pids nobody has, which the SIGCHLD
+ * handler is taken to watch, so no sweep calls waitpid for them.
+ */
+static Job **makeJobs(int count) {
+    Job **jobs = (Job **)malloc(count * sizeof(Job *));
+    int i;
+    for (i = 0; i < count; i++) {
+        char **args = (char **)malloc(3 * sizeof(char *));
+        args[0] = strdup(names[i % 8]);
+        args[1] = strdup("--item");
+        args[2] = NULL;
+        jobs[i] = newJob(args, 2);
+        jobs[i]->pid = 4000000 + i;
+        jobs[i]->started = 1;
+        jobs[i]->watched = 1;
+    }
+    return jobs;
+}
+
+static void benchJobTable(int size) {
+    char name[4][64];
+    snprintf(name[0], sizeof(name[0]), "job table insert, %d jobs", size);
+    snprintf(name[1], sizeof(name[1]), "job table iterate, %d jobs", size);
+    snprintf(name[2], sizeof(name[2]), "job table find, %d jobs", size);
+    snprintf(name[3], sizeof(name[3]), "job table remove oldest, %d jobs", size);
+    if (!selected(name[0]) && !selected(name[1]) && !selected(name[2]) && !selected(name[3])) return;
+    Job **jobs = makeJobs(size);
+    JobsQueue *jobsQueue = createJobsQueue();
+    Meter insert = {0, 0, 0, 0, 0}, iterate = insert, find = insert, remove = insert;
+    int finds = size < MAX_FINDS ? size : MAX_FINDS, i;
+    long long until = nowNs() + RUN_NS;
+    unsigned seed = 1;
+    long visited = 0;
+    do {
+        startMeter(&insert);
+        for (i = 0; i < size; i++) jobsQueue = addJob(jobsQueue, jobs[i]);
+        stopMeter(&insert, size);
+        startMeter(&iterate);
+        Job *job;
+        for (job = jobsQueue->first; job; job = job->next) visited += job->pid;
+        stopMeter(&iterate, size);
+        startMeter(&find);
+        for (i = 0; i < finds; i++) visited += findJob(jobsQueue, 4000000 + rand_r(&seed) % size) != NULL;
+        stopMeter(&find, finds);
+        startMeter(&remove);
+        for (i = 0; i < size; i++) removeJob(jobsQueue, jobs[i]->pid);
+        stopMeter(&remove, size);
+    } while (nowNs() < until);
+    for (i = 0; i < 4; i++) {
+        if (selected(name[i])) report(name[i], i == 0 ? &insert : i == 1 ? &iterate : i == 2 ? &find : &remove);
+    }
+    for (i = 0; i < size; i++) deleteJob(jobs[i]);
+    free(jobs);
+    freeJobsQueue(jobsQueue);
+    if (!visited) printf("\n");
+}
+
+/**
+ * The function sweeps a table of running jobs, then one where every other
+ * job exited, which the sweep unlinks and frees. An op is a job the sweep
+ * looked at.
+ */
+static void benchPurge(int size) {
+    char idle[64], half[64];
+    snprintf(idle, sizeof(idle), "purge none done, %d jobs", size);
+    snprintf(half, sizeof(half), "purge half done, %d jobs", size);
+    if (!selected(idle) && !selected(half)) return;
+    Meter none = {0, 0, 0, 0, 0}, some = none;
+    long long until = nowNs() + RUN_NS;
+    do {
+        JobsQueue *jobsQueue = createJobsQueue();
+        Job **jobs = makeJobs(size);
+        int i;
+        for (i = 0; i < size; i++) jobsQueue = addJob(jobsQueue, jobs[i]);
+        startMeter(&none);
+        removeCompletedJobs(jobsQueue);
+        stopMeter(&none, size);
+        for (i = 0; i < size; i += 2) jobs[i]->started = 0;
+        startMeter(&some);
+        removeCompletedJobs(jobsQueue);
+        stopMeter(&some, size);
+        free(jobs);
+        freeJobsQueue(jobsQueue);
+    } while (nowNs() < until);
+    if (selected(idle)) report(idle, &none);
+    if (selected(half)) report(half, &some);
+}
+
+static void benchBuiltin(const char *name, const char *command) {
+    if (!selected(name)) return;
+    Meter meter = {0, 0, 0, 0, 0};
+    long long until = nowNs() + RUN_NS;
+    long found = 0;
+    while (nowNs() < until) {
+        startMeter(&meter);
+        int i;
+        for (i = 0; i < BATCH; i++) found += findBuiltin(command) != NULL;
+        stopMeter(&meter, BATCH);
+    }
+    report(name, &meter);
+    if (found < 0) printf("\n");
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 2 || (argc == 2 && argv[1][0] == '-')) {
+        fprintf(stderr, "usage: microbench [FILTER]\n");
+        return 2;
+    }
+    if (argc == 2) filter = argv[1];
+    benchTokenizer();
+    int sizes[] = {10, 10000, 1000000}, i;
+    for (i = 0; i < 3; i++) benchJobTable(sizes[i]);
+    benchBuiltin("builtin lookup, first hit", "true");
+    benchBuiltin("builtin lookup, last hit", "cat");
+    benchBuiltin("builtin lookup, miss", "ls");
+    for (i = 0; i < 3; i++) benchPurge(sizes[i]);
+    return 0;
+}
@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <spawn.h>
+#include <time.h>
+#include <unistd.h>
+#include <wait.h>
+#include "../prefetch.h"
+
+/*
+ * Measures the cold-start launch latency of a command with and without the
+ * prefetcher. Before every launch the executable and its libraries are
+ * dropped from the page cache (with -d through /proc/sys/vm/drop_caches,
+ * which needs root, else with POSIX_FADV_DONTNEED, which spares pages other
+ * processes map, like libc). The prefetched runs then prefetch and idle for
+ * the gap, like a shell between prompts, before the timed launch.
+ * usage: prefetch_bench [-n RUNS] [-g GAP_MS] [-d] [CMD [ARGS...]]
+ */
+
+extern char **environ;
+
+static int compareDoubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * The function drops the page cache.
+ * @return 0 on success or -1 on failure.
+ */
+static int dropCaches(int global, const char *path) {
+    if (!global) return evictExecutable(path) > 0 ? 0 : -1;
+    sync();
+    int fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+    int ok = fd >= 0 && write(fd, "3", 1) == 1;
+    if (fd >= 0) close(fd);
+    return ok ? 0 : -1;
+}
+
+/**
+ * The function times one launch until the command exited.
+ * @return The seconds or -1 on failure.
+ */
+static double launch(char **argv) {
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, 1, "/dev/null", O_WRONLY, 0);
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pid_t pid;
+    int err = posix_spawn(&pid, argv[0], &actions, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    int status;
+    if (err || waitpid(pid, &status, 0) < 0) return -1;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+int main(int argc, char *argv[]) {
+    int runs = 20, gapMs = 100, global = 0, opt;
+    while ((opt = getopt(argc, argv, "+n:g:d")) != -1) {
+        if (opt == 'n') runs = atoi(optarg);
+        else if (opt == 'g') gapMs = atoi(optarg);
+        else if (opt == 'd') global = 1;
+        else {
+            fprintf(stderr, "usage: prefetch_bench [-n RUNS] [-g GAP_MS] [-d] [CMD [ARGS...]]\n");
+            return 2;
+        }
+    }
+    char *defaultCmd[] = {"/usr/bin/python3", "-c", "pass", NULL};
+    char **cmd = optind < argc ? argv + optind : defaultCmd;
+    char path[PATH_MAX];
+    if (!realpath(cmd[0], path)) {
+        perror(cmd[0]);
+        return 1;
+    }
+    double *times[2];
+    times[0] = (double *)malloc(runs * sizeof(double));
+    times[1] = (double *)malloc(runs * sizeof(double));
+    struct timespec gap = {gapMs / 1000, (gapMs % 1000) * 1000000L};
+    int run, mode;
+    for (run = 0; run < runs; run++) {
+        for (mode = 0; mode < 2; mode++) {
+            if (dropCaches(global, path) < 0) {
+                perror("drop caches");
+                return 1;
+            }
+            if (mode) prefetchExecutable(path, 0);
+            nanosleep(&gap, NULL);
+            times[mode][run] = launch(cmd);
+            if (times[mode][run] < 0) {
+                fprintf(stderr, "%s: failed to launch\n", cmd[0]);
+                return 1;
+            }
+        }
+    }
+    const char *names[2] = {"cold", "prefetched"};
+    for (mode = 0; mode < 2; mode++) {
+        double sum = 0;
+        for (run = 0; run < runs; run++) sum += times[mode][run];
+        qsort(times[mode], runs, sizeof(double), compareDoubles);
+        printf("%-10s %d runs: mean %.2f ms, median %.2f ms\n", names[mode], runs, sum * 1e3 / runs,
+               times[mode][runs / 2] * 1e3);
+    }
+    return 0;
+}
@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <time.h>
+#include <unistd.h>
+#include "../reap.h"
+
+/*
+ * Runs thousands of short-lived jobs whose stdout is captured, keeping a fixed
+ * number in flight, and reports the reap+drain throughput of each reaper
+ * backend.
+ * usage: reap_bench [-n JOBS] [-c CONCURRENCY] [CMD [ARGS...]]
+ */
+
+#define EVENT_BATCH 256
+
+extern char **environ;
+
+typedef struct {
+    int pending;
+} Slot;
+
+/**
+ * The function starts one job with its stdout on a pipe the reaper drains.
+ * @return 0 on success or -1 on failure.
+ */
+static int spawnJob(Reaper *reaper, char **argv, Slot *slot) {
+    int out[2];
+    if (pipe2(out, O_CLOEXEC) < 0) return -1;
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, out[1], 1);
+    pid_t pid;
+    int err = posix_spawnp(&pid, argv[0], &actions, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(out[1]);
+    if (err) {
+        close(out[0]);
+        return -1;
+    }
+    slot->pending = 2;
+    if (watchChild(reaper, pid, slot) < 0 || watchOutput(reaper, out[0], slot) < 0) return -1;
+    return 0;
+}
+
+/**
+ * The function runs the jobs through one backend.
+ * @return The jobs per second or -1 on failure.
+ */
+static double runBackend(int backend, long jobs, int concurrency, char **argv, const char **name) {
+    Reaper *reaper = createReaper(backend);
+    if (!reaper) return -1;
+    *name = reaperBackend(reaper);
+    Slot *slots = (Slot *)calloc(concurrency, sizeof(Slot));
+    int *freeSlots = (int *)malloc(concurrency * sizeof(int));
+    int freeCount = concurrency, i;
+    for (i = 0; i < concurrency; i++) freeSlots[i] = i;
+    long started = 0, done = 0;
+    long long bytes = 0;
+    ReapEvent events[EVENT_BATCH];
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (done < jobs) {
+        while (started < jobs && freeCount > 0) {
+            if (spawnJob(reaper, argv, &slots[freeSlots[--freeCount]]) < 0) return -1;
+            started++;
+        }
+        int n = reapEvents(reaper, events, EVENT_BATCH, -1);
+        if (n < 0) return -1;
+        for (i = 0; i < n; i++) {
+            Slot *slot = (Slot *)events[i].tag;
+            if (events[i].kind == REAP_OUTPUT) {
+                bytes += events[i].size;
+                if (events[i].size > 0) continue;
+                close(events[i].fd);
+            }
+            if (--slot->pending == 0) {
+                freeSlots[freeCount++] = slot - slots;
+                done++;
+            }
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    free(slots);
+    free(freeSlots);
+    freeReaper(reaper);
+    if (bytes == 0) fprintf(stderr, "warning: no output was captured\n");
+    return jobs / seconds;
+}
+
+int main(int argc, char *argv[]) {
+    long jobs = 5000;
+    int concurrency = 64, opt;
+    while ((opt = getopt(argc, argv, "+n:c:")) != -1) {
+        if (opt == 'n') jobs = atol(optarg);
+        else if (opt == 'c') concurrency = atoi(optarg);
+        else {
+            fprintf(stderr, "usage: reap_bench [-n JOBS] [-c CONCURRENCY] [CMD [ARGS...]]\n");
+            return 2;
+        }
+    }
+    char *defaultCmd[] = {"/bin/echo", "hello", NULL};
+    char **cmd = optind < argc ? argv + optind : defaultCmd;
+    int backends[2] = {REAP_EPOLL, REAP_URING};
+    int i;
+    for (i = 0; i < 2; i++) {
+        const char *name = "?";
+        double rate = runBackend(backends[i], jobs, concurrency, cmd, &name);
+        if (rate < 0) {
+            fprintf(stderr, "%s: failed\n", name);
+            return 1;
+        }
+        printf("%-9s %ld jobs, %d in flight: %.0f jobs/sec\n", name, jobs, concurrency, rate);
+    }
+    return 0;
+}
@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "../sigchld.h"
+
+/*
+ * Forks thousands of children that exit at once, while the exits are only
+ * drained every few hundred forks so the SIGCHLD ring overflows, and every
+ * tenth child is waited for synchronously like a foreground job. It checks
+ * that the exit of every watched child is taken exactly once, with its
+ * status, and that no zombie is left.
+ * usage: sigchld_stress [-n CHILDREN] [-d DRAIN_EVERY]
+ */
+
+#define TAKE_BATCH 128
+#define TIMEOUT_SEC 30
+
+typedef struct {
+    pid_t pid;
+    int code;
+    int seen;
+} Child;
+
+static int comparePids(const void *a, const void *b) {
+    pid_t x = ((const Child *)a)->pid, y = ((const Child *)b)->pid;
+    return (x > y) - (x < y);
+}
+
+/**
+ * The function takes the queued exits and matches them to the children.
+ * @return The number of exits taken or -1 if one was unexpected.
+ */
+static int takeExits(Child *children, int count) {
+    ChildExit exits[TAKE_BATCH];
+    int n, i, taken = 0;
+    while ((n = takeChildExits(exits, TAKE_BATCH)) > 0) {
+        for (i = 0; i < n; i++) {
+            Child key = {exits[i].pid, 0, 0};
+            Child *child = (Child *)bsearch(&key, children, count, sizeof(Child), comparePids);
+            if (!child || child->seen || !WIFEXITED(exits[i].status) ||
+                WEXITSTATUS(exits[i].status) != child->code) {
+                fprintf(stderr, "unexpected exit of %d\n", exits[i].pid);
+                return -1;
+            }
+            child->seen = 1;
+        }
+        taken += n;
+    }
+    return taken;
+}
+
+int main(int argc, char *argv[]) {
+    int count = 5000, drainEvery = 2000, opt;
+    while ((opt = getopt(argc, argv, "n:d:")) != -1) {
+        if (opt == 'n') count = atoi(optarg);
+        else if (opt == 'd') drainEvery = atoi(optarg);
+        else {
+            fprintf(stderr, "usage: sigchld_stress [-n CHILDREN] [-d DRAIN_EVERY]\n");
+            return 2;
+        }
+    }
+    if (count <= 0 || count > MAX_WATCHED || drainEvery <= 0) {
+        fprintf(stderr, "CHILDREN must be 1 to %d\n", MAX_WATCHED);
+        return 2;
+    }
+    if (initChildExits() < 0) {
+        perror("sigaction");
+        return 1;
+    }
+    Child *children = (Child *)calloc(count, sizeof(Child));
+    if (!children) {
+        perror("calloc");
+        return 1;
+    }
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int i, taken = 0, foreign = 0;
+    // the early drains run while children are still being forked, so the
+    // handler and the consumer really race, and the exits pile up in between
+    for (i = 0; i < count; i++) {
+        holdChildExits(1);
+        pid_t pid = fork();
+        if (pid == 0) _exit(i % 251);
+        if (pid < 0) {
+            perror("fork");
+            return 1;
+        }
+        children[i].pid = pid;
+        children[i].code = i % 251;
+        watchExit(pid);
+        holdChildExits(0);
+        if (i % 10 == 0) {
+            pid_t other = fork();
+            if (other == 0) _exit(0);
+            while (other > 0 && waitpid(other, NULL, 0) < 0 && errno == EINTR);
+            foreign++;
+        }
+        if (i % drainEvery == drainEvery - 1) {
+            qsort(children, i + 1, sizeof(Child), comparePids);
+            int n = takeExits(children, i + 1);
+            if (n < 0) return 1;
+            taken += n;
+        }
+    }
+    qsort(children, count, sizeof(Child), comparePids);
+    while (taken < count) {
+        int n = takeExits(children, count);
+        if (n < 0) return 1;
+        taken += n;
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        if (end.tv_sec - start.tv_sec > TIMEOUT_SEC) break;
+        if (!n) usleep(1000);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    int zombies = 0;
+    while (waitpid(-1, NULL, WNOHANG) > 0) zombies++;
+    printf("%d children (+%d waited for), %d exits taken, %d zombies left, %.1f ms\n", count, foreign, taken,
+           zombies, (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6);
+    free(children);
+    return taken == count && zombies == 0 ? 0 : 1;
+}
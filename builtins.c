@@ -0,0 +1,374 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "timeout.h"
+#include "builtins.h"
+
+#define CAT_BUF_SIZE 65536
+#define SPEC_SIZE 32
+
+/* -1 until the environment was checked */
+static int builtinsEnabled = -1;
+
+static int trueBuiltin(int argc, char **argv, int in) {
+    (void)argc;
+    (void)argv;
+    (void)in;
+    return 0;
+}
+
+static int falseBuiltin(int argc, char **argv, int in) {
+    (void)argc;
+    (void)argv;
+    (void)in;
+    return 1;
+}
+
+/**
+ * The function writes a string with backslash escapes expanded.
+ * @return 1 if \c stopped the output and 0 else.
+ */
+static int putEscaped(const char *s) {
+    for (; *s; s++) {
+        if (*s != '\\' || !s[1]) {
+            putchar(*s);
+            continue;
+        }
+        switch (*++s) {
+            case 'n': putchar('\n'); break;
+            case 't': putchar('\t'); break;
+            case 'r': putchar('\r'); break;
+            case 'a': putchar('\a'); break;
+            case 'b': putchar('\b'); break;
+            case 'f': putchar('\f'); break;
+            case 'v': putchar('\v'); break;
+            case '\\': putchar('\\'); break;
+            case 'c': return 1;
+            case '0': {
+                int value = 0, i;
+                for (i = 0; i < 3 && s[1] >= '0' && s[1] <= '7'; i++) value = value * 8 + *++s - '0';
+                putchar(value);
+                break;
+            }
+            default:
+                putchar('\\');
+                putchar(*s);
+        }
+    }
+    return 0;
+}
+
+static int echoBuiltin(int argc, char **argv, int in) {
+    (void)in;
+    int newline = 1, escapes = 0, i = 1;
+    for (; i < argc && argv[i][0] == '-' && argv[i][1] && strspn(argv[i] + 1, "neE") == strlen(argv[i] + 1); i++) {
+        const char *flag;
+        for (flag = argv[i] + 1; *flag; flag++) {
+            if (*flag == 'n') newline = 0;
+            else escapes = *flag == 'e';
+        }
+    }
+    for (; i < argc; i++) {
+        if (escapes && putEscaped(argv[i])) return 0;
+        if (!escapes) fputs(argv[i], stdout);
+        if (i + 1 < argc) putchar(' ');
+    }
+    if (newline) putchar('\n');
+    return 0;
+}
+
+/**
+ * The function prints one conversion of printf's format.
+ * @param spec The conversion, like %-5d.
+ * @param arg The argument or NULL when they ran out.
+ * @return 0 on success or 1 if the argument is not a number.
+ */
+static int printConversion(const char *spec, char conversion, const char *arg) {
+    char *end = NULL;
+    switch (conversion) {
+        case 'd': case 'i': {
+            long long value = arg ? strtoll(arg, &end, 0) : 0;
+            char format[SPEC_SIZE + 2];
+            snprintf(format, sizeof(format), "%.*sll%c", (int)strlen(spec) - 1, spec, conversion);
+            printf(format, value);
+            break;
+        }
+        case 'o': case 'u': case 'x': case 'X': {
+            unsigned long long value = arg ? strtoull(arg, &end, 0) : 0;
+            char format[SPEC_SIZE + 2];
+            snprintf(format, sizeof(format), "%.*sll%c", (int)strlen(spec) - 1, spec, conversion);
+            printf(format, value);
+            break;
+        }
+        case 'f': case 'e': case 'E': case 'g': case 'G': {
+            double value = arg ? strtod(arg, &end) : 0;
+            printf(spec, value);
+            break;
+        }
+        case 'c':
+            printf(spec, arg ? arg[0] : 0);
+            break;
+        case 'b':
+            if (arg) putEscaped(arg);
+            break;
+        default:
+            printf(spec, arg ? arg : "");
+    }
+    if (arg && end && (*end || end == arg)) {
+        fprintf(stderr, "printf: %s: invalid number\n", arg);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * The function prints printf's format once.
+ * @param args The arguments left, advanced past the ones used.
+ * @return The status.
+ */
+static int printFormat(const char *format, char ***args) {
+    int status = 0;
+    const char *p = format;
+    while (*p) {
+        if (*p == '\\') {
+            char escape[3] = {'\\', p[1], 0};
+            if (!p[1]) escape[1] = 0;
+            putEscaped(escape);
+            p += p[1] ? 2 : 1;
+            continue;
+        }
+        if (*p != '%') {
+            putchar(*p++);
+            continue;
+        }
+        if (p[1] == '%') {
+            putchar('%');
+            p += 2;
+            continue;
+        }
+        size_t len = 1 + strspn(p + 1, "-+ #0123456789.");
+        if (!p[len] || len + 2 > SPEC_SIZE || !strchr("diouxXfeEgGcsb", p[len])) {
+            fprintf(stderr, "printf: %s: invalid conversion\n", p);
+            return 1;
+        }
+        char spec[SPEC_SIZE];
+        memcpy(spec, p, len);
+        spec[len] = p[len] == 'b' ? 's' : p[len];
+        spec[len + 1] = 0;
+        const char *arg = **args;
+        if (arg) (*args)++;
+        status |= printConversion(spec, p[len], arg);
+        p += len + 1;
+    }
+    return status;
+}
+
+static int printfBuiltin(int argc, char **argv, int in) {
+    (void)in;
+    if (argc < 2) {
+        fprintf(stderr, "usage: printf FORMAT [ARGS...]\n");
+        return 2;
+    }
+    char **args = argv + 2;
+    int status = 0;
+    // like coreutils, the format is reused while arguments are left
+    do {
+        char **before = args;
+        status |= printFormat(argv[1], &args);
+        if (args == before) break;
+    } while (*args);
+    return status;
+}
+
+/**
+ * The function parses test's integer operand.
+ * @return 0 on success or -1 if it is not an integer.
+ */
+static int parseInteger(const char *s, long long *value) {
+    char *end;
+    errno = 0;
+    *value = strtoll(s, &end, 10);
+    if (end == s || *end || errno) {
+        fprintf(stderr, "test: %s: integer expression expected\n", s);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * The function evaluates test's unary operators.
+ * @return 0 if true, 1 if false or 2 for an unknown operator.
+ */
+static int testUnary(const char *op, const char *arg) {
+    struct stat st;
+    if (strcmp(op, "-n") == 0) return !*arg;
+    if (strcmp(op, "-z") == 0) return *arg != 0;
+    if (strcmp(op, "-r") == 0) return access(arg, R_OK) != 0;
+    if (strcmp(op, "-w") == 0) return access(arg, W_OK) != 0;
+    if (strcmp(op, "-x") == 0) return access(arg, X_OK) != 0;
+    if (strcmp(op, "-L") == 0 || strcmp(op, "-h") == 0) return lstat(arg, &st) != 0 || !S_ISLNK(st.st_mode);
+    if (strlen(op) != 2 || op[0] != '-' || !strchr("efdsp", op[1])) return 2;
+    if (stat(arg, &st) != 0) return 1;
+    switch (op[1]) {
+        case 'f': return !S_ISREG(st.st_mode);
+        case 'd': return !S_ISDIR(st.st_mode);
+        case 's': return st.st_size == 0;
+        case 'p': return !S_ISFIFO(st.st_mode);
+        default: return 0;
+    }
+}
+
+/**
+ * The function evaluates test's binary operators.
+ * @return 0 if true, 1 if false or 2 for an unknown operator.
+ */
+static int testBinary(const char *left, const char *op, const char *right) {
+    if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0) return strcmp(left, right) != 0;
+    if (strcmp(op, "!=") == 0) return strcmp(left, right) == 0;
+    static const char *ops[] = {"-eq", "-ne", "-lt", "-le", "-gt", "-ge"};
+    int i;
+    for (i = 0; i < 6 && strcmp(op, ops[i]); i++);
+    if (i == 6) return 2;
+    long long a, b;
+    if (parseInteger(left, &a) < 0 || parseInteger(right, &b) < 0) return 2;
+    int result[6] = {a == b, a != b, a < b, a <= b, a > b, a >= b};
+    return !result[i];
+}
+
+/**
+ * The function evaluates test's POSIX forms by the number of arguments.
+ * @return 0 if true, 1 if false or 2 on an error.
+ */
+static int testArgs(int argc, char **argv) {
+    if (argc == 0) return 1;
+    if (argc == 1) return !*argv[0];
+    if (strcmp(argv[0], "!") == 0 && argc <= 4) {
+        int result = testArgs(argc - 1, argv + 1);
+        return result == 2 ? 2 : !result;
+    }
+    if (argc == 2) return testUnary(argv[0], argv[1]);
+    if (argc == 3) return testBinary(argv[0], argv[1], argv[2]);
+    return 2;
+}
+
+static int testBuiltin(int argc, char **argv, int in) {
+    (void)in;
+    if (strcmp(argv[0], "[") == 0) {
+        if (strcmp(argv[argc - 1], "]") != 0) {
+            fprintf(stderr, "[: missing ]\n");
+            return 2;
+        }
+        argc--;
+    }
+    int result = testArgs(argc - 1, argv + 1);
+    if (result == 2) fprintf(stderr, "%s: bad expression\n", argv[0]);
+    return result;
+}
+
+static int sleepBuiltin(int argc, char **argv, int in) {
+    (void)in;
+    double seconds = 0;
+    int i;
+    for (i = 1; i < argc; i++) {
+        char *end;
+        double value = strtod(argv[i], &end);
+        double unit = *end == 'm' ? 60 : *end == 'h' ? 3600 : *end == 'd' ? 86400 : 1;
+        if (end == argv[i] || value < 0 || (*end && (strchr("smhd", *end) == NULL || end[1]))) {
+            fprintf(stderr, "sleep: %s: invalid time interval\n", argv[i]);
+            return 1;
+        }
+        seconds += value * unit;
+    }
+    if (argc < 2) {
+        fprintf(stderr, "usage: sleep SECONDS...\n");
+        return 1;
+    }
+    // the shell runs the builtin itself, so it keeps the timeouts going
+    // about 31 years stands in for longer sleeps, sleep inf among them
+    sleepFor(seconds < 1e9 ? (long long)(seconds * 1e9) : 1000000000000000000LL);
+    return 0;
+}
+
+/**
+ * The function copies an fd to stdout.
+ * @return 0 on success or -1 on failure.
+ */
+static int copyFd(int fd) {
+    char buf[CAT_BUF_SIZE];
+    for (;;) {
+        // a pipe or a terminal may block, the timeouts are kept going meanwhile
+        waitInput(fd);
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        if (n == 0) return 0;
+        if (fwrite(buf, 1, n, stdout) != (size_t)n) return -1;
+    }
+}
+
+static int catBuiltin(int argc, char **argv, int in) {
+    int status = 0, i;
+    for (i = argc > 1 ? 1 : 0; i < argc; i++) {
+        if (i == 0 || strcmp(argv[i], "-") == 0) {
+            if (in >= 0) {
+                if (copyFd(in) < 0) status = 1;
+                continue;
+            }
+            // the shell's stdin is buffered, so it is read through stdio
+            char buf[CAT_BUF_SIZE];
+            size_t n;
+            while ((n = fread(buf, 1, sizeof(buf), stdin)) > 0) fwrite(buf, 1, n, stdout);
+            clearerr(stdin);
+            continue;
+        }
+        int fd = open(argv[i], O_RDONLY | O_CLOEXEC);
+        if (fd < 0 || copyFd(fd) < 0) {
+            perror(argv[i]);
+            status = 1;
+        }
+        if (fd >= 0) close(fd);
+    }
+    return status;
+}
+
+static const struct {
+    const char *name;
+    BuiltinFunction function;
+} builtins[] = {
+    {"true", trueBuiltin},
+    {"false", falseBuiltin},
+    {"echo", echoBuiltin},
+    {"printf", printfBuiltin},
+    {"test", testBuiltin},
+    {"[", testBuiltin},
+    {"sleep", sleepBuiltin},
+    {"cat", catBuiltin},
+};
+
+BuiltinFunction findBuiltin(const char *name) {
+    if (builtinsEnabled < 0) builtinsEnabled = getenv("EX2_EXTERNAL_BUILTINS") == NULL;
+    if (!builtinsEnabled) return NULL;
+    size_t i;
+    for (i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++) {
+        if (strcmp(builtins[i].name, name) == 0) return builtins[i].function;
+    }
+    return NULL;
+}
+
+int switchBuiltins(char **args) {
+    if (builtinsEnabled < 0) builtinsEnabled = getenv("EX2_EXTERNAL_BUILTINS") == NULL;
+    if (!args[1]) {
+        printf("builtins %s\n", builtinsEnabled ? "on" : "off");
+        return 0;
+    }
+    if (strcmp(args[1], "on") == 0 || strcmp(args[1], "off") == 0) {
+        builtinsEnabled = strcmp(args[1], "on") == 0;
+        return 0;
+    }
+    fprintf(stderr, "usage: builtins [on|off]\n");
+    return 2;
+}
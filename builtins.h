@@ -0,0 +1,29 @@
+#ifndef EX2_BUILTINS_H
+#define EX2_BUILTINS_H
+
+/**
+ * An in-process version of a common utility.
+ * @param argc The number of arguments.
+ * @param argv The NULL terminated arguments, starting with the name.
+ * @param in The fd stdin is redirected from, or -1 for the shell's stdin.
+ * @return The exit status.
+ */
+typedef int (*BuiltinFunction)(int argc, char **argv, int in);
+
+/**
+ * The function finds the in-process version of a utility: true, false,
+ * echo, printf, test, [, sleep or cat. They are skipped when
+ * EX2_EXTERNAL_BUILTINS is set in the environment or after builtins off.
+ * @param name The command's name.
+ * @return The function or NULL if the command runs externally.
+ */
+BuiltinFunction findBuiltin(const char *name);
+/**
+ * The function runs the builtins builtin: builtins on|off switches the
+ * in-process utilities, without an argument it prints whether they are on.
+ * @param args The builtin's NULL terminated argv.
+ * @return 0 on success or 2 on a usage error.
+ */
+int switchBuiltins(char **args);
+
+#endif
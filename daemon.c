@@ -0,0 +1,523 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <wait.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "expand.h"
+#include "jobs.h"
+#include "reap.h"
+#include "metrics.h"
+#include "trace.h"
+#include "launch.h"
+#include "daemon.h"
+
+#define MAX_EVENTS 256
+#define LISTEN_BACKLOG 1024
+#define READ_CHUNK 65536
+#define BAD_SOCKET "Error opening daemon socket\n"
+
+extern char **environ;
+
+typedef struct {
+    int fd;
+    char *in;
+    size_t inSize;
+    size_t inCapacity;
+    char *out;
+    size_t outSize;
+    size_t outCapacity;
+    int watchingOut;
+} Client;
+
+/* epoll tags for the fds that are not clients */
+static char listenTag, signalTag, reaperTag;
+
+static int epollFd = -1;
+/* waits for the jobs and reads their stdout, io_uring when available */
+static Reaper *reaper = NULL;
+/* clients indexed by their fd, so a job's owner is found in O(1) */
+static Client **clients = NULL;
+static int clientsCapacity = 0;
+
+/**
+ * The function makes sure a buffer can hold size more bytes.
+ * @return 0 on success or -1 on bad alloc.
+ */
+static int reserve(char **buffer, size_t *capacity, size_t used, size_t size) {
+    if (used + size <= *capacity) return 0;
+    size_t newCapacity = *capacity ? *capacity : 4096;
+    while (used + size > newCapacity) newCapacity *= 2;
+    char *grown = (char *)realloc(*buffer, newCapacity);
+    if (!grown) return -1;
+    *buffer = grown;
+    *capacity = newCapacity;
+    return 0;
+}
+
+/**
+ * The function writes as much of the client's pending output as the socket
+ * takes, and watches for writability while some is left.
+ * @param client The client.
+ */
+static void flushClient(Client *client) {
+    size_t written = 0;
+    while (written < client->outSize) {
+        ssize_t n = write(client->fd, client->out + written, client->outSize - written);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        written += n;
+    }
+    memmove(client->out, client->out + written, client->outSize - written);
+    client->outSize -= written;
+    int watch = client->outSize > 0;
+    if (watch != client->watchingOut) {
+        struct epoll_event event;
+        event.events = EPOLLIN | (watch ? EPOLLOUT : 0);
+        event.data.ptr = client;
+        epoll_ctl(epollFd, EPOLL_CTL_MOD, client->fd, &event);
+        client->watchingOut = watch;
+    }
+}
+
+/**
+ * The function queues a message to a client.
+ * @param client The client.
+ * @param type The message's type.
+ * @param body The message's body.
+ * @param size The body's size.
+ */
+static void sendMessage(Client *client, char type, const void *body, size_t size) {
+    uint32_t length = size + 1;
+    if (reserve(&client->out, &client->outCapacity, client->outSize, sizeof(length) + length) < 0) {
+        perror(BAD_ALLOC);
+        return;
+    }
+    memcpy(client->out + client->outSize, &length, sizeof(length));
+    client->out[client->outSize + sizeof(length)] = type;
+    memcpy(client->out + client->outSize + sizeof(length) + 1, body, size);
+    client->outSize += sizeof(length) + length;
+    if (!client->watchingOut) flushClient(client);
+}
+
+/**
+ * The function closes a client's connection, its jobs keep running.
+ * @param client The client.
+ * @param jobsQueue The jobsQueue.
+ */
+static void closeClient(Client *client, JobsQueue *jobsQueue) {
+    Job *job;
+    for (job = jobsQueue->first; job; job = job->next) {
+        if (job->owner == client->fd) job->owner = -1;
+    }
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, client->fd, NULL);
+    clients[client->fd] = NULL;
+    close(client->fd);
+    free(client->in);
+    free(client->out);
+    free(client);
+}
+
+/**
+ * The function accepts every pending connection.
+ * @param listenFd The listening socket.
+ */
+static void acceptClients(int listenFd) {
+    for (;;) {
+        int fd = accept4(listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) return;
+        if (fd >= clientsCapacity) {
+            int capacity = clientsCapacity ? clientsCapacity : 64;
+            while (fd >= capacity) capacity *= 2;
+            Client **grown = (Client **)realloc(clients, capacity * sizeof(Client *));
+            if (!grown) {
+                close(fd);
+                continue;
+            }
+            memset(grown + clientsCapacity, 0, (capacity - clientsCapacity) * sizeof(Client *));
+            clients = grown;
+            clientsCapacity = capacity;
+        }
+        Client *client = (Client *)calloc(1, sizeof(Client));
+        if (!client) {
+            close(fd);
+            continue;
+        }
+        client->fd = fd;
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = client;
+        if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) < 0) {
+            close(fd);
+            free(client);
+            continue;
+        }
+        clients[fd] = client;
+    }
+}
+
+/**
+ * The function splits a DAEMON_RUN body into cwd, argv and env.
+ * @param body The body, without the type byte.
+ * @param size The body's size.
+ * @param cwd Set to the job's cwd.
+ * @param args The list the argv words are copied to.
+ * @param env Set to a newly allocated, NULL terminated array of pointers into
+ * the body.
+ * @return 0 on success or -1 on a malformed message or bad alloc.
+ */
+static int parseRun(char *body, size_t size, char **cwd, ArgList *args, char ***env) {
+    if (size == 0 || body[size - 1] != 0) return -1;
+    char *curr = body, *end = body + size;
+    *cwd = curr;
+    curr += strlen(curr) + 1;
+    while (curr < end && *curr) {
+        char *word = strdup(curr);
+        if (!word || appendArg(args, word) < 0) {
+            free(word);
+            return -1;
+        }
+        curr += strlen(curr) + 1;
+    }
+    if (curr >= end || args->size == 0 || appendArg(args, NULL) < 0) return -1;
+    curr++;
+    int count = 0;
+    char *scan;
+    for (scan = curr; scan < end; scan += strlen(scan) + 1) count++;
+    *env = (char **)malloc((count + 1) * sizeof(char *));
+    if (!*env) return -1;
+    count = 0;
+    for (scan = curr; scan < end; scan += strlen(scan) + 1) (*env)[count++] = scan;
+    (*env)[count] = NULL;
+    return 0;
+}
+
+/**
+ * The function starts a submitted job and replies with its pid.
+ * @param client The client.
+ * @param body The DAEMON_RUN body.
+ * @param size The body's size.
+ * @param jobsQueue The jobsQueue.
+ * @param childMask The signal mask children start with.
+ * @return The jobsQueue.
+ */
+static JobsQueue *startJob(Client *client, char *body, size_t size, JobsQueue *jobsQueue,
+                           const sigset_t *childMask) {
+    char *cwd, **env = NULL;
+    ArgList args;
+    initArgList(&args);
+    int32_t reply = -EINVAL;
+    TRACE(TRACE_INPUT_READ, 0, size);
+    if (parseRun(body, size, &cwd, &args, &env) < 0) {
+        freeArgList(&args);
+        free(env);
+        sendMessage(client, DAEMON_STARTED, &reply, sizeof(reply));
+        return jobsQueue;
+    }
+    Job *job = newJob(args.args, args.size - 1);
+    if (job) TRACE(TRACE_PARSE_DONE, 0, job->argc);
+    int out[2];
+    if (job && takeLaunchOptions(job) < 0) {
+        deleteJob(job);
+        job = NULL;
+        errno = EINVAL;
+    }
+    if (!job || pipe2(out, O_CLOEXEC) < 0) {
+        reply = -errno;
+        deleteJob(job);
+        free(env);
+        sendMessage(client, DAEMON_STARTED, &reply, sizeof(reply));
+        return jobsQueue;
+    }
+    long long started = nowNs();
+    pid_t pid = fork();
+    if (pid == 0) {
+        sigprocmask(SIG_SETMASK, childMask, NULL);
+        signal(SIGPIPE, SIG_DFL);
+        int devNull = open("/dev/null", O_RDONLY);
+        // the fd would leak into the command unless it already is stdin
+        if (devNull > 0) {
+            dup2(devNull, 0);
+            close(devNull);
+        }
+        dup2(out[1], 1);
+        if (*cwd && chdir(cwd) < 0) _exit(126);
+        if (env[0]) environ = env;
+        if (applyLaunchOptions(&job->launch) < 0) _exit(126);
+        execvp(job->args[0], job->args);
+        _exit(127);
+    }
+    free(env);
+    close(out[1]);
+    if (pid < 0) {
+        reply = -errno;
+        close(out[0]);
+        deleteJob(job);
+        metrics.forkFailures++;
+        perror(UNSUCCESSFUL_FORK);
+        sendMessage(client, DAEMON_STARTED, &reply, sizeof(reply));
+        return jobsQueue;
+    }
+    metrics.commandsLaunched++;
+    metrics.jobsRunning++;
+    TRACE_AT(TRACE_FORK, started, pid, 0);
+    job->pid = pid;
+    job->started = started;
+    job->owner = client->fd;
+    job->pending = 0;
+    if (watchChild(reaper, pid, job) == 0) job->pending++;
+    if (watchOutput(reaper, out[0], job) == 0) job->pending++;
+    else close(out[0]);
+    jobsQueue = addJob(jobsQueue, job);
+    reply = pid;
+    sendMessage(client, DAEMON_STARTED, &reply, sizeof(reply));
+    return jobsQueue;
+}
+
+/**
+ * The function replies with the listing of the daemon's jobs.
+ * @param client The client.
+ * @param jobsQueue The jobsQueue.
+ */
+static void listJobs(Client *client, JobsQueue *jobsQueue) {
+    char *text = NULL;
+    size_t size = 0, capacity = 0;
+    Job *job;
+    for (job = jobsQueue->first; job; job = job->next) {
+        char pid[16];
+        int len = snprintf(pid, sizeof(pid), "%d\t", job->pid);
+        if (reserve(&text, &capacity, size, len) < 0) break;
+        memcpy(text + size, pid, len);
+        size += len;
+        int i;
+        for (i = 0; job->args[i]; i++) {
+            size_t argLen = strlen(job->args[i]);
+            if (reserve(&text, &capacity, size, argLen + 2) < 0) break;
+            memcpy(text + size, job->args[i], argLen);
+            size += argLen;
+            text[size++] = ' ';
+        }
+        if (reserve(&text, &capacity, size, 1) < 0) break;
+        text[size++] = '\n';
+    }
+    sendMessage(client, DAEMON_LISTING, text, size);
+    free(text);
+}
+
+/**
+ * The function reads from a client and handles its complete messages.
+ * @param client The client.
+ * @param jobsQueue The jobsQueue.
+ * @param childMask The signal mask children start with.
+ * @return The jobsQueue.
+ */
+static JobsQueue *readClient(Client *client, JobsQueue *jobsQueue, const sigset_t *childMask) {
+    int hungUp = 0;
+    for (;;) {
+        if (reserve(&client->in, &client->inCapacity, client->inSize, READ_CHUNK) < 0) {
+            closeClient(client, jobsQueue);
+            return jobsQueue;
+        }
+        ssize_t n = read(client->fd, client->in + client->inSize, READ_CHUNK);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && errno == EAGAIN) break;
+        if (n <= 0) {
+            // a client that half-closed after its requests still gets them
+            // run, so the buffered messages are handled before it is closed
+            hungUp = 1;
+            break;
+        }
+        client->inSize += n;
+    }
+    size_t offset = 0;
+    while (client->inSize - offset >= sizeof(uint32_t)) {
+        uint32_t length;
+        memcpy(&length, client->in + offset, sizeof(length));
+        if (length == 0 || length > DAEMON_MAX_MESSAGE) {
+            closeClient(client, jobsQueue);
+            return jobsQueue;
+        }
+        if (client->inSize - offset - sizeof(length) < length) break;
+        char *message = client->in + offset + sizeof(length);
+        if (message[0] == DAEMON_RUN) {
+            jobsQueue = startJob(client, message + 1, length - 1, jobsQueue, childMask);
+        } else if (message[0] == DAEMON_JOBS) {
+            listJobs(client, jobsQueue);
+        }
+        offset += sizeof(length) + length;
+    }
+    memmove(client->in, client->in + offset, client->inSize - offset);
+    client->inSize -= offset;
+    if (hungUp) {
+        flushClient(client);
+        closeClient(client, jobsQueue);
+    }
+    return jobsQueue;
+}
+
+/**
+ * The function returns the client that submitted a job, if still connected.
+ * @param job The job.
+ * @return The client or NULL.
+ */
+static Client *jobOwner(Job *job) {
+    if (job->owner < 0 || job->owner >= clientsCapacity) return NULL;
+    return clients[job->owner];
+}
+
+/**
+ * The function handles the reaper's events: output is forwarded to the job's
+ * owner and a job is reported once it exited and its output hit EOF.
+ * @param jobsQueue The jobsQueue.
+ */
+static void handleReaped(JobsQueue *jobsQueue) {
+    ReapEvent events[MAX_EVENTS];
+    int n = reapEvents(reaper, events, MAX_EVENTS, 0);
+    int i;
+    for (i = 0; i < n; i++) {
+        Job *job = (Job *)events[i].tag;
+        Client *owner = jobOwner(job);
+        if (events[i].kind == REAP_OUTPUT && events[i].size > 0) {
+            if (!owner) continue;
+            size_t size = sizeof(int32_t) + events[i].size;
+            char body[size];
+            int32_t pid = job->pid;
+            memcpy(body, &pid, sizeof(pid));
+            memcpy(body + sizeof(pid), events[i].data, events[i].size);
+            sendMessage(owner, DAEMON_OUTPUT, body, size);
+            continue;
+        }
+        if (events[i].kind == REAP_OUTPUT) {
+            close(events[i].fd);
+            // the job exited before its output hit EOF
+            if (job->pending == 1 && !job->started) metrics.jobsPending--;
+        } else {
+            job->status = events[i].status;
+            TRACE(TRACE_CHILD_EXIT, job->pid, job->status);
+            // the child exits with 127 when its exec failed
+            if (WIFEXITED(job->status) && WEXITSTATUS(job->status) == 127) {
+                metrics.execFailures++;
+                TRACE(TRACE_EXEC_FAILED, job->pid, 0);
+            }
+            metrics.jobsReaped++;
+            metrics.jobsRunning--;
+            observeRuntime(nowNs() - job->started);
+            job->started = 0;
+            if (job->pending > 1) metrics.jobsPending++;
+        }
+        if (--job->pending > 0) continue;
+        removeJob(jobsQueue, job->pid);
+        if (owner) {
+            int32_t exited[2] = {job->pid, job->status};
+            sendMessage(owner, DAEMON_EXITED, exited, sizeof(exited));
+        }
+        deleteJob(job);
+    }
+}
+
+/**
+ * The function opens the daemon's listening socket.
+ * @param socketPath The socket's path.
+ * @return The socket or -1 on failure.
+ */
+static int listenOn(const char *socketPath) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, socketPath);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    unlink(socketPath);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, LISTEN_BACKLOG) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int runDaemon(const char *socketPath) {
+    JobsQueue *jobsQueue = createJobsQueue();
+    if (!jobsQueue) {
+        perror(BAD_ALLOC);
+        return 1;
+    }
+    sigset_t mask, childMask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigprocmask(SIG_BLOCK, &mask, &childMask);
+    signal(SIGPIPE, SIG_IGN);
+    int listenFd = listenOn(socketPath);
+    int signalFd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    reaper = createReaper(REAP_AUTO);
+    if (listenFd < 0 || signalFd < 0 || epollFd < 0 || !reaper) {
+        perror(BAD_SOCKET);
+        return 1;
+    }
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = &listenTag;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &event);
+    event.data.ptr = &signalTag;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, signalFd, &event);
+    event.data.ptr = &reaperTag;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, reaperFd(reaper), &event);
+
+    int running = 1;
+    struct epoll_event events[MAX_EVENTS];
+    while (running) {
+        int n = epoll_wait(epollFd, events, MAX_EVENTS, metricsDueMs());
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) break;
+        int i;
+        for (i = 0; i < n; i++) {
+            void *tag = events[i].data.ptr;
+            if (tag == &listenTag) {
+                acceptClients(listenFd);
+            } else if (tag == &signalTag) {
+                struct signalfd_siginfo info;
+                while (read(signalFd, &info, sizeof(info)) == sizeof(info)) running = 0;
+            } else if (tag == &reaperTag) {
+                handleReaped(jobsQueue);
+            } else {
+                Client *client = (Client *)tag;
+                if (events[i].events & EPOLLOUT) flushClient(client);
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                    jobsQueue = readClient(client, jobsQueue, &childMask);
+                }
+            }
+        }
+        // everything started in this round is submitted in one go
+        flushReaper(reaper);
+        flushMetrics(0);
+        flushTrace(0);
+    }
+    flushMetrics(1);
+    flushTrace(1);
+    int fd;
+    for (fd = 0; fd < clientsCapacity; fd++) {
+        if (clients[fd]) closeClient(clients[fd], jobsQueue);
+    }
+    free(clients);
+    close(listenFd);
+    close(signalFd);
+    close(epollFd);
+    freeReaper(reaper);
+    unlink(socketPath);
+    freeJobsQueue(jobsQueue);
+    return 0;
+}
@@ -0,0 +1,34 @@
+#ifndef EX2_DAEMON_H
+#define EX2_DAEMON_H
+
+/*
+ * Every message on the daemon's socket is a uint32 payload length followed by
+ * the payload, whose first byte is the message's type.
+ *
+ * DAEMON_RUN:     cwd, argv words, an empty word, then env words, all NUL
+ *                 terminated. An empty env keeps the daemon's environment.
+ * DAEMON_JOBS:    no body.
+ * DAEMON_STARTED: int32 pid, or -errno if the job could not be started. Sent
+ *                 once per DAEMON_RUN, in submission order.
+ * DAEMON_OUTPUT:  int32 pid and a chunk of the job's stdout. All of a job's
+ *                 output is sent before its DAEMON_EXITED.
+ * DAEMON_EXITED:  int32 pid and int32 wait status.
+ * DAEMON_LISTING: the jobs' text, one "pid\targs" line per job.
+ */
+#define DAEMON_RUN 'R'
+#define DAEMON_JOBS 'J'
+#define DAEMON_STARTED 'P'
+#define DAEMON_OUTPUT 'O'
+#define DAEMON_EXITED 'X'
+#define DAEMON_LISTING 'L'
+#define DAEMON_MAX_MESSAGE (1 << 20)
+
+/**
+ * The function runs ex2 as a job daemon listening on a unix domain socket,
+ * until it gets SIGINT or SIGTERM.
+ * @param socketPath The socket's path.
+ * @return The daemon's exit code.
+ */
+int runDaemon(const char *socketPath);
+
+#endif
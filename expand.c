@@ -0,0 +1,438 @@
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "expand.h"
+
+#define DENTS_BUF_SIZE (256 * 1024)
+#define LISTING_CACHE_SIZE 16
+#define LISTING_TTL_NSEC 2000000000LL
+#define GLOB_CHARS "*?["
+
+/* the kernel's record layout for getdents64 */
+typedef struct {
+    ino64_t d_ino;
+    off64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+} LinuxDirent64;
+
+typedef struct {
+    char *name;
+    size_t offset;
+    unsigned char type;
+} Entry;
+
+typedef struct {
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    long long loadedAt;
+    unsigned long lastUsed;
+    int pinned;
+    char *names;
+    Entry *entries;
+    int count;
+} Listing;
+
+/* short-lived directory listings, each sorted once when it is read */
+static Listing listings[LISTING_CACHE_SIZE];
+static unsigned long useClock = 0;
+static char *dentsBuf = NULL;
+
+/**
+ * The function returns the monotonic time in nanoseconds.
+ * @return The time.
+ */
+static long long monotonicNow();
+/**
+ * The function reads all of a directory's entries with getdents64.
+ * @param fd The directory.
+ * @param listing The listing to fill, its old contents must be freed.
+ * @return 0 on success or -1 on failure.
+ */
+static int readListing(int fd, Listing *listing);
+/**
+ * The function frees a listing's names and entries.
+ * @param listing The listing.
+ */
+static void clearListing(Listing *listing);
+/**
+ * The function returns the listing of a directory, from the cache if the
+ * directory's inode and mtime are unchanged. The listing is pinned until
+ * releaseListing is called.
+ * @param dirPath The directory's path.
+ * @return The listing or NULL on failure.
+ */
+static Listing *loadListing(const char *dirPath);
+/**
+ * The function unpins a listing returned by loadListing.
+ * @param listing The listing.
+ */
+static void releaseListing(Listing *listing);
+/**
+ * The function expands the pattern's remaining components under a directory.
+ * @param dirPath The directory prefix, empty or ending with /.
+ * @param rest The remaining pattern.
+ * @param list The list to append to.
+ * @return the number of matches or -1 on failure.
+ */
+static int expandFrom(const char *dirPath, const char *rest, ArgList *list);
+
+void initArgList(ArgList *list) {
+    list->args = NULL;
+    list->size = 0;
+    list->capacity = 0;
+}
+
+int appendArg(ArgList *list, char *arg) {
+    if (list->size == list->capacity) {
+        int capacity = list->capacity ? list->capacity * 2 : 16;
+        char **args = (char **)realloc(list->args, capacity * sizeof(char *));
+        if (!args) return -1;
+        list->args = args;
+        list->capacity = capacity;
+    }
+    list->args[list->size++] = arg;
+    return 0;
+}
+
+void freeArgList(ArgList *list) {
+    int i;
+    for (i = 0; i < list->size; i++) free(list->args[i]);
+    free(list->args);
+    initArgList(list);
+}
+
+int hasGlob(const char *word) { return strpbrk(word, GLOB_CHARS) != NULL; }
+
+/**
+ * The function matches a char against the bracket expression at *pattern.
+ * @param pattern Points at the '[', advanced past the ']' on success.
+ * @param c The char.
+ * @return 1 on match, 0 on mismatch or -1 if the expression is not closed.
+ */
+static int classMatch(const char **pattern, char c) {
+    const char *p = *pattern + 1;
+    int negate = 0, matched = 0;
+    if (*p == '!' || *p == '^') {
+        negate = 1;
+        p++;
+    }
+    const char *start = p;
+    while (*p && (*p != ']' || p == start)) {
+        unsigned char lo = *p, hi;
+        if (lo == '\\' && p[1]) lo = *++p;
+        hi = lo;
+        if (p[1] == '-' && p[2] && p[2] != ']') {
+            p += 2;
+            if (*p == '\\' && p[1]) p++;
+            hi = *p;
+        }
+        if ((unsigned char)c >= lo && (unsigned char)c <= hi) matched = 1;
+        p++;
+    }
+    if (*p != ']') return -1;
+    *pattern = p + 1;
+    return matched != negate;
+}
+
+int globMatch(const char *pattern, const char *name) {
+    const char *p = pattern, *n = name, *starP = NULL, *starN = NULL;
+    while (*n) {
+        if (*p == '*') {
+            while (*p == '*') p++;
+            if (!*p) return 1;
+            starP = p;
+            starN = n;
+            continue;
+        }
+        const char *next = p + 1;
+        int ok;
+        if (*p == '?') {
+            ok = 1;
+        } else if (*p == '[') {
+            next = p;
+            ok = classMatch(&next, *n);
+            if (ok < 0) {
+                ok = (*n == '[');
+                next = p + 1;
+            }
+        } else if (*p == '\\' && p[1]) {
+            ok = (p[1] == *n);
+            next = p + 2;
+        } else {
+            ok = (*p && *p == *n);
+        }
+        if (ok) {
+            p = next;
+            n++;
+            continue;
+        }
+        if (!starP) return 0;
+        p = starP;
+        n = ++starN;
+    }
+    while (*p == '*') p++;
+    return *p == 0;
+}
+
+static long long monotonicNow() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static int compareEntries(const void *a, const void *b) {
+    return strcmp(((const Entry *)a)->name, ((const Entry *)b)->name);
+}
+
+static int readListing(int fd, Listing *listing) {
+    if (!dentsBuf) dentsBuf = (char *)malloc(DENTS_BUF_SIZE);
+    if (!dentsBuf) return -1;
+    size_t used = 0, namesCap = 4096;
+    int count = 0, entriesCap = 64;
+    char *names = (char *)malloc(namesCap);
+    Entry *entries = (Entry *)malloc(entriesCap * sizeof(Entry));
+    if (!names || !entries) goto fail;
+    for (;;) {
+        long n = syscall(SYS_getdents64, fd, dentsBuf, DENTS_BUF_SIZE);
+        if (n < 0) goto fail;
+        if (n == 0) break;
+        long pos = 0;
+        while (pos < n) {
+            LinuxDirent64 *dirent = (LinuxDirent64 *)(dentsBuf + pos);
+            pos += dirent->d_reclen;
+            const char *name = dirent->d_name;
+            if (name[0] == '.' && (!name[1] || (name[1] == '.' && !name[2]))) continue;
+            size_t len = strlen(name) + 1;
+            if (used + len > namesCap) {
+                while (used + len > namesCap) namesCap *= 2;
+                char *grown = (char *)realloc(names, namesCap);
+                if (!grown) goto fail;
+                names = grown;
+            }
+            if (count == entriesCap) {
+                entriesCap *= 2;
+                Entry *grown = (Entry *)realloc(entries, entriesCap * sizeof(Entry));
+                if (!grown) goto fail;
+                entries = grown;
+            }
+            memcpy(names + used, name, len);
+            entries[count].offset = used;
+            entries[count].type = dirent->d_type;
+            count++;
+            used += len;
+        }
+    }
+    // names may have moved while growing, so pointers are fixed up only now
+    int i;
+    for (i = 0; i < count; i++) entries[i].name = names + entries[i].offset;
+    qsort(entries, count, sizeof(Entry), compareEntries);
+    listing->names = names;
+    listing->entries = entries;
+    listing->count = count;
+    return 0;
+fail:
+    free(names);
+    free(entries);
+    return -1;
+}
+
+static void clearListing(Listing *listing) {
+    free(listing->names);
+    free(listing->entries);
+    listing->names = NULL;
+    listing->entries = NULL;
+    listing->count = 0;
+    listing->ino = 0;
+    listing->dev = 0;
+}
+
+static Listing *loadListing(const char *dirPath) {
+    int fd = open(*dirPath ? dirPath : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+    struct stat dirStat;
+    if (fstat(fd, &dirStat) < 0) {
+        close(fd);
+        return NULL;
+    }
+    long long now = monotonicNow();
+    Listing *slot = NULL;
+    int i;
+    for (i = 0; i < LISTING_CACHE_SIZE; i++) {
+        Listing *curr = &listings[i];
+        if (curr->names && curr->dev == dirStat.st_dev && curr->ino == dirStat.st_ino) {
+            if (curr->mtime.tv_sec == dirStat.st_mtim.tv_sec && curr->mtime.tv_nsec == dirStat.st_mtim.tv_nsec
+                && now - curr->loadedAt < LISTING_TTL_NSEC) {
+                close(fd);
+                curr->lastUsed = ++useClock;
+                curr->pinned++;
+                return curr;
+            }
+            if (!curr->pinned) slot = curr;
+            break;
+        }
+    }
+    for (i = 0; !slot && i < LISTING_CACHE_SIZE; i++) {
+        Listing *curr = &listings[i];
+        if (curr->pinned) continue;
+        if (!slot || !curr->names || curr->lastUsed < slot->lastUsed) slot = curr;
+        if (!curr->names) break;
+    }
+    if (!slot) {
+        // every slot is in use further up the pattern, read an uncached copy
+        slot = (Listing *)calloc(1, sizeof(Listing));
+        if (!slot) {
+            close(fd);
+            return NULL;
+        }
+        slot->pinned = -1;
+    } else {
+        clearListing(slot);
+    }
+    int err = readListing(fd, slot);
+    close(fd);
+    if (err < 0) {
+        if (slot->pinned < 0) free(slot);
+        return NULL;
+    }
+    if (slot->pinned < 0) return slot;
+    slot->dev = dirStat.st_dev;
+    slot->ino = dirStat.st_ino;
+    slot->mtime = dirStat.st_mtim;
+    slot->loadedAt = now;
+    slot->lastUsed = ++useClock;
+    slot->pinned = 1;
+    return slot;
+}
+
+static void releaseListing(Listing *listing) {
+    if (listing->pinned < 0) {
+        clearListing(listing);
+        free(listing);
+        return;
+    }
+    listing->pinned--;
+}
+
+/**
+ * The function allocates the concatenation of a directory prefix, a name and
+ * an optional suffix.
+ * @return The new string or NULL on bad alloc.
+ */
+static char *concatPath(const char *dirPath, const char *name, size_t nameLen, const char *suffix) {
+    size_t dirLen = strlen(dirPath), suffixLen = strlen(suffix);
+    char *path = (char *)malloc(dirLen + nameLen + suffixLen + 1);
+    if (!path) return NULL;
+    memcpy(path, dirPath, dirLen);
+    memcpy(path + dirLen, name, nameLen);
+    memcpy(path + dirLen + nameLen, suffix, suffixLen + 1);
+    return path;
+}
+
+static int expandFrom(const char *dirPath, const char *rest, ArgList *list) {
+    const char *end = strchr(rest, '/');
+    size_t compLen = end ? (size_t)(end - rest) : strlen(rest);
+    const char *next = end;
+    while (next && *next == '/') next++;
+    int last = !next || !*next;
+    int dirsOnly = last && end;
+    char comp[compLen + 1];
+    memcpy(comp, rest, compLen);
+    comp[compLen] = 0;
+
+    if (!hasGlob(comp)) {
+        char *path = concatPath(dirPath, comp, compLen, (last && !dirsOnly) ? "" : "/");
+        if (!path) return -1;
+        int matches;
+        if (last) {
+            struct stat st;
+            if (fstatat(AT_FDCWD, path, &st, AT_SYMLINK_NOFOLLOW) < 0) {
+                free(path);
+                return 0;
+            }
+            return appendArg(list, path) < 0 ? (free(path), -1) : 1;
+        }
+        matches = expandFrom(path, next, list);
+        free(path);
+        return matches;
+    }
+
+    Listing *listing = loadListing(dirPath);
+    if (!listing) return 0;
+    int matches = 0, i;
+    for (i = 0; i < listing->count && matches >= 0; i++) {
+        Entry *entry = &listing->entries[i];
+        if (entry->name[0] == '.' && comp[0] != '.') continue;
+        if (!globMatch(comp, entry->name)) continue;
+        int maybeDir = entry->type == DT_DIR || entry->type == DT_LNK || entry->type == DT_UNKNOWN;
+        if ((!last || dirsOnly) && !maybeDir) continue;
+        char *path = concatPath(dirPath, entry->name, strlen(entry->name), last && !dirsOnly ? "" : "/");
+        if (!path) {
+            matches = -1;
+            break;
+        }
+        if (last && (!dirsOnly || entry->type == DT_DIR)) {
+            if (appendArg(list, path) < 0) {
+                free(path);
+                matches = -1;
+            } else {
+                matches++;
+            }
+            continue;
+        }
+        int found;
+        if (last) {
+            // a link or unknown type only counts if it resolves to a directory
+            struct stat st;
+            found = (stat(path, &st) == 0 && S_ISDIR(st.st_mode));
+            if (found && appendArg(list, path) == 0) {
+                matches++;
+                continue;
+            }
+            free(path);
+            if (found) matches = -1;
+            continue;
+        }
+        found = expandFrom(path, next, list);
+        free(path);
+        if (found < 0) matches = -1;
+        else matches += found;
+    }
+    releaseListing(listing);
+    return matches;
+}
+
+int expandGlob(const char *pattern, ArgList *list) {
+    if (pattern[0] == '/') {
+        while (*pattern == '/') pattern++;
+        return expandFrom("/", pattern, list);
+    }
+    return expandFrom("", pattern, list);
+}
+
+int splitWords(char *line, ArgList *list) {
+    const char space[2] = " ";
+    char *token = strtok(line, space);
+    while (token) {
+        int matches = 0;
+        if (hasGlob(token)) matches = expandGlob(token, list);
+        if (matches < 0) return -1;
+        // like bash, a pattern that matches nothing is passed as is
+        if (matches == 0) {
+            char *word = strdup(token);
+            if (!word || appendArg(list, word) < 0) {
+                free(word);
+                return -1;
+            }
+        }
+        token = strtok(NULL, space);
+    }
+    return 0;
+}
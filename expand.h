@@ -0,0 +1,59 @@
+#ifndef EX2_EXPAND_H
+#define EX2_EXPAND_H
+
+#include <sys/types.h>
+
+typedef struct {
+    char **args;
+    int size;
+    int capacity;
+} ArgList;
+
+/**
+ * The function initializes an empty ArgList.
+ * @param list The list.
+ */
+void initArgList(ArgList *list);
+/**
+ * The function appends an arg to the list, the list takes ownership of it.
+ * @param list The list.
+ * @param arg The arg, may be NULL to terminate the list.
+ * @return 0 on success or -1 on bad alloc.
+ */
+int appendArg(ArgList *list, char *arg);
+/**
+ * The function frees the list's args and the list's array.
+ * @param list The list.
+ */
+void freeArgList(ArgList *list);
+/**
+ * The function returns 1 if the word has glob characters and 0 else.
+ * @param word The word.
+ * @return 1 if the word is a glob pattern and 0 else.
+ */
+int hasGlob(const char *word);
+/**
+ * The function matches a single path component against a glob pattern.
+ * Supports *, ?, [...] with ranges and ! or ^ negation, and \ escapes.
+ * @param pattern The pattern.
+ * @param name The name.
+ * @return 1 on match and 0 else.
+ */
+int globMatch(const char *pattern, const char *name);
+/**
+ * The function expands a glob pattern and appends the sorted matches to the
+ * list, directory listings are cached by inode and mtime for a short while.
+ * @param pattern The pattern, may span several path components.
+ * @param list The list to append to.
+ * @return the number of matches or -1 on failure.
+ */
+int expandGlob(const char *pattern, ArgList *list);
+/**
+ * The function splits a line into words and expands the glob patterns.
+ * @param line The line, it is modified.
+ * @param list The list to append the words to.
+ * @return 0 on success or -1 on bad alloc.
+ */
+int splitWords(char *line, ArgList *list);
+
+#endif
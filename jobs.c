@@ -0,0 +1,496 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <wait.h>
+#include <sys/uio.h>
+#include "script.h"
+#include "metrics.h"
+#include "trace.h"
+#include "jobtable.h"
+#include "sigchld.h"
+#include "timeout.h"
+#include "jobs.h"
+
+/* how many exits are taken from the SIGCHLD ring at once */
+#define EXIT_BATCH 64
+/* jobs renders into this many chunks of this size, then writes them at once */
+#define RENDER_CHUNKS 8
+#define RENDER_CHUNK_SIZE 65536
+
+typedef struct {
+    struct iovec chunks[RENDER_CHUNKS];
+    int used;
+    int failed;
+} Output;
+
+static char renderBuffer[RENDER_CHUNKS][RENDER_CHUNK_SIZE];
+
+Job *newJob(char **n_args, int n_argc) {
+    Job *job = (Job *)malloc(sizeof(Job));
+    if (!job) {
+        freeArgs(n_args);
+        free(n_args);
+        perror(BAD_ALLOC);
+        return NULL;
+    }
+    job->jobName = n_args[0];
+    job->args = n_args;
+    job->argc = n_argc;
+    job->owner = -1;
+    job->status = 0;
+    job->pending = 0;
+    job->started = 0;
+    job->stdinFd = -1;
+    job->stageFds = NULL;
+    job->stageFdCount = 0;
+    job->pidfd = -1;
+    job->slot = -1;
+    job->watched = 0;
+    memset(&job->launch, 0, sizeof(job->launch));
+    job->launch.ioPriority = -1;
+    job->launch.policy = -1;
+    job->timer = -1;
+    job->pgid = 0;
+    job->prev = NULL;
+    job->next = NULL;
+    job->prevByName = NULL;
+    job->nextByName = NULL;
+    job->stopped = 0;
+    job->prevStopped = NULL;
+    job->nextStopped = NULL;
+    return job;
+}
+void freeArgs(char *args[]) {
+    int i = 0;
+    while (args[i]) free(args[i++]);
+}
+void deleteJob(Job *job) {
+    if (!job) return;
+    if (job->stdinFd >= 0) close(job->stdinFd);
+    int i;
+    for (i = 0; i < job->stageFdCount; i++) {
+        if (job->stageFds[i] >= 0) close(job->stageFds[i]);
+    }
+    free(job->stageFds);
+    if (job->pidfd >= 0) close(job->pidfd);
+    cancelTimeout(job);
+    freeArgs(job->args);
+    free(job->args);
+    free(job);
+}
+/**
+ * The function returns the name index's bucket for a name.
+ */
+static JobList *nameBucket(JobsQueue *jobsQueue, const char *name) {
+    return &jobsQueue->byName[hashBytes(name, strlen(name)) % JOB_NAME_BUCKETS];
+}
+/**
+ * The function adds a job to the name index.
+ */
+static void indexJob(JobsQueue *jobsQueue, Job *job) {
+    JobList *bucket = nameBucket(jobsQueue, job->jobName);
+    job->prevByName = bucket->last;
+    job->nextByName = NULL;
+    if (bucket->last) bucket->last->nextByName = job;
+    else bucket->first = job;
+    bucket->last = job;
+}
+/**
+ * The function removes a job from the name index.
+ */
+static void unindexJob(JobsQueue *jobsQueue, Job *job) {
+    JobList *bucket = nameBucket(jobsQueue, job->jobName);
+    if (job->prevByName) job->prevByName->nextByName = job->nextByName;
+    else bucket->first = job->nextByName;
+    if (job->nextByName) job->nextByName->prevByName = job->prevByName;
+    else bucket->last = job->prevByName;
+    job->prevByName = job->nextByName = NULL;
+}
+/**
+ * The function puts a job in a free slot of the pid index.
+ */
+static void placePid(JobsQueue *jobsQueue, Job *job) {
+    int mask = jobsQueue->pidSlots - 1, i = pidHash(job->pid) & mask;
+    while (jobsQueue->byPid[i]) i = (i + 1) & mask;
+    jobsQueue->byPid[i] = job;
+}
+/**
+ * The function adds a job, which is linked already, to the pid index. A
+ * full index is rebuilt twice the size; when that fails the index is
+ * dropped and findJob walks the jobs until a later job rebuilds it.
+ */
+static void indexPid(JobsQueue *jobsQueue, Job *job) {
+    if (jobsQueue->size * 2 <= jobsQueue->pidSlots) {
+        placePid(jobsQueue, job);
+        return;
+    }
+    int slots = jobsQueue->pidSlots ? jobsQueue->pidSlots * 2 : JOB_PID_SLOTS;
+    while (jobsQueue->size * 2 > slots) slots *= 2;
+    free(jobsQueue->byPid);
+    jobsQueue->byPid = (Job **)calloc(slots, sizeof(Job *));
+    jobsQueue->pidSlots = jobsQueue->byPid ? slots : 0;
+    if (!jobsQueue->byPid) return;
+    Job *curr;
+    for (curr = jobsQueue->first; curr; curr = curr->next) placePid(jobsQueue, curr);
+}
+/**
+ * The function removes a job from the pid index, moving the jobs probed
+ * past its slot back so no probe stops short of them.
+ */
+static void unindexPid(JobsQueue *jobsQueue, Job *job) {
+    if (!jobsQueue->byPid) return;
+    int mask = jobsQueue->pidSlots - 1, i = pidHash(job->pid) & mask, j;
+    while (jobsQueue->byPid[i] != job) {
+        if (!jobsQueue->byPid[i]) return;
+        i = (i + 1) & mask;
+    }
+    for (j = i;;) {
+        j = (j + 1) & mask;
+        Job *moved = jobsQueue->byPid[j];
+        if (!moved) break;
+        int home = pidHash(moved->pid) & mask;
+        // the job can fill the hole unless the hole is before its home
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            jobsQueue->byPid[i] = moved;
+            i = j;
+        }
+    }
+    jobsQueue->byPid[i] = NULL;
+}
+/**
+ * The function moves a job in or out of the stopped jobs.
+ */
+static void setStopped(JobsQueue *jobsQueue, Job *job, int stopped) {
+    if (job->stopped == stopped) return;
+    JobList *list = &jobsQueue->stoppedJobs;
+    job->stopped = stopped;
+    if (stopped) {
+        job->prevStopped = list->last;
+        job->nextStopped = NULL;
+        if (list->last) list->last->nextStopped = job;
+        else list->first = job;
+        list->last = job;
+        return;
+    }
+    if (job->prevStopped) job->prevStopped->nextStopped = job->nextStopped;
+    else list->first = job->nextStopped;
+    if (job->nextStopped) job->nextStopped->prevStopped = job->prevStopped;
+    else list->last = job->prevStopped;
+    job->prevStopped = job->nextStopped = NULL;
+}
+JobsQueue *createJobsQueue() {
+    JobsQueue *jobsQueue = (JobsQueue*)calloc(1, sizeof(JobsQueue));
+    if (!jobsQueue) return NULL;
+    jobsQueue->first = NULL;
+    jobsQueue->last = NULL;
+    jobsQueue->size = 0;
+    return jobsQueue;
+}
+JobsQueue *createJobQueue(Job *job) {
+    if (!job) return createJobsQueue();
+    JobsQueue *jobsQueue = (JobsQueue*)calloc(1, sizeof(JobsQueue));
+    if (!jobsQueue) return NULL;
+    jobsQueue->first = job;
+    jobsQueue->last = job;
+    jobsQueue->size = 1;
+    jobsQueue->reattached = job->pidfd >= 0;
+    indexJob(jobsQueue, job);
+    indexPid(jobsQueue, job);
+    return jobsQueue;
+}
+int isEmpty(JobsQueue *jobsQueue) { return jobsQueue->size == 0; }
+JobsQueue *addJob(JobsQueue *jobsQueue, Job *job) {
+    if (!jobsQueue) {
+        if (job) freeJobsQueue(createJobQueue(job));
+        return jobsQueue;
+    }
+    if (!job) return NULL;
+    if (jobsQueue->size == 0) {
+        freeJobsQueue(jobsQueue);
+        jobsQueue = createJobQueue(job);
+        return jobsQueue;
+    }
+    job->prev = jobsQueue->last;
+    jobsQueue->last->next = job;
+    jobsQueue->last = job;
+    (jobsQueue->size)++;
+    jobsQueue->reattached += job->pidfd >= 0;
+    indexJob(jobsQueue, job);
+    indexPid(jobsQueue, job);
+    return jobsQueue;
+}
+void freeJobsQueue(JobsQueue *jobsQueue) {
+    if (!jobsQueue) return;
+    Job *curr = jobsQueue->first;
+    while (curr != NULL) {
+        Job *temp = curr;
+        curr = curr->next;
+        deleteJob(temp);
+    }
+    free(jobsQueue->byPid);
+    free(jobsQueue);
+}
+
+/**
+ * The function empties the rendered chunks.
+ */
+static void resetOutput(Output *out) {
+    int i;
+    for (i = 0; i < RENDER_CHUNKS; i++) {
+        out->chunks[i].iov_base = renderBuffer[i];
+        out->chunks[i].iov_len = 0;
+    }
+    out->used = 0;
+}
+
+/**
+ * The function writes the rendered chunks with one writev, or a few if the
+ * fd takes them in parts, and empties them.
+ */
+static void flushOutput(Output *out) {
+    struct iovec *chunk = out->chunks;
+    int count = out->used;
+    if (count < RENDER_CHUNKS && out->chunks[count].iov_len > 0) count++;
+    while (count > 0 && !out->failed) {
+        ssize_t n = writev(STDOUT_FILENO, chunk, count);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            out->failed = 1;
+            break;
+        }
+        while (count > 0 && (size_t)n >= chunk->iov_len) {
+            n -= chunk->iov_len;
+            chunk++;
+            count--;
+        }
+        if (count > 0) {
+            chunk->iov_base = (char *)chunk->iov_base + n;
+            chunk->iov_len -= n;
+        }
+    }
+    resetOutput(out);
+}
+
+/**
+ * The function appends bytes to the rendered chunks.
+ */
+static void render(Output *out, const char *data, size_t size) {
+    while (size > 0) {
+        struct iovec *chunk = &out->chunks[out->used];
+        size_t room = RENDER_CHUNK_SIZE - chunk->iov_len;
+        if (room == 0) {
+            if (++out->used == RENDER_CHUNKS) flushOutput(out);
+            continue;
+        }
+        size_t n = size < room ? size : room;
+        memcpy((char *)chunk->iov_base + chunk->iov_len, data, n);
+        chunk->iov_len += n;
+        data += n;
+        size -= n;
+    }
+}
+
+/**
+ * The function renders a job's line.
+ */
+static void renderJob(Output *out, Job *job, int pidsOnly) {
+    char pid[16];
+    int len = snprintf(pid, sizeof(pid), pidsOnly ? "%d\n" : "%d\t", job->pid);
+    render(out, pid, len);
+    if (pidsOnly) return;
+    int i;
+    for (i = 0; job->args[i]; i++) {
+        render(out, job->args[i], strlen(job->args[i]));
+        render(out, " ", 1);
+    }
+    render(out, "\n", 1);
+}
+
+/**
+ * The function returns 1 if a job is stopped and 0 else. A child's state
+ * is the one removeCompletedJobs took last, a reattached job's state is
+ * read from /proc.
+ */
+static int jobStopped(Job *job) {
+    if (job->pidfd < 0) return job->stopped;
+    char path[32], buf[512];
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)job->pid);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 0;
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) return 0;
+    buf[n] = 0;
+    char *state = strrchr(buf, ')');
+    return state && (state[2] == 'T' || state[2] == 't');
+}
+
+/**
+ * The function returns 1 if a job passes the filter and 0 else.
+ */
+static int jobMatches(Job *job, const JobsFilter *filter) {
+    if (filter->name && strcmp(job->jobName, filter->name) != 0) return 0;
+    if (filter->running == filter->stopped) return 1;
+    return jobStopped(job) == filter->stopped;
+}
+
+void printJobs(JobsQueue *jobsQueue, const JobsFilter *filter) {
+    static const JobsFilter all = {0, 0, 0, NULL};
+    if (!filter) filter = &all;
+    Output out;
+    out.failed = 0;
+    resetOutput(&out);
+    fflush(stdout);
+    Job *job;
+    if (filter->name) {
+        job = nameBucket(jobsQueue, filter->name)->first;
+        for (; job && !out.failed; job = job->nextByName) {
+            if (jobMatches(job, filter)) renderJob(&out, job, filter->pidsOnly);
+        }
+    } else if (filter->stopped && !filter->running && !jobsQueue->reattached) {
+        job = jobsQueue->stoppedJobs.first;
+        for (; job && !out.failed; job = job->nextStopped) renderJob(&out, job, filter->pidsOnly);
+    } else {
+        for (job = jobsQueue->first; job && !out.failed; job = job->next) {
+            if (jobMatches(job, filter)) renderJob(&out, job, filter->pidsOnly);
+        }
+    }
+    flushOutput(&out);
+}
+
+int runJobs(JobsQueue *jobsQueue, char **args) {
+    JobsFilter filter = {0, 0, 0, NULL};
+    int i;
+    for (i = 1; args[i]; i++) {
+        const char *flag = args[i];
+        if (strcmp(flag, "--match") == 0 && args[i + 1]) {
+            filter.name = args[++i];
+            continue;
+        }
+        if (flag[0] != '-' || !flag[1] || flag[1] == '-') {
+            fprintf(stderr, JOBS_USAGE);
+            return 2;
+        }
+        for (flag++; *flag; flag++) {
+            if (*flag == 'r') filter.running = 1;
+            else if (*flag == 's') filter.stopped = 1;
+            else if (*flag == 'p') filter.pidsOnly = 1;
+            else {
+                fprintf(stderr, JOBS_USAGE);
+                return 2;
+            }
+        }
+    }
+    printJobs(jobsQueue, &filter);
+    return 0;
+}
+
+/**
+ * The function unlinks a job from the jobsQueue.
+ * @param jobsQueue The jobsQueue.
+ * @param job The job.
+ */
+static void unlinkJob(JobsQueue *jobsQueue, Job *job) {
+    if (job->prev) job->prev->next = job->next;
+    else jobsQueue->first = job->next;
+    if (job->next) job->next->prev = job->prev;
+    else jobsQueue->last = job->prev;
+    (jobsQueue->size)--;
+    jobsQueue->reattached -= job->pidfd >= 0;
+    setStopped(jobsQueue, job, 0);
+    job->prev = job->next = NULL;
+    unindexJob(jobsQueue, job);
+    unindexPid(jobsQueue, job);
+    forgetJob(job);
+    TRACE(TRACE_REAP, job->pid, 0);
+}
+
+void jobExited(Job *job, int status, const struct rusage *usage) {
+    TRACE(TRACE_CHILD_EXIT, job->pid, status);
+    metrics.jobsReaped++;
+    metrics.jobsRunning--;
+    observeRuntime(nowNs() - job->started);
+    if (usage) {
+        metrics.jobCpuSeconds += usage->ru_utime.tv_sec + usage->ru_stime.tv_sec +
+                                 (usage->ru_utime.tv_usec + usage->ru_stime.tv_usec) / 1e6;
+    }
+    job->status = status;
+    job->started = 0;
+    cancelTimeout(job);
+}
+
+/**
+ * The function takes the children's stops and continues, each is reported
+ * once, and keeps the stopped jobs up to date with them. Exits are left to
+ * the SIGCHLD handler and the loop in removeCompletedJobs.
+ */
+static void takeStateChanges(JobsQueue *jobsQueue) {
+    for (;;) {
+        siginfo_t info;
+        info.si_pid = 0;
+        if (waitid(P_ALL, 0, &info, WSTOPPED | WCONTINUED | WNOHANG) < 0 || info.si_pid == 0) return;
+        Job *job = findJob(jobsQueue, info.si_pid);
+        if (job && job->pidfd < 0) setStopped(jobsQueue, job, info.si_code != CLD_CONTINUED);
+    }
+}
+
+void removeCompletedJobs(JobsQueue *jobsQueue) {
+    takeStateChanges(jobsQueue);
+    // with SIGCHLD held every exit the handler reaped is in the ring, so once
+    // it is drained a watched job that didn't exit is still running
+    holdChildExits(1);
+    ChildExit exits[EXIT_BATCH];
+    int n, i;
+    while ((n = takeChildExits(exits, EXIT_BATCH)) > 0) {
+        for (i = 0; i < n; i++) {
+            Job *job = findJob(jobsQueue, exits[i].pid);
+            if (job && job->started) jobExited(job, exits[i].status, &exits[i].usage);
+        }
+    }
+    Job *curr = jobsQueue->first;
+    while (curr) {
+        Job *next = curr->next;
+        // foreground jobs were reaped already, background ones by the SIGCHLD
+        // handler, or here if it doesn't watch them, and a reattached job,
+        // another shell's child, only reports its exit through its pidfd,
+        // without a status
+        int done = !curr->started;
+        if (!done && curr->pidfd >= 0) {
+            struct pollfd exited = {curr->pidfd, POLLIN, 0};
+            done = poll(&exited, 1, 0) > 0;
+            if (done) jobExited(curr, 0, NULL);
+        } else if (!done && !curr->watched) {
+            int status;
+            pid_t reaped = waitpid(curr->pid, &status, WNOHANG);
+            if (reaped > 0) jobExited(curr, status, NULL);
+            done = reaped > 0 || (reaped < 0 && errno == ECHILD);
+        }
+        if (done) {
+            unlinkJob(jobsQueue, curr);
+            deleteJob(curr);
+        }
+        curr = next;
+    }
+    holdChildExits(0);
+}
+
+Job *findJob(JobsQueue *jobsQueue, pid_t pid) {
+    if (!jobsQueue->byPid) {
+        Job *job = jobsQueue->first;
+        while (job && job->pid != pid) job = job->next;
+        return job;
+    }
+    int mask = jobsQueue->pidSlots - 1, i = pidHash(pid) & mask;
+    while (jobsQueue->byPid[i] && jobsQueue->byPid[i]->pid != pid) i = (i + 1) & mask;
+    return jobsQueue->byPid[i];
+}
+
+Job *removeJob(JobsQueue *jobsQueue, pid_t pid) {
+    Job *job = findJob(jobsQueue, pid);
+    if (job) unlinkJob(jobsQueue, job);
+    return job;
+}
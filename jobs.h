@@ -0,0 +1,205 @@
+#ifndef EX2_JOBS_H
+#define EX2_JOBS_H
+
+#include <sys/types.h>
+#include <sys/resource.h>
+
+#define UNSUCCESSFUL_FORK "Unsuccessful fork\n"
+#define BAD_ALLOC "Bad memory allocation\n"
+#define SYS_CALL_ERR "Error calling system call\n"
+#define JOBS_USAGE "usage: jobs [-r] [-s] [-p] [--match NAME]\n" \
+                   "       jobs --top [-d SECONDS] [-n COUNT]\n"
+#define JOB_NAME_BUCKETS 256
+/* the slots of a new pid index, it doubles while it is more than half full */
+#define JOB_PID_SLOTS 64
+#define MAX_LAUNCH_LIMITS 8
+
+/* how a job's processes are set up between fork and exec, see launch.h */
+typedef struct {
+    /* 1 if nice is added to the shell's niceness */
+    int hasNice;
+    int nice;
+    /* the io priority as ioprio_set takes it, or -1 to keep the shell's */
+    int ioPriority;
+    /* SCHED_BATCH, SCHED_IDLE or SCHED_OTHER, or -1 to keep the shell's */
+    int policy;
+    /* the wall-clock timeout, 0 for the default and -1 for none, and the
+     * grace before SIGKILL */
+    long long timeoutNs;
+    long long graceNs;
+    /* the soft resource limits to set */
+    int limitCount;
+    struct {
+        int resource;
+        rlim_t value;
+    } limits[MAX_LAUNCH_LIMITS];
+} LaunchOptions;
+
+typedef struct Job {
+    pid_t pid;
+    char *jobName;
+    char **args;
+    int argc;
+    /* the daemon client that submitted the job, or -1 */
+    int owner;
+    /* the job's wait status once it exited */
+    int status;
+    /* the number of events the job waits for before it is done */
+    int pending;
+    /* the monotonic time the job was forked at in nanoseconds, 0 once reaped */
+    long long started;
+    /* a close-on-exec fd the job's stdin is redirected from, or -1 */
+    int stdinFd;
+    /* for a pipeline, the close-on-exec fds the commands after the first are
+     * redirected from, -1 for the pipe before them, or NULL if none is */
+    int *stageFds;
+    int stageFdCount;
+    /* a pidfd for a job an earlier shell started, which isn't our child, or -1 */
+    int pidfd;
+    /* the job's slot in the persistent job table, or -1 */
+    int slot;
+    /* 1 if the SIGCHLD handler reaps the job, see sigchld.h */
+    int watched;
+    /* the priorities and limits the job was launched with */
+    LaunchOptions launch;
+    /* the job's entry in the timeout heap, or -1, see timeout.h */
+    int timer;
+    /* the process group the job leads, or 0 if it is in the shell's */
+    pid_t pgid;
+    /* 1 if the job's last stop or continue was a stop, see removeCompletedJobs */
+    int stopped;
+    struct Job *prev;
+    struct Job *next;
+    /* the jobs with a name in the same bucket of the name index */
+    struct Job *prevByName;
+    struct Job *nextByName;
+    /* the stopped jobs around it, in the order they stopped */
+    struct Job *prevStopped;
+    struct Job *nextStopped;
+} Job;
+
+typedef struct {
+    Job *first;
+    Job *last;
+} JobList;
+
+typedef struct {
+    Job *first;
+    Job *last;
+    int size;
+    /* the jobs by a hash of their name, in the order they were added */
+    JobList byName[JOB_NAME_BUCKETS];
+    /* the jobs by pid, an open-addressed hash with linear probing, or NULL
+     * if it couldn't be allocated and findJob walks the jobs */
+    Job **byPid;
+    int pidSlots;
+    /* the stopped children, which jobs -s lists without asking the kernel */
+    JobList stoppedJobs;
+    /* the jobs an earlier shell started, whose state is read from /proc */
+    int reattached;
+} JobsQueue;
+
+/* which jobs the jobs builtin lists, and how */
+typedef struct {
+    int running;
+    int stopped;
+    /* 1 to list the pids only */
+    int pidsOnly;
+    /* the command name to match, or NULL */
+    const char *name;
+} JobsFilter;
+
+/**
+ * The function creates a new job given its parameters.
+ * @param n_args The job's NULL terminated args, the job takes ownership.
+ * @param n_argc The number of args.
+ * @return a pointer to the newly created job.
+ */
+Job *newJob(char **n_args, int n_argc);
+/**
+ * The function frees the job's args.
+ * @param args The args to free.
+ */
+void freeArgs(char *args[]);
+/**
+ * The function deletes the given job.
+ * @param job The given job.
+ */
+void deleteJob(Job *job);
+/**
+ * The function creates a new JobQueue.
+ * @return The new jobQueue.
+ */
+JobsQueue *createJobsQueue();
+/**
+ * The function creates a new jobsQueue given a job.
+ * @param The given job.
+ * @return The new jobsQueue.
+ */
+JobsQueue *createJobQueue(Job *job);
+/**
+ * The function returns 1 if the jobsQueue is empty and 0 else.
+ * @param jobsQueue The given jobsQueue.
+ * @return 1 if the jobsQueue is empty and 0 else.
+ */
+int isEmpty(JobsQueue *jobsQueue);
+/**
+ * The function add a new job to the jobsQueue.
+ * @param jobsQueue THe given jobsQueue.
+ * @param job The given job.
+ * @return The jobsQueue.
+ */
+JobsQueue *addJob(JobsQueue *jobsQueue, Job *job);
+/**
+ * The function frees the jobsQueue.
+ * @param jobsQueue The jobsQueue.
+ */
+void freeJobsQueue(JobsQueue *jobsQueue);
+/**
+ * The function will print the jobs from the jobsQueue. The lines are
+ * rendered into large reusable buffers and written with writev, and a name
+ * is looked up in the name index rather than matched against every job.
+ * @param jobsQueue The jobsQueue.
+ * @param filter The jobs to print, or NULL for all of them.
+ */
+void printJobs(JobsQueue *jobsQueue, const JobsFilter *filter);
+/**
+ * The function runs the jobs builtin, which lists the running (-r) or
+ * stopped (-s) jobs, or both, with -p only their pids and with --match only
+ * the jobs of a command. The stopped jobs are listed in the order they
+ * stopped.
+ * @param jobsQueue The jobsQueue.
+ * @param args The builtin's NULL terminated argv, starting with "jobs".
+ * @return 0 on success or 2 on a usage error.
+ */
+int runJobs(JobsQueue *jobsQueue, char **args);
+/**
+ * The function accounts for a job that exited and sets its status.
+ * @param job The job.
+ * @param status The job's wait status.
+ * @param usage The job's resource usage, or NULL if it is unknown.
+ */
+void jobExited(Job *job, int status, const struct rusage *usage);
+/**
+ * The function will removed jobs that have completed from the jobsQueue.
+ * It takes the stops and continues of the children too, so the stopped
+ * jobs are known without a system call per job.
+ * @param jobsQueue The jobsQueue.
+ */
+void removeCompletedJobs(JobsQueue *jobsQueue);
+/**
+ * The function returns the job with the given pid.
+ * @param jobsQueue The jobsQueue.
+ * @param pid The job's pid.
+ * @return The job or NULL if there is none.
+ */
+Job *findJob(JobsQueue *jobsQueue, pid_t pid);
+/**
+ * The function unlinks the job with the given pid from the jobsQueue.
+ * @param jobsQueue The jobsQueue.
+ * @param pid The job's pid.
+ * @return The unlinked job, which the caller should delete, or NULL.
+ */
+Job *removeJob(JobsQueue *jobsQueue, pid_t pid);
+
+#endif
@@ -0,0 +1,264 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "script.h"
+#include "metrics.h"
+#include "trace.h"
+#include "jobtable.h"
+
+#define TABLE_MAGIC 0x4a325845u /* "EX2J" */
+#define TABLE_VERSION 2
+/* the slots of a new table, it doubles whenever it is full */
+#define TABLE_SLOTS 128
+#define SLOT_ARGV_SIZE 1008
+
+/*
+ * A slot is free while its pid is 0. The pid is written last and cleared
+ * first, so a shell that dies halfway leaves no half written job behind.
+ */
+typedef struct {
+    int32_t pid;
+    uint32_t argc;
+    /* the process's start time in clock ticks since boot, from /proc */
+    uint64_t startTime;
+    /* the NUL separated args, the last one may be cut */
+    char argv[SLOT_ARGV_SIZE];
+} JobSlot;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slots;
+    uint32_t reserved;
+    JobSlot slot[];
+} JobTable;
+
+/* shared with the file, so every store reaches it even if the shell crashes */
+static JobTable *table = NULL;
+/* holds the table's lock until the shell exits */
+static int tableFd = -1;
+/* no slot below it is free, so recording doesn't scan the whole table */
+static uint32_t firstFree = 0;
+
+/**
+ * The function returns the size of a table's file.
+ */
+static size_t tableSize(uint32_t slots) {
+    return sizeof(JobTable) + (size_t)slots * sizeof(JobSlot);
+}
+
+/**
+ * The function reads a process's start time from /proc/<pid>/stat.
+ * @return 0 on success or -1 if there is no such process.
+ */
+static int processStartTime(pid_t pid, uint64_t *start) {
+    char path[32], buf[1024];
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) return -1;
+    buf[n] = 0;
+    // the command name may hold spaces and parentheses, the fields after it
+    // start at the state, which is field 3, and the start time is field 22
+    char *field = strrchr(buf, ')');
+    int i;
+    for (i = 2; field && i < 22; i++) {
+        field = strchr(field + 1, ' ');
+    }
+    if (!field) return -1;
+    *start = strtoull(field + 1, NULL, 10);
+    return 0;
+}
+
+/**
+ * The function converts a process's start time to the monotonic clock.
+ * @return The time in nanoseconds, as nowNs() returns it.
+ */
+static long long startedNs(uint64_t startTime) {
+    struct timespec boot;
+    clock_gettime(CLOCK_BOOTTIME, &boot);
+    long long ticks = sysconf(_SC_CLK_TCK);
+    long long age = boot.tv_sec * 1000000000LL + boot.tv_nsec - (long long)(startTime * (1000000000LL / ticks));
+    return nowNs() - (age > 0 ? age : 0);
+}
+
+/**
+ * The function rebuilds a job from its slot and opens a pidfd to track it.
+ * @return The job or NULL if the process is gone, or it is another process
+ * that got the pid.
+ */
+static Job *reattach(JobSlot *slot) {
+    int pidfd = syscall(SYS_pidfd_open, slot->pid, 0);
+    if (pidfd < 0) return NULL;
+    // a pidfd doesn't keep the pid from being reused, but the process it
+    // refers to held the pid when it was opened; a process that got the pid
+    // since started after that, so a start time read now that matches the
+    // slot's, which is older, is the start time of the pidfd's process
+    uint64_t start;
+    if (processStartTime(slot->pid, &start) < 0 || start != slot->startTime) {
+        close(pidfd);
+        return NULL;
+    }
+    slot->argv[SLOT_ARGV_SIZE - 1] = 0;
+    int argc = 0;
+    const char *word = slot->argv, *end = slot->argv + SLOT_ARGV_SIZE;
+    while (argc < (int)slot->argc && word < end) {
+        word += strlen(word) + 1;
+        argc++;
+    }
+    char **args = (char **)calloc(argc + 1, sizeof(char *));
+    int i;
+    word = slot->argv;
+    for (i = 0; args && i < argc; i++) {
+        args[i] = strdup(word);
+        if (!args[i]) {
+            freeArgs(args);
+            free(args);
+            args = NULL;
+            break;
+        }
+        word += strlen(word) + 1;
+    }
+    if (!args || !argc) {
+        if (!args) perror(BAD_ALLOC);
+        free(args);
+        close(pidfd);
+        return NULL;
+    }
+    // newJob frees the args when it fails
+    Job *job = newJob(args, argc);
+    if (!job) {
+        close(pidfd);
+        return NULL;
+    }
+    job->pid = slot->pid;
+    job->pidfd = pidfd;
+    job->slot = slot - table->slot;
+    // the earlier shell started background jobs in groups of their own
+    if (getpgid(slot->pid) == slot->pid) job->pgid = slot->pid;
+    job->started = startedNs(start);
+    return job;
+}
+
+JobsQueue *openJobTable(JobsQueue *jobsQueue) {
+    char *path = NULL;
+    const char *file = getenv("EX2_JOBS_FILE");
+    if (file && !*file) return jobsQueue;
+    if (!file) {
+        char *dir = cacheDir(NULL);
+        if (!dir) return jobsQueue;
+        size_t len = strlen(dir) + sizeof("/jobs");
+        path = (char *)malloc(len);
+        if (path) snprintf(path, len, "%s/jobs", dir);
+        free(dir);
+        if (!path) return jobsQueue;
+        file = path;
+    }
+    int fd = open(file, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    free(path);
+    if (fd < 0) return jobsQueue;
+    // another running shell owns the table
+    struct stat st;
+    if (flock(fd, LOCK_EX | LOCK_NB) < 0 || fstat(fd, &st) < 0) {
+        close(fd);
+        return jobsQueue;
+    }
+    // a shell that died while growing the table may leave the file longer
+    // than its header says, the rest is free slots
+    JobTable header;
+    int fresh = st.st_size < (off_t)sizeof(header) || pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+                header.magic != TABLE_MAGIC || header.version != TABLE_VERSION || header.slots < TABLE_SLOTS ||
+                (uint64_t)st.st_size < tableSize(header.slots);
+    uint32_t slots = fresh ? TABLE_SLOTS : header.slots;
+    if (fresh && (ftruncate(fd, 0) < 0 || ftruncate(fd, tableSize(slots)) < 0)) {
+        close(fd);
+        return jobsQueue;
+    }
+    JobTable *mapped = (JobTable *)mmap(NULL, tableSize(slots), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapped == MAP_FAILED) {
+        close(fd);
+        return jobsQueue;
+    }
+    if (fresh) {
+        mapped->magic = TABLE_MAGIC;
+        mapped->version = TABLE_VERSION;
+        mapped->slots = slots;
+    }
+    table = mapped;
+    tableFd = fd;
+    uint32_t i;
+    for (i = 0; i < table->slots; i++) {
+        if (!table->slot[i].pid) continue;
+        Job *job = reattach(&table->slot[i]);
+        if (!job) {
+            table->slot[i].pid = 0;
+            continue;
+        }
+        TRACE(TRACE_FORK, job->pid, 0);
+        metrics.jobsRunning++;
+        jobsQueue = addJob(jobsQueue, job);
+    }
+    return jobsQueue;
+}
+
+int jobTableOpen() { return table != NULL; }
+
+/**
+ * The function doubles the table, the file first and then the mapping, so
+ * the header never counts slots the file doesn't have.
+ * @return 0 on success or -1 on failure.
+ */
+static int growTable() {
+    uint32_t slots = table->slots;
+    if (slots > UINT32_MAX / 2) return -1;
+    if (ftruncate(tableFd, tableSize(slots * 2)) < 0) return -1;
+    JobTable *grown = (JobTable *)mremap(table, tableSize(slots), tableSize(slots * 2), MREMAP_MAYMOVE);
+    if (grown == MAP_FAILED) return -1;
+    table = grown;
+    table->slots = slots * 2;
+    return 0;
+}
+
+void recordJob(Job *job) {
+    if (!table || job->slot >= 0) return;
+    uint64_t start;
+    if (processStartTime(job->pid, &start) < 0) return;
+    uint32_t i;
+    for (i = firstFree; i < table->slots && table->slot[i].pid; i++);
+    if (i == table->slots && growTable() < 0) {
+        fprintf(stderr, "%d: the job table can't grow, a later shell won't reattach the job\n", (int)job->pid);
+        return;
+    }
+    firstFree = i + 1;
+    JobSlot *slot = &table->slot[i];
+    size_t size = 0;
+    int arg;
+    for (arg = 0; arg < job->argc && size < SLOT_ARGV_SIZE; arg++) {
+        size_t len = strlen(job->args[arg]);
+        if (len > SLOT_ARGV_SIZE - 1 - size) len = SLOT_ARGV_SIZE - 1 - size;
+        memcpy(slot->argv + size, job->args[arg], len);
+        size += len;
+        slot->argv[size++] = 0;
+    }
+    slot->argc = arg;
+    slot->startTime = start;
+    __atomic_store_n(&slot->pid, job->pid, __ATOMIC_RELEASE);
+    job->slot = i;
+}
+
+void forgetJob(Job *job) {
+    if (!table || job->slot < 0) return;
+    __atomic_store_n(&table->slot[job->slot].pid, 0, __ATOMIC_RELEASE);
+    if ((uint32_t)job->slot < firstFree) firstFree = job->slot;
+    job->slot = -1;
+}
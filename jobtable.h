@@ -0,0 +1,33 @@
+#ifndef EX2_JOBTABLE_H
+#define EX2_JOBTABLE_H
+
+#include "jobs.h"
+
+/**
+ * The function maps the persistent job table, <cache dir>/jobs or
+ * EX2_JOBS_FILE (an empty value turns the table off), and adds the jobs an
+ * earlier shell left running to the jobsQueue. Those jobs aren't children of
+ * this shell, so they are tracked through a pidfd. Only one shell owns the
+ * table at a time; the others run without it.
+ * @param jobsQueue The jobsQueue.
+ * @return The jobsQueue.
+ */
+JobsQueue *openJobTable(JobsQueue *jobsQueue);
+/**
+ * The function returns 1 if this shell owns the job table and 0 else.
+ * @return 1 if this shell owns the job table and 0 else.
+ */
+int jobTableOpen();
+/**
+ * The function records a started job in the job table. The job's start time
+ * is read from /proc so a reused pid isn't mistaken for the job later.
+ * @param job The job, its pid is set.
+ */
+void recordJob(Job *job);
+/**
+ * The function removes a job from the job table, if it is in it.
+ * @param job The job.
+ */
+void forgetJob(Job *job);
+
+#endif
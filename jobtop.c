@@ -0,0 +1,345 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include "metrics.h"
+#include "timeout.h"
+#include "jobtop.h"
+
+#define PROC_BUFFER_SIZE 1024
+#define DEFAULT_ROWS 24
+/* the lines above the jobs: the summary and the column titles */
+#define HEADER_ROWS 2
+/* the fds left to the rest of the shell when the samples keep theirs */
+#define RESERVED_FDS 64
+
+typedef struct {
+    pid_t pid;
+    Job *job;
+    /* the job's /proc files, kept open between samples, or -1 */
+    int schedFd;
+    int statFd;
+    int ioFd;
+    /* the totals at the last sample: the CPU time in nanoseconds, and the
+     * bytes read and written */
+    unsigned long long runtime;
+    unsigned long long readBytes;
+    unsigned long long writeBytes;
+    /* 1 once the totals were read, so there is a rate at the next sample */
+    int sampled;
+    char state;
+    long rssKb;
+    double cpu;
+    double readRate;
+    double writeRate;
+} Sample;
+
+typedef struct {
+    /* the samples by pid */
+    Sample *samples;
+    int count;
+    long long sampledAt;
+    /* the CPU time the last sample took in nanoseconds */
+    long long cost;
+    long ticksPerSecond;
+    long pageKb;
+    /* 1 if the kernel has /proc/PID/schedstat */
+    int schedstat;
+    /* how many fds the samples keep open, and may */
+    long keptFds;
+    long fdBudget;
+} Top;
+
+/**
+ * The function returns the CPU time the shell used in nanoseconds, which is
+ * what a sample costs, unlike the wall time that counts the time the busy
+ * jobs had the core.
+ */
+static long long cpuNs() {
+    struct timespec now;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+static int compareSamples(const void *a, const void *b) {
+    pid_t x = ((const Sample *)a)->pid, y = ((const Sample *)b)->pid;
+    return (x > y) - (x < y);
+}
+
+/**
+ * The function orders samples by CPU, the busiest first, then by pid.
+ */
+static int compareBusy(const void *a, const void *b) {
+    const Sample *x = *(const Sample *const *)a, *y = *(const Sample *const *)b;
+    if (x->cpu != y->cpu) return x->cpu < y->cpu ? 1 : -1;
+    return (x->pid > y->pid) - (x->pid < y->pid);
+}
+
+static void closeSample(Top *top, Sample *sample) {
+    if (sample->schedFd >= 0) close(sample->schedFd);
+    if (sample->statFd >= 0) close(sample->statFd);
+    if (sample->ioFd >= 0) close(sample->ioFd);
+    top->keptFds -= (sample->schedFd >= 0) + (sample->statFd >= 0) + (sample->ioFd >= 0);
+}
+
+/**
+ * The function reads a /proc file of a job from its start. The file stays
+ * open for the next sample while the fd budget allows, else it is opened
+ * and closed each time.
+ * @return The bytes read or -1 on failure.
+ */
+static ssize_t readProc(Top *top, int *fd, pid_t pid, const char *name, char *buf) {
+    int file = *fd;
+    if (file < 0) {
+        char path[64];
+        snprintf(path, sizeof(path), "/proc/%d/%s", (int)pid, name);
+        file = open(path, O_RDONLY | O_CLOEXEC);
+        if (file < 0) return -1;
+        if (top->keptFds < top->fdBudget) {
+            *fd = file;
+            top->keptFds++;
+        }
+    }
+    ssize_t n = pread(file, buf, PROC_BUFFER_SIZE - 1, 0);
+    if (file != *fd) close(file);
+    if (n < 0) return -1;
+    buf[n] = 0;
+    return n;
+}
+
+/**
+ * The function reads a job's totals and works out its rates since the last
+ * sample. The CPU time is read first from /proc/PID/schedstat, the cheapest
+ * of the files, and a job that didn't run since the last sample can't have
+ * changed its state, RSS or I/O, so most of the jobs, which sleep, cost one
+ * read.
+ * @param elapsed The time since the last sample in seconds.
+ */
+static void sampleJob(Top *top, Sample *sample, double elapsed) {
+    char buf[PROC_BUFFER_SIZE];
+    unsigned long long runtime = sample->runtime, readBytes = sample->readBytes, writeBytes = sample->writeBytes;
+    int read = 0, timed = 0;
+    if (top->schedstat) {
+        if (readProc(top, &sample->schedFd, sample->pid, "schedstat", buf) > 0) {
+            runtime = strtoull(buf, NULL, 10);
+            timed = 1;
+            if (sample->sampled && runtime == sample->runtime) {
+                sample->cpu = sample->readRate = sample->writeRate = 0;
+                return;
+            }
+        }
+    }
+    if (readProc(top, &sample->statFd, sample->pid, "stat", buf) > 0) {
+        // the command name may hold spaces and parentheses, the fields after
+        // the last ) don't
+        char *p = strrchr(buf, ')');
+        if (p && p[1] == ' ' && p[2]) {
+            sample->state = p[2];
+            p += 3;
+            int field;
+            long long value = 0, utime = 0;
+            // the state is field 3, utime 14, stime 15 and rss 24
+            for (field = 4; field <= 24 && *p; field++) {
+                value = strtoll(p, &p, 10);
+                if (field == 14) utime = value;
+                if (field == 15 && !timed) runtime = (utime + value) * 1000000000ULL / top->ticksPerSecond;
+            }
+            if (field > 24) sample->rssKb = value * top->pageKb;
+            read = 1;
+        }
+    }
+    if (readProc(top, &sample->ioFd, sample->pid, "io", buf) > 0) {
+        sscanf(buf, "rchar: %llu wchar: %llu", &readBytes, &writeBytes);
+    }
+    if (!read) {
+        sample->state = '?';
+        return;
+    }
+    if (sample->sampled && elapsed > 0) {
+        sample->cpu = (runtime - sample->runtime) / 1e7 / elapsed;
+        sample->readRate = (readBytes - sample->readBytes) / elapsed;
+        sample->writeRate = (writeBytes - sample->writeBytes) / elapsed;
+    }
+    sample->runtime = runtime;
+    sample->readBytes = readBytes;
+    sample->writeBytes = writeBytes;
+    sample->sampled = 1;
+}
+
+/**
+ * The function samples the running jobs. The samples of the jobs that are
+ * still running keep their fds and totals, the rest are closed.
+ * @return 0 on success or -1 on bad alloc.
+ */
+static int sampleJobs(Top *top, JobsQueue *jobsQueue) {
+    long long started = nowNs(), cpu = cpuNs();
+    Sample *samples = (Sample *)malloc((jobsQueue->size + 1) * sizeof(Sample));
+    if (!samples) {
+        perror(BAD_ALLOC);
+        return -1;
+    }
+    int count = 0, i;
+    Job *job;
+    for (job = jobsQueue->first; job; job = job->next) {
+        if (!job->started) continue;
+        Sample key;
+        key.pid = job->pid;
+        Sample *old = top->count ? (Sample *)bsearch(&key, top->samples, top->count, sizeof(Sample), compareSamples)
+                                 : NULL;
+        Sample *sample = &samples[count++];
+        if (old && old->job) {
+            *sample = *old;
+            // taken, so it isn't closed below
+            old->job = NULL;
+        } else {
+            memset(sample, 0, sizeof(*sample));
+            sample->pid = job->pid;
+            sample->schedFd = sample->statFd = sample->ioFd = -1;
+        }
+        sample->job = job;
+    }
+    for (i = 0; i < top->count; i++) {
+        if (top->samples[i].job) closeSample(top, &top->samples[i]);
+    }
+    free(top->samples);
+    qsort(samples, count, sizeof(Sample), compareSamples);
+    top->samples = samples;
+    top->count = count;
+    double elapsed = top->sampledAt ? (started - top->sampledAt) / 1e9 : 0;
+    for (i = 0; i < count; i++) sampleJob(top, &samples[i], elapsed);
+    top->sampledAt = started;
+    top->cost = cpuNs() - cpu;
+    return 0;
+}
+
+/**
+ * The function prints the samples, busiest first. On a terminal it redraws
+ * the screen in place and shows as many jobs as fit.
+ * @param interval The time between samples in nanoseconds.
+ */
+static void renderTop(Top *top, int terminal, long long interval) {
+    const Sample **order = (const Sample **)malloc((top->count + 1) * sizeof(Sample *));
+    if (!order) {
+        perror(BAD_ALLOC);
+        return;
+    }
+    int i, rows = top->count;
+    double cpu = 0;
+    long rss = 0;
+    for (i = 0; i < top->count; i++) {
+        order[i] = &top->samples[i];
+        cpu += top->samples[i].cpu;
+        rss += top->samples[i].rssKb;
+    }
+    qsort(order, top->count, sizeof(Sample *), compareBusy);
+    if (terminal) {
+        struct winsize size;
+        int height = ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_row ? size.ws_row : DEFAULT_ROWS;
+        if (rows > height - HEADER_ROWS - 1) rows = height - HEADER_ROWS - 1;
+        if (rows < 0) rows = 0;
+        // home the cursor, and clear each line's rest as it is overwritten
+        printf("\033[H");
+    }
+    const char *eol = terminal ? "\033[K\n" : "\n";
+    printf("jobs: %d  cpu: %.1f%%  rss: %.1f MiB  sampled in %.2f ms (%.2f%% of a core)%s", top->count, cpu,
+           rss / 1024.0, top->cost / 1e6, 100.0 * top->cost / interval, eol);
+    printf("%8s %5s %6s %10s %10s %10s  %s%s", "PID", "STATE", "%CPU", "RSS KiB", "READ/s", "WRITE/s", "COMMAND",
+           eol);
+    for (i = 0; i < rows; i++) {
+        const Sample *sample = order[i];
+        printf("%8d %5c %6.1f %10ld %10.0f %10.0f ", sample->pid, sample->state, sample->cpu, sample->rssKb,
+               sample->readRate, sample->writeRate);
+        int a;
+        for (a = 0; a < sample->job->argc; a++) printf(" %s", sample->job->args[a]);
+        printf("%s", eol);
+    }
+    if (terminal) printf("\033[J");
+    else printf("\n");
+    fflush(stdout);
+    free(order);
+}
+
+/**
+ * The function waits for the next sample, while the jobs' timeouts fire.
+ * @param terminal 1 to stop at a line on stdin.
+ * @return 1 if a line was entered and 0 else.
+ */
+static int waitSample(long long until, int terminal) {
+    struct pollfd fds[2] = {{timeoutFd(), POLLIN, 0}, {STDIN_FILENO, POLLIN, 0}};
+    long long left;
+    while ((left = until - nowNs()) > 0) {
+        int n = poll(fds, terminal ? 2 : 1, (int)(left / 1000000) + 1);
+        if (n < 0 && errno != EINTR) return 0;
+        if (n <= 0) continue;
+        if (fds[0].revents) fireTimeouts();
+        if (terminal && fds[1].revents) {
+            char line[256];
+            if (!fgets(line, sizeof(line), stdin)) clearerr(stdin);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int runTop(JobsQueue *jobsQueue, char **args) {
+    long long interval = TOP_INTERVAL_NS;
+    long count = 0;
+    int i;
+    for (i = 2; args[i]; i += 2) {
+        char *end = NULL;
+        if (strcmp(args[i], "-d") == 0 && args[i + 1] && parseDuration(args[i + 1], &interval) == 0 &&
+            interval > 0) {
+            continue;
+        }
+        if (strcmp(args[i], "-n") == 0 && args[i + 1]) {
+            count = strtol(args[i + 1], &end, 10);
+            if (!*end && count > 0) continue;
+        }
+        fprintf(stderr, TOP_USAGE);
+        return 2;
+    }
+    int terminal = isatty(STDIN_FILENO) && isatty(STDOUT_FILENO);
+    if (!count && !terminal) count = 1;
+    Top top;
+    memset(&top, 0, sizeof(top));
+    // every job keeps three fds open, so the soft limit is raised to the hard
+    // one, and the jobs past it are sampled by opening their files each time;
+    // it is restored once the fds are closed, so later jobs don't inherit it
+    struct rlimit limit, saved;
+    int raised = 0;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        saved = limit;
+        if (limit.rlim_cur < limit.rlim_max) {
+            raised = 1;
+            limit.rlim_cur = limit.rlim_max;
+            if (setrlimit(RLIMIT_NOFILE, &limit) < 0) getrlimit(RLIMIT_NOFILE, &limit);
+        }
+        top.fdBudget = limit.rlim_cur == RLIM_INFINITY ? 1L << 20 : (long)limit.rlim_cur - RESERVED_FDS;
+    }
+    top.ticksPerSecond = sysconf(_SC_CLK_TCK);
+    top.pageKb = sysconf(_SC_PAGESIZE) / 1024;
+    // a kernel without schedstats has no such file, the CPU time is read
+    // from stat then
+    top.schedstat = access("/proc/self/schedstat", R_OK) == 0;
+    if (terminal) printf("\033[H\033[2J");
+    // the first sample only reads the totals the rates are worked out from
+    int result = sampleJobs(&top, jobsQueue);
+    long shown = 0;
+    while (result == 0 && (!count || shown < count)) {
+        if (waitSample(top.sampledAt + interval, terminal)) break;
+        removeCompletedJobs(jobsQueue);
+        result = sampleJobs(&top, jobsQueue);
+        if (result == 0) renderTop(&top, terminal, interval);
+        shown++;
+    }
+    for (i = 0; i < top.count; i++) closeSample(&top, &top.samples[i]);
+    free(top.samples);
+    if (raised) setrlimit(RLIMIT_NOFILE, &saved);
+    return 0;
+}
@@ -0,0 +1,25 @@
+#ifndef EX2_JOBTOP_H
+#define EX2_JOBTOP_H
+
+#include "jobs.h"
+
+#define TOP_USAGE "usage: jobs --top [-d SECONDS] [-n COUNT]\n"
+/* how long jobs --top waits between samples unless -d says else */
+#define TOP_INTERVAL_NS 2000000000LL
+
+/**
+ * The function runs jobs --top, which samples every running job each
+ * interval and shows its CPU %, RSS and read and write rates (the bytes it
+ * passed through read and write calls), busiest first. Each job's
+ * /proc/PID/schedstat, stat and io stay open between samples and are read
+ * with pread, and stat and io are only read for the jobs that ran since the
+ * last sample, so an idle job costs one read. On a terminal the view
+ * refreshes in place until a line is entered, else it is printed COUNT
+ * times (once by default).
+ * @param jobsQueue The jobsQueue.
+ * @param args The builtin's NULL terminated argv, starting with "jobs".
+ * @return 0 on success or 2 on a usage error.
+ */
+int runTop(JobsQueue *jobsQueue, char **args);
+
+#endif
@@ -0,0 +1,242 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <poll.h>
+#include <wait.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include "sigchld.h"
+#include "timeout.h"
+#include "jobwait.h"
+
+#define EVENT_BATCH 256
+/* how often the jobs without a pidfd, once the fds run out, are checked */
+#define UNWATCHED_POLL_MS 10
+/* the epoll data of the timeouts' timerfd */
+#define TIMER_EVENT UINT32_MAX
+
+typedef struct {
+    pid_t pid;
+    Job *job;
+    /* the pidfd in the epoll set, or -1 */
+    int fd;
+    int done;
+    /* the exit status wait reports for the job, 127 if it is unknown */
+    int code;
+} Target;
+
+static int compareTargets(const void *a, const void *b) {
+    pid_t x = ((const Target *)a)->pid, y = ((const Target *)b)->pid;
+    return (x > y) - (x < y);
+}
+
+/**
+ * The function finds the target with a pid.
+ * @return The target or NULL.
+ */
+static Target *findTarget(Target *targets, int count, pid_t pid) {
+    Target key;
+    key.pid = pid;
+    return (Target *)bsearch(&key, targets, count, sizeof(Target), compareTargets);
+}
+
+/**
+ * The function takes a finished target out of the epoll set and prints its
+ * status.
+ * @param known 0 if the job's status is unknown.
+ */
+static void finish(Target *target, int epollFd, int known) {
+    if (target->fd >= 0) {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, target->fd, NULL);
+        if (target->fd != target->job->pidfd) close(target->fd);
+        target->fd = -1;
+    }
+    target->done = 1;
+    int status = target->job->status;
+    target->code = known ? WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status) : 127;
+    if (!known) printf("%d\t?\n", target->pid);
+    else printf("%d\t%d\n", target->pid, target->code);
+    fflush(stdout);
+}
+
+/**
+ * The function applies the exits the SIGCHLD handler queued to their jobs,
+ * in the order the jobs finished, and finishes the targets among them.
+ * @param max The most targets to finish, the exits after them are left in
+ * the ring.
+ * @return The number of targets finished.
+ */
+static int collectExits(JobsQueue *jobsQueue, Target *targets, int count, int epollFd, int max) {
+    ChildExit exits[EVENT_BATCH];
+    int n, i, finished = 0;
+    while (finished < max && (n = takeChildExits(exits, max - finished < EVENT_BATCH ? max - finished
+                                                                                      : EVENT_BATCH)) > 0) {
+        for (i = 0; i < n; i++) {
+            Target *target = findTarget(targets, count, exits[i].pid);
+            Job *job = target ? target->job : findJob(jobsQueue, exits[i].pid);
+            if (!job || !job->started) continue;
+            jobExited(job, exits[i].status, &exits[i].usage);
+            if (target) {
+                finish(target, epollFd, 1);
+                finished++;
+            }
+        }
+    }
+    return finished;
+}
+
+/**
+ * The function finishes a target whose pidfd is readable, unless the
+ * SIGCHLD handler reaps it and hasn't yet. SIGCHLD must be held.
+ * @return 1 if it finished and 0 else.
+ */
+static int finishReady(Target *target, int epollFd) {
+    Job *job = target->job;
+    // a reattached job isn't our child, so its status is unknown
+    if (job->pidfd >= 0) {
+        jobExited(job, 0, NULL);
+        finish(target, epollFd, 0);
+        return 1;
+    }
+    if (job->watched) return 0;
+    int status;
+    pid_t reaped = waitpid(target->pid, &status, WNOHANG);
+    if (reaped == 0) return 0;
+    jobExited(job, reaped > 0 ? status : 0, NULL);
+    finish(target, epollFd, reaped > 0);
+    return 1;
+}
+
+/**
+ * The function finishes a target that has no pidfd in the epoll set if it
+ * exited. SIGCHLD must be held.
+ * @return 1 if it finished and 0 else.
+ */
+static int finishPolled(Target *target, int epollFd) {
+    if (target->job->pidfd >= 0) {
+        struct pollfd exited = {target->job->pidfd, POLLIN, 0};
+        if (poll(&exited, 1, 0) <= 0) return 0;
+    }
+    return finishReady(target, epollFd);
+}
+
+int runWait(JobsQueue *jobsQueue, char **args) {
+    int i = 1, next = 0, result = 0, count = 0;
+    if (args[i] && strcmp(args[i], "-n") == 0) {
+        next = 1;
+        i++;
+    }
+    Target *targets = (Target *)malloc((jobsQueue->size + 1) * sizeof(Target));
+    if (!targets) {
+        perror(BAD_ALLOC);
+        return 1;
+    }
+    Job *job, *last = NULL;
+    if (!args[i]) {
+        for (job = jobsQueue->first; job; job = job->next) {
+            if (job->started) targets[count++].job = job;
+        }
+    }
+    for (; args[i]; i++) {
+        char *end;
+        long pid = strtol(args[i], &end, 10);
+        if (*end || pid <= 0) {
+            fprintf(stderr, WAIT_USAGE);
+            free(targets);
+            return 2;
+        }
+        job = findJob(jobsQueue, (pid_t)pid);
+        last = job && job->started ? job : NULL;
+        if (!last) {
+            fprintf(stderr, "wait: %ld is not a job\n", pid);
+            result = 127;
+            continue;
+        }
+        // a job given twice is waited for once
+        int j;
+        for (j = 0; j < count && targets[j].job != job; j++);
+        if (j == count) targets[count++].job = job;
+    }
+    for (i = 0; i < count; i++) {
+        targets[i].pid = targets[i].job->pid;
+        targets[i].fd = -1;
+        targets[i].done = 0;
+        targets[i].code = 127;
+    }
+    qsort(targets, count, sizeof(Target), compareTargets);
+    int epollFd = count ? epoll_create1(EPOLL_CLOEXEC) : -1;
+    if (count && epollFd < 0) {
+        perror(SYS_CALL_ERR);
+        free(targets);
+        return 1;
+    }
+    int limit = next && count ? 1 : count, polled = 0;
+    // while SIGCHLD is held no job can be reaped, so each one that isn't in
+    // the ring yet can still be opened as a pidfd
+    holdChildExits(1);
+    int finished = collectExits(jobsQueue, targets, count, epollFd, limit);
+    for (i = 0; i < count && finished < limit; i++) {
+        Target *target = &targets[i];
+        if (target->done) continue;
+        target->fd = target->job->pidfd >= 0 ? target->job->pidfd : syscall(SYS_pidfd_open, target->pid, 0);
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.u32 = i;
+        // once the fds run out the job is checked every UNWATCHED_POLL_MS,
+        // it isn't finished before it was reaped
+        if (target->fd < 0 || epoll_ctl(epollFd, EPOLL_CTL_ADD, target->fd, &event) < 0) {
+            if (target->fd != target->job->pidfd && target->fd >= 0) close(target->fd);
+            target->fd = -1;
+            polled++;
+        }
+    }
+    holdChildExits(0);
+    // the jobs' timeouts fire while the builtin waits
+    struct epoll_event timer;
+    timer.events = EPOLLIN;
+    timer.data.u32 = TIMER_EVENT;
+    if (count && timeoutFd() >= 0) epoll_ctl(epollFd, EPOLL_CTL_ADD, timeoutFd(), &timer);
+    struct epoll_event events[EVENT_BATCH];
+    while (finished < limit) {
+        int n = epoll_wait(epollFd, events, EVENT_BATCH, polled ? UNWATCHED_POLL_MS : -1);
+        if (n < 0 && errno != EINTR) {
+            perror(SYS_CALL_ERR);
+            break;
+        }
+        // the SIGCHLD handler reaped most of the jobs that are ready already,
+        // and interrupts the wait for them
+        holdChildExits(1);
+        finished += collectExits(jobsQueue, targets, count, epollFd, limit - finished);
+        int e;
+        for (e = 0; e < n && finished < limit; e++) {
+            if (events[e].data.u32 == TIMER_EVENT) {
+                fireTimeouts();
+                continue;
+            }
+            Target *target = &targets[events[e].data.u32];
+            if (!target->done) finished += finishReady(target, epollFd);
+        }
+        int stillPolled = 0;
+        for (i = 0; i < count && polled; i++) {
+            Target *target = &targets[i];
+            if (target->done || target->fd >= 0) continue;
+            if (finished < limit && finishPolled(target, epollFd)) finished++;
+            else stillPolled++;
+        }
+        polled = stillPolled;
+        holdChildExits(0);
+    }
+    if (next) result = 127;
+    for (i = 0; i < count; i++) {
+        if (targets[i].fd >= 0 && targets[i].fd != targets[i].job->pidfd) close(targets[i].fd);
+        // like sh, the status is the last given job's, or with -n the one
+        // that finished
+        if ((next && targets[i].done) || (!next && targets[i].job == last)) result = targets[i].code;
+    }
+    if (epollFd >= 0) close(epollFd);
+    free(targets);
+    return result;
+}
@@ -0,0 +1,23 @@
+#ifndef EX2_JOBWAIT_H
+#define EX2_JOBWAIT_H
+
+#include "jobs.h"
+
+#define WAIT_USAGE "usage: wait [-n] [PID...]\n"
+
+/**
+ * The function runs the wait builtin, which waits for every background job,
+ * with -n for the next one to finish, or for the given jobs. Each job's pid
+ * and exit status (128 + the signal for a killed job, ? for a reattached
+ * job) are printed as it finishes. All the jobs are waited for with one
+ * epoll set of pidfds, so the cost grows with the exits and not with the
+ * number of jobs.
+ * @param jobsQueue The jobsQueue.
+ * @param args The builtin's NULL terminated argv, starting with "wait".
+ * @return The exit status of the last given job, or with -n of the job
+ * that finished, 0 when waiting for every job, 2 on a usage error or 127 if
+ * the last pid isn't a job or a job's status is unknown.
+ */
+int runWait(JobsQueue *jobsQueue, char **args);
+
+#endif
@@ -0,0 +1,199 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include "timeout.h"
+#include "launch.h"
+
+/* from linux/ioprio.h, which glibc doesn't wrap */
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_PRIO_VALUE(class, level) (((class) << IOPRIO_CLASS_SHIFT) | (level))
+
+#define DEFAULT_NICE 10
+
+typedef struct {
+    char flag;
+    int resource;
+    /* the bytes one unit of the value stands for, 1 for counts and seconds */
+    rlim_t unit;
+} LimitFlag;
+
+static const LimitFlag limitFlags[] = {
+    {'t', RLIMIT_CPU, 1},
+    {'v', RLIMIT_AS, 1024},
+    {'d', RLIMIT_DATA, 1024},
+    {'s', RLIMIT_STACK, 1024},
+    {'m', RLIMIT_RSS, 1024},
+    {'f', RLIMIT_FSIZE, 1024},
+    {'c', RLIMIT_CORE, 1024},
+    {'n', RLIMIT_NOFILE, 1},
+    {'u', RLIMIT_NPROC, 1},
+};
+
+/**
+ * The function parses a whole word as a number in a range.
+ * @return 0 on success or -1 if it isn't one.
+ */
+static int parseNumber(const char *word, long min, long max, long *value) {
+    char *end;
+    if (!word) return -1;
+    errno = 0;
+    *value = strtol(word, &end, 10);
+    return *end || end == word || errno || *value < min || *value > max ? -1 : 0;
+}
+
+/**
+ * The function parses the ionice options after the word ionice.
+ * @return The number of words taken or -1 on a usage error.
+ */
+static int parseIonice(char **args, LaunchOptions *options) {
+    long class = IOPRIO_CLASS_IDLE, level = 0;
+    int i = 0;
+    while (args[i] && (strcmp(args[i], "-c") == 0 || strcmp(args[i], "-n") == 0)) {
+        if (args[i][1] == 'c' && parseNumber(args[i + 1], 1, 3, &class) < 0) return -1;
+        if (args[i][1] == 'n' && parseNumber(args[i + 1], 0, 7, &level) < 0) return -1;
+        i += 2;
+    }
+    // the idle class has no levels
+    options->ioPriority = IOPRIO_PRIO_VALUE(class, class == IOPRIO_CLASS_IDLE ? 0 : level);
+    return i;
+}
+
+/**
+ * The function parses the ulimit options after the word ulimit.
+ * @return The number of words taken or -1 on a usage error.
+ */
+static int parseUlimit(char **args, LaunchOptions *options) {
+    int i = 0;
+    while (args[i] && args[i][0] == '-' && args[i][1] && !args[i][2]) {
+        const LimitFlag *flag = NULL;
+        size_t f;
+        for (f = 0; f < sizeof(limitFlags) / sizeof(limitFlags[0]); f++) {
+            if (limitFlags[f].flag == args[i][1]) flag = &limitFlags[f];
+        }
+        if (!flag || !args[i + 1]) return -1;
+        rlim_t value = RLIM_INFINITY;
+        if (strcmp(args[i + 1], "unlimited") != 0) {
+            long number;
+            if (parseNumber(args[i + 1], 0, LONG_MAX / (long)flag->unit, &number) < 0) return -1;
+            value = (rlim_t)number * flag->unit;
+        }
+        // a flag given twice keeps its last value
+        int l;
+        for (l = 0; l < options->limitCount && options->limits[l].resource != flag->resource; l++);
+        if (l == MAX_LAUNCH_LIMITS) return -1;
+        if (l == options->limitCount) options->limitCount++;
+        options->limits[l].resource = flag->resource;
+        options->limits[l].value = value;
+        i += 2;
+    }
+    return i;
+}
+
+/**
+ * The function parses the timeout options after the word timeout.
+ * @return The number of words taken or -1 on a usage error.
+ */
+static int parseTimeout(char **args, LaunchOptions *options) {
+    int i = 0;
+    options->graceNs = DEFAULT_GRACE_NS;
+    if (args[i] && strcmp(args[i], "-k") == 0) {
+        if (!args[i + 1] || parseDuration(args[i + 1], &options->graceNs) < 0) return -1;
+        i += 2;
+    }
+    if (!args[i] || parseDuration(args[i], &options->timeoutNs) < 0) return -1;
+    // timeout 0 turns the default off, like it does timeout(1)
+    if (options->timeoutNs == 0) options->timeoutNs = -1;
+    return i + 1;
+}
+
+int takeLaunchOptions(Job *job) {
+    LaunchOptions *options = &job->launch;
+    char **args = job->args;
+    int i = 0, taken;
+    while (args[i]) {
+        char *word = args[i];
+        if (strcmp(word, "nice") == 0) {
+            long nice = DEFAULT_NICE;
+            taken = 0;
+            if (args[i + 1] && strcmp(args[i + 1], "-n") == 0) {
+                taken = parseNumber(args[i + 2], -40, 40, &nice) < 0 ? -1 : 2;
+            }
+            options->hasNice = 1;
+            options->nice += nice;
+        } else if (strcmp(word, "ionice") == 0) {
+            taken = parseIonice(args + i + 1, options);
+        } else if (strcmp(word, "sched") == 0) {
+            const char *policy = args[i + 1];
+            taken = 1;
+            if (policy && strcmp(policy, "batch") == 0) options->policy = SCHED_BATCH;
+            else if (policy && strcmp(policy, "idle") == 0) options->policy = SCHED_IDLE;
+            else if (policy && strcmp(policy, "other") == 0) options->policy = SCHED_OTHER;
+            else taken = -1;
+        } else if (strcmp(word, "ulimit") == 0) {
+            taken = parseUlimit(args + i + 1, options);
+        } else if (strcmp(word, "timeout") == 0 && !(args[i + 1] && strcmp(args[i + 1], "--default") == 0)) {
+            taken = parseTimeout(args + i + 1, options);
+        } else {
+            break;
+        }
+        if (taken < 0) {
+            fprintf(stderr, LAUNCH_USAGE);
+            return -1;
+        }
+        i += 1 + taken;
+    }
+    if (i == 0) return 0;
+    if (!args[i] || strcmp(args[i], "|") == 0) {
+        fprintf(stderr, LAUNCH_USAGE);
+        return -1;
+    }
+    int j;
+    for (j = 0; j < i; j++) free(args[j]);
+    memmove(args, args + i, (job->argc - i + 1) * sizeof(char *));
+    job->argc -= i;
+    job->jobName = args[0];
+    return 0;
+}
+
+int hasLaunchOptions(const LaunchOptions *options) {
+    return options->hasNice || options->ioPriority >= 0 || options->policy >= 0 || options->limitCount > 0 ||
+           options->timeoutNs > 0;
+}
+
+int applyLaunchOptions(const LaunchOptions *options) {
+    int i;
+    for (i = 0; i < options->limitCount; i++) {
+        struct rlimit limit;
+        if (getrlimit(options->limits[i].resource, &limit) < 0) {
+            perror("ulimit");
+            return -1;
+        }
+        limit.rlim_cur = options->limits[i].value;
+        if (setrlimit(options->limits[i].resource, &limit) < 0) {
+            perror("ulimit");
+            return -1;
+        }
+    }
+    if (options->policy >= 0) {
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        if (sched_setscheduler(0, options->policy, &param) < 0) perror("sched");
+    }
+    if (options->ioPriority >= 0 && syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, options->ioPriority) < 0) {
+        perror("ionice");
+    }
+    if (options->hasNice) {
+        errno = 0;
+        int nice = getpriority(PRIO_PROCESS, 0);
+        if ((nice == -1 && errno) || setpriority(PRIO_PROCESS, 0, nice + options->nice) < 0) perror("nice");
+    }
+    return 0;
+}
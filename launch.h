@@ -0,0 +1,41 @@
+#ifndef EX2_LAUNCH_H
+#define EX2_LAUNCH_H
+
+#include "jobs.h"
+
+#define LAUNCH_USAGE "usage: nice [-n N] CMD\n" \
+                     "       ionice [-c 1|2|3] [-n 0-7] CMD\n" \
+                     "       sched batch|idle|other CMD\n" \
+                     "       ulimit [-t|-v|-d|-s|-m|-f|-c|-n|-u VALUE]... CMD\n" \
+                     "       timeout [-k GRACE] DURATION CMD\n"
+
+/**
+ * The function takes the launch prefixes off the front of a job and records
+ * them in job->launch. The prefixes can be chained, like
+ * nice -n 5 ionice -c 3 ulimit -t 60 CMD, and apply to every process of the
+ * job:
+ * nice adds N (10 by default) to the niceness, ionice sets the io class and
+ * level (the idle class by default), sched sets the scheduling policy,
+ * ulimit sets soft limits (cpu time in seconds, sizes in KiB, files and
+ * processes as counts, or unlimited) and timeout runs the job in its own
+ * process group, which is terminated after DURATION, see timeout.h.
+ * @param job The job.
+ * @return 0 on success or -1 on a usage error, which it reports.
+ */
+int takeLaunchOptions(Job *job);
+/**
+ * The function returns 1 if a job was launched with any prefix and 0 else.
+ * @param options The job's options.
+ * @return 1 if an option is set and 0 else.
+ */
+int hasLaunchOptions(const LaunchOptions *options);
+/**
+ * The function applies the options to the calling process, in a child
+ * between fork and exec. A priority the process may not take is reported
+ * and skipped, like nice does.
+ * @param options The job's options.
+ * @return 0 on success or -1 if a limit couldn't be set.
+ */
+int applyLaunchOptions(const LaunchOptions *options);
+
+#endif
@@ -3,91 +3,99 @@
 #include <unistd.h>
 #include <wait.h>
 #include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <limits.h>
+#include "expand.h"
+#include "script.h"
+#include "jobs.h"
+#include "daemon.h"
+#include "metrics.h"
+#include "trace.h"
+#include "memo.h"
+#include "map.h"
+#include "redir.h"
+#include "builtins.h"
+#include "search.h"
+#include "prefetch.h"
+#include "jobtable.h"
+#include "sigchld.h"
+#include "jobwait.h"
+#include "batch.h"
+#include "pipeline.h"
+#include "launch.h"
+#include "timeout.h"
+#include "shutdown.h"
+#include "jobtop.h"
+#include "record.h"
 
 #define MAX_JOB_LEN 1024
-#define MAX_ARGS 20
-#define UNSUCCESSFUL_FORK "Unsuccessful fork\n"
-#define BAD_ALLOC "Bad memory allocation\n"
-#define SYS_CALL_ERR "Error calling system call\n"
-#define MAX_PATH_SIZE 100
+#define DIR_STACK_SIZE 32
+#define NO_HOME "cd: HOME not set\n"
+#define DIR_STACK_EMPTY "directory stack empty\n"
+#define DIR_STACK_FULL "directory stack full\n"
+#define BAD_SCRIPT "Error opening script\n"
 
 
-typedef struct Job {
-    pid_t pid;
-    char *jobName;
-    char *args[MAX_ARGS];
-    struct Job *next;
-} Job;
-
 typedef struct {
-    Job *first;
-    Job *last;
-    int size;
-} JobsQueue;
+    int fd;
+    char *path;
+} Dir;
+
+/* the current directory, held open so that relative cd's never walk from / */
+static Dir cwd = {-1, NULL};
+/* pushd's stack, every entry keeps its dirfd so popd is a single fchdir */
+static Dir dirStack[DIR_STACK_SIZE];
+static int dirStackSize = 0;
 
 /**
- * The function creates a new job given its parameters.
- * @param n_jobName the name of the job.
- * @return a pointer to the newly created job.
- */
-Job *newJob(char *n_jobName, char *[]);
-/**
- * The function copy's a job's args to the job.
- * @param job The given job.
- * @param n_args The job's args to copied.
- */
-void cpyArgs(Job *job, char *n_args[]);
-/**
- * The function frees the job's args.
- * @param args The args to free.
+ * The function is the read function of the shell's stdin. stdio only calls
+ * it once its buffer is empty, so the timeouts fire while the shell waits
+ * for a line, and a line that is buffered already is read at once.
  */
-void freeArgs(char *args[]);
+static ssize_t readStdin(void *cookie, char *buf, size_t size);
 /**
- * The function deletes the given job.
- * @param job The given job.
+ * The function reads a line from the prompt.
+ * @return The line or NULL on EOF.
  */
-void deleteJob(Job *job);
+char *getInput();
 /**
- * The function creates a new JobQueue.
- * @return The new jobQueue.
+ * The function reads a here-doc's body from the prompt, up to a line of the
+ * delimiter.
+ * @param delimiter The delimiter.
+ * @return The newly allocated body or NULL on EOF or bad alloc.
  */
-JobsQueue *createJobsQueue();
+char *readHeredoc(const char *delimiter);
 /**
- * The function creates a new jobsQueue given a job.
- * @param The given job.
- * @return The new jobsQueue.
- */
-JobsQueue *createJobQueue(Job *job);
-/**
- * The function returns 1 if the jobsQueue is empty and 0 else.
- * @param jobsQueue The given jobsQueue.
- * @return 1 if the jobsQueue is empty and 0 else.
+ * The function returns a job received from prompt.
+ * @param wait Flag to wait for fork to finish.
+ * @return The new job.
  */
-int isEmpty(JobsQueue *jobsQueue);
+Job *getPromptJob(int *wait);
 /**
- * The function add a new job to the jobsQueue.
- * @param jobsQueue THe given jobsQueue.
- * @param job The given job.
+ * The function runs a job, either as a builtin or in a new process.
+ * @param jobsQueue The jobsQueue.
+ * @param job The job, the function takes ownership of it.
+ * @param wait Flag to wait for the job to finish.
  * @return The jobsQueue.
  */
-JobsQueue *addJob(JobsQueue *jobsQueue, Job *job);
+JobsQueue *runJob(JobsQueue *jobsQueue, Job *job, int wait);
 /**
- * The function frees the jobsQueue.
+ * The function runs every command of a script file. The script is parsed
+ * once and the parsed form is cached, so later runs of the same content
+ * skip splitting entirely.
+ * @param path The script's path.
  * @param jobsQueue The jobsQueue.
+ * @return The jobsQueue.
  */
-void freeJobsQueue(JobsQueue *jobsQueue);
-/**
- * The function returns a job received from prompt.
- * @param wait Flag to wait for fork to finish.
- * @return The new job.
- */
-Job *getPromptJob(int *wait);
+JobsQueue *runScript(const char *path, JobsQueue *jobsQueue);
 /**
- * The function checks if thread pid needs to waited for, and waits for it.
+ * The function checks if the job needs to waited for, and waits for it.
  * @param wait The flag.
- * @param pid The thread.
+ * @param job The job.
  */
-void checkForWait(int wait, pid_t pid);
+void checkForWait(int wait, Job *job);
 /**
  * The function exits the command prompt with an error msg.
  * @param error The error msg.
@@ -95,195 +103,382 @@ void checkForWait(int wait, pid_t pid);
 void exitPrompt(char *error);
 /**
  * The function checks the jobs name and will execute specific jobs accordingly.
+ * Foreground jobs of common utilities run in-process, see builtins.h.
  * @param job The given job.
  * @param jobsQueue The jobsQueue.
+ * @param wait Flag for a foreground job.
  * @return 1 if should continue or 0 to exec and fork.
  */
-int checkJobName(Job *job, JobsQueue *jobsQueue);
+int checkJobName(Job *job, JobsQueue *jobsQueue, int wait);
 /**
- * The function will print the jobs from the jobsQueue.
- * @param jobsQueue The jobsQueue.
+ * The function will changeDir according to bash's cd.
+ * @param args cd's args.
+ * @return success or failure.
  */
-void printJobs(JobsQueue *jobsQueue);
+int cd(char *args[]);
 /**
- * The function will removed jobs that have completed from the jobsQueue.
- * @param jobsQueue The jobsQueue.
+ * The function opens the starting directory and sets the logical cwd.
+ * @return 0 on success or -1 on failure.
  */
-void removeCompletedJobs(JobsQueue *jobsQueue);
+int initCwd();
 /**
- * The function will changeDir according to bash's cd.
- * @param args cd's args.
+ * The function joins a path to a base directory and normalizes . and ..
+ * @param base The absolute directory the path is relative to.
+ * @param path The path, absolute paths ignore base.
+ * @return A newly allocated absolute path or NULL on bad alloc.
+ */
+char *joinPath(const char *base, const char *path);
+/**
+ * The function opens a directory relative to the current directory.
+ * @param path The directory's path.
+ * @param dir The opened dir, only set on success.
+ * @return 0 on success or -1 on failure.
+ */
+int openDir(const char *path, Dir *dir);
+/**
+ * The function makes the given dir the current directory.
+ * @param dir The dir, the function takes ownership of it.
+ * @return 0 on success or -1 on failure.
+ */
+int enterDir(Dir dir);
+/**
+ * The function pushes the current directory and changes to args[1], with no
+ * args it swaps the current directory with the top of the stack.
+ * @param args pushd's args.
  * @return success or failure.
  */
-int cd(char *args[]);
+int pushd(char *args[]);
+/**
+ * The function pops the top of the directory stack and changes to it.
+ * @return success or failure.
+ */
+int popd();
+/**
+ * The function prints the current directory followed by the directory stack.
+ */
+void printDirs();
 
 
-int main() {
+int main(int argc, char *argv[]) {
     int wait_;
+    initTrace();
+    if (argc > 2 && strcmp(argv[1], "--daemon") == 0) return runDaemon(argv[2]);
+    initRecord();
     JobsQueue *jobsQueue = createJobsQueue();
     if (!jobsQueue) exitPrompt(BAD_ALLOC);
-    do {
+    if (initCwd() < 0) exitPrompt(SYS_CALL_ERR);
+    jobsQueue = openJobTable(jobsQueue);
+    initChildExits();
+    initTimeouts();
+    initShutdown();
+    initPrefetch();
+    // the shell reads its stdin through waitInput, see readStdin
+    cookie_io_functions_t stdinIo = {readStdin, NULL, NULL, NULL};
+    FILE *in = fopencookie(NULL, "r", stdinIo);
+    if (in) stdin = in;
+    if (argc > 1) {
+        jobsQueue = runScript(argv[1], jobsQueue);
+    } else do {
+        flushMetrics(0);
+        flushTrace(0);
+        checkPrefetch();
+        removeCompletedJobs(jobsQueue);
+        expireTimeouts();
         Job *job = getPromptJob(&wait_);
         if (!job) break;
-        if (checkJobName(job, jobsQueue)) continue;
-        pid_t pid = fork();
-        if (pid == 0) {
-            execvp(job->jobName, job->args);
-            perror(SYS_CALL_ERR);
-            deleteJob(job);
-            exit(1);//or exit 0?
-        }
-        else if (pid > 0) {
-            job->pid = pid;
-            printf("%d\n", pid);
-            jobsQueue = addJob(jobsQueue, job); //check for null
-            checkForWait(wait_, pid);
-        }
-        else if (pid < 0) {
-            deleteJob(job);
-            perror(UNSUCCESSFUL_FORK);
-            //exit w freeing
-        }
+        jobsQueue = runJob(jobsQueue, job, wait_);
     } while (1);
-    wait(NULL);//kill instead of wait
+    int code = shutdownShell(jobsQueue, NULL);
+    flushMetrics(1);
+    flushTrace(1);
+    savePrefetch();
     freeJobsQueue(jobsQueue);
+    return code;
 }
 
-Job *newJob(char *n_jobName, char *n_args[]) {
-    Job *job = (Job *)malloc(sizeof(Job));
-    if (!job) {
-        free(n_jobName);
-        freeArgs(n_args);
-        perror(BAD_ALLOC);
-        return NULL;
+JobsQueue *runJob(JobsQueue *jobsQueue, Job *job, int wait) {
+    if (takeLaunchOptions(job) < 0) {
+        deleteJob(job);
+        return jobsQueue;
     }
-    job->jobName = n_jobName;
-    cpyArgs(job, n_args);
-    job->next = NULL;
-}
-void cpyArgs(Job *job, char *n_args[]) {
-    int i = 0;
-        char *curr = n_args[i];
-        while (curr) {
-            (job->args)[i++] = curr;
-            curr = n_args[i];
-    }
-    (job->args)[i] = curr;
-}
-void freeArgs(char *args[]) {
-    int i = 0;
-    char *curr = args[i];
-    while (curr) {
-        char *temp = curr;
-        curr = args[i++];
-        free(temp);
+    if (!wait) useDefaultTimeout(&job->launch);
+    if (isPipeline(job)) return runPipeline(jobsQueue, job, wait);
+    if (checkJobName(job, jobsQueue, wait)) {
+        metrics.builtinsRun++;
+        TRACE(TRACE_BUILTIN, 0, 0);
+        deleteJob(job);
+        return jobsQueue;
+    }
+    // a failed exec is reported through a close-on-exec pipe, which also
+    // times the spawn up to the moment exec succeeded
+    int execErr[2];
+    if (pipe2(execErr, O_CLOEXEC) < 0) execErr[0] = execErr[1] = -1;
+    noteLaunch(job->jobName);
+    long long started = nowNs();
+    // a background job is reaped by the SIGCHLD handler, which must watch it
+    // before it can exit
+    if (!wait) holdChildExits(1);
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (!wait) holdChildExits(0);
+        // a background job or one with a timeout leads its own process
+        // group, which the timeout and the shutdown signal
+        if (!wait || job->launch.timeoutNs > 0) setpgid(0, 0);
+        if (job->stdinFd >= 0) dup2(job->stdinFd, 0);
+        int launched = applyLaunchOptions(&job->launch) == 0;
+        int err = launched ? 0 : errno;
+        if (launched) {
+            execvp(job->jobName, job->args);
+            err = errno;
+            perror(SYS_CALL_ERR);
+        }
+        // like a pipeline's commands, 127 for a command that isn't found and
+        // 126 for one that can't run or whose launch options can't be applied
+        int code = launched && err == ENOENT ? 127 : 126;
+        if (execErr[1] >= 0 && write(execErr[1], &err, sizeof(err)) < 0) _exit(code);
+        deleteJob(job);
+        _exit(code);
+    }
+    if (!wait) {
+        if (pid > 0) job->watched = watchExit(pid) == 0;
+        holdChildExits(0);
+    }
+    // set by both, so the group exists before either goes on
+    if (pid > 0 && (!wait || job->launch.timeoutNs > 0)) {
+        setpgid(pid, pid);
+        job->pgid = pid;
+    }
+    if (execErr[1] >= 0) close(execErr[1]);
+    if (job->stdinFd >= 0) {
+        close(job->stdinFd);
+        job->stdinFd = -1;
+    }
+    if (pid > 0) {
+        int err;
+        ssize_t n = -1;
+        while (execErr[0] >= 0 && (n = read(execErr[0], &err, sizeof(err))) < 0 && errno == EINTR);
+        if (execErr[0] >= 0) close(execErr[0]);
+        metrics.commandsLaunched++;
+        TRACE_AT(TRACE_FORK, started, pid, 0);
+        if (n == sizeof(err)) {
+            metrics.execFailures++;
+            TRACE(TRACE_EXEC_FAILED, pid, err);
+        } else {
+            observeSpawn(nowNs() - started);
+            TRACE(TRACE_EXEC, pid, 0);
+        }
+        job->pid = pid;
+        job->started = started;
+        if (job->launch.timeoutNs > 0) addTimeout(job);
+        printf("%d\n", pid);
+        jobsQueue = addJob(jobsQueue, job); //check for null
+        metrics.jobsRunning++;
+        if (!wait) recordJob(job);
+        checkForWait(wait, job);
+    }
+    else if (pid < 0) {
+        if (execErr[0] >= 0) close(execErr[0]);
+        metrics.forkFailures++;
+        deleteJob(job);
+        perror(UNSUCCESSFUL_FORK);
+        //exit w freeing
     }
-}
-void deleteJob(Job *job) {
-    if (!job) return;
-    free(job->jobName);
-    int i = 0;
-    /*char *curr = job->args[i];
-    while (curr) {
-        char *temp = curr;
-        curr = job->args[i++];
-        free(temp);
-    }*/
-    //freeArgs(job->args);
-    free(job);
-}
-JobsQueue *createJobsQueue() {
-    JobsQueue *jobsQueue = (JobsQueue*)malloc(sizeof(JobsQueue));
-    if (!jobsQueue) return NULL;
-    jobsQueue->first = NULL;
-    jobsQueue->last = NULL;
-    jobsQueue->size = 0;
-    return jobsQueue;
-}
-JobsQueue *createJobQueue(Job *job) {
-    if (!job) return createJobsQueue();
-    JobsQueue *jobsQueue = (JobsQueue*)malloc(sizeof(JobsQueue));
-    if (!jobsQueue) return NULL;
-    jobsQueue->first = job;
-    jobsQueue->last = job;
-    jobsQueue->size = 1;
     return jobsQueue;
 }
-int isEmpty(JobsQueue *jobsQueue) { return jobsQueue->size == 0; }
-JobsQueue *addJob(JobsQueue *jobsQueue, Job *job) {
-    if (!jobsQueue) {
-        if (job) freeJobsQueue(createJobQueue(job));
+
+JobsQueue *runScript(const char *path, JobsQueue *jobsQueue) {
+    Script script;
+    if (openScript(path, &script) < 0) {
+        perror(BAD_SCRIPT);
         return jobsQueue;
     }
-    if (!job) return NULL;
-    if (jobsQueue->size == 0) {
-        freeJobsQueue(jobsQueue);
-        jobsQueue = createJobQueue(job);
-        return jobsQueue;
+    ScriptCommand command;
+    while (nextScriptCommand(&script, &command)) {
+        removeCompletedJobs(jobsQueue);
+        expireTimeouts();
+        ArgList list;
+        initArgList(&list);
+        const char *word = command.words;
+        uint32_t i;
+        int err = 0;
+        for (i = 0; i < command.argc && !err; i++) {
+            size_t len = strlen(word);
+            int matches = 0;
+            if ((command.flags & CMD_HAS_GLOB) && hasGlob(word)) matches = expandGlob(word, &list);
+            if (matches < 0) err = 1;
+            else if (matches == 0) {
+                char *copy = (char *)malloc(len + 1);
+                if (!copy || appendArg(&list, (char *)memcpy(copy, word, len + 1)) < 0) {
+                    free(copy);
+                    err = 1;
+                }
+            }
+            word += len + 1;
+        }
+        if (err) {
+            freeArgList(&list);
+            perror(BAD_ALLOC);
+            break;
+        }
+        int stdinFd, *stageFds, stageCount;
+        if (takeRedirections(&list, command.heredoc, &stdinFd, &stageFds, &stageCount) < 0 || list.size == 0) {
+            closeRedirections(stdinFd, stageFds, stageCount);
+            freeArgList(&list);
+            continue;
+        }
+        if (appendArg(&list, NULL) < 0) {
+            closeRedirections(stdinFd, stageFds, stageCount);
+            freeArgList(&list);
+            perror(BAD_ALLOC);
+            break;
+        }
+        Job *job = newJob(list.args, list.size - 1);
+        if (!job) {
+            closeRedirections(stdinFd, stageFds, stageCount);
+            break;
+        }
+        job->stdinFd = stdinFd;
+        job->stageFds = stageFds;
+        job->stageFdCount = stageCount;
+        TRACE(TRACE_PARSE_DONE, 0, job->argc);
+        jobsQueue = runJob(jobsQueue, job, !(command.flags & CMD_BACKGROUND));
     }
-    jobsQueue->last->next = job;
-    jobsQueue->last = job;
-    (jobsQueue->size)++;
+    closeScript(&script);
     return jobsQueue;
 }
-void freeJobsQueue(JobsQueue *jobsQueue) {
-    if (!jobsQueue) return;
-    Job *curr = jobsQueue->first;
-    while (curr != NULL) {
-        Job *temp = curr;
-        curr = curr->next;
-        deleteJob(temp);
-    }
-    free(jobsQueue);
+
+static ssize_t readStdin(void *cookie, char *buf, size_t size) {
+    (void)cookie;
+    waitInput(STDIN_FILENO);
+    ssize_t n;
+    while ((n = read(STDIN_FILENO, buf, size)) < 0 && errno == EINTR);
+    return n;
 }
 char *getInput() {
-    char *jobString;
+    char *jobString = (char *)malloc(MAX_JOB_LEN);
+    if (!jobString) {
+        perror(BAD_ALLOC);
+        return NULL;
+    }
     do {
         printf("prompt>");
-        jobString = (char *)malloc(MAX_JOB_LEN);//check bad alloc
-        if (!jobString) {
-            perror(BAD_ALLOC);
+        fflush(stdout);
+        if (!fgets(jobString, MAX_JOB_LEN, stdin)) {
+            free(jobString);
             return NULL;
         }
-        fgets(jobString, MAX_JOB_LEN, stdin);
     } while (strcmp(jobString, "\n") == 0);
-    jobString[strlen(jobString) - 1] = 0;
+    recordLine(0, jobString);
+    size_t len = strlen(jobString);
+    if (jobString[len - 1] == '\n') jobString[len - 1] = 0;
     return jobString;
 }
 Job *getPromptJob(int *wait) {
-    char *jobString = getInput();
-    char *args[MAX_ARGS];
-    const char space[2] = " ";
-    int i = 0;
-    char *token = strtok(jobString, space);
-    args[i++] = token;
-    while(token) {
-        token = strtok(NULL, space);
-        args[i++] = token;
-    }
-    if (i >= 1) *wait = (strcmp(args[i - 2], "&") != 0);
-    if (!(*wait)) args[i - 2] = 0;
-    Job *job = newJob(args[0], &args[0]);
-    if (!job) return NULL;
+    ArgList list;
+    do {
+        char *jobString = getInput();
+        if (!jobString) return NULL;
+        TRACE(TRACE_INPUT_READ, 0, strlen(jobString));
+        initArgList(&list);
+        int err = splitWords(jobString, &list);
+        free(jobString);
+        if (err < 0) {
+            freeArgList(&list);
+            perror(BAD_ALLOC);
+            return NULL;
+        }
+        if (list.size == 0) freeArgList(&list);
+    } while (list.size == 0);
+    *wait = (strcmp(list.args[list.size - 1], "&") != 0);
+    if (!(*wait)) free(list.args[--list.size]);
+    const char *delimiter = heredocDelimiter(&list);
+    char *heredoc = delimiter ? readHeredoc(delimiter) : NULL;
+    int stdinFd, *stageFds, stageCount;
+    int err = takeRedirections(&list, heredoc, &stdinFd, &stageFds, &stageCount);
+    free(heredoc);
+    if (err < 0 || list.size == 0 || appendArg(&list, NULL) < 0) {
+        closeRedirections(stdinFd, stageFds, stageCount);
+        freeArgList(&list);
+        return getPromptJob(wait);
+    }
+    Job *job = newJob(list.args, list.size - 1);
+    if (!job) {
+        closeRedirections(stdinFd, stageFds, stageCount);
+        return NULL;
+    }
+    job->stdinFd = stdinFd;
+    job->stageFds = stageFds;
+    job->stageFdCount = stageCount;
+    TRACE(TRACE_PARSE_DONE, 0, job->argc);
     return job;
 }
-void checkForWait(int wait, pid_t pid) {
+char *readHeredoc(const char *delimiter) {
+    char line[MAX_JOB_LEN];
+    size_t size = 0, capacity = MAX_JOB_LEN;
+    char *body = (char *)malloc(capacity);
+    if (!body) return NULL;
+    body[0] = 0;
+    printf("> ");
+    while (fgets(line, MAX_JOB_LEN, stdin)) {
+        recordLine(1, line);
+        size_t len = strlen(line);
+        size_t lineLen = len - (len > 0 && line[len - 1] == '\n');
+        if (lineLen == strlen(delimiter) && strncmp(line, delimiter, lineLen) == 0) return body;
+        if (size + len + 1 > capacity) {
+            char *grown = (char *)realloc(body, capacity *= 2);
+            if (!grown) break;
+            body = grown;
+        }
+        memcpy(body + size, line, len + 1);
+        size += len;
+        printf("> ");
+    }
+    free(body);
+    return NULL;
+}
+void checkForWait(int wait, Job *job) {
     if (!wait) return;
-    waitpid(pid, NULL, 0);
+    int status;
+    if (waitChild(job->pid, &status) > 0) {
+        TRACE(TRACE_CHILD_EXIT, job->pid, status);
+        noteExitStatus(status);
+        metrics.jobsReaped++;
+        metrics.jobsRunning--;
+        observeRuntime(nowNs() - job->started);
+        job->started = 0;
+        cancelTimeout(job);
+    }
 }
 void exitPrompt(char *error) {
     perror(error);
     exit(1);
 }
-int checkJobName(Job *job, JobsQueue *jobsQueue) {
+int checkJobName(Job *job, JobsQueue *jobsQueue, int wait) {
     char *jobName = job->jobName;
+    // a job with launch options runs as a process the options apply to
+    BuiltinFunction builtin = wait && !hasLaunchOptions(&job->launch) ? findBuiltin(jobName) : NULL;
+    if (builtin) {
+        noteExitStatus(W_EXITCODE(builtin(job->argc, job->args, job->stdinFd), 0));
+        fflush(stdout);
+        return 1;
+    }
     if (strcmp(jobName, "exit") == 0) {
+        int code = shutdownShell(jobsQueue, job->args[1]);
+        flushMetrics(1);
+        flushTrace(1);
+        savePrefetch();
         freeJobsQueue(jobsQueue);
-        exit(1);
+        exit(code);
     }
     if (strcmp(jobName, "jobs") == 0) {
         removeCompletedJobs(jobsQueue);
-        printJobs(jobsQueue);
+        if (job->args[1] && strcmp(job->args[1], "--top") == 0) runTop(jobsQueue, job->args);
+        else runJobs(jobsQueue, job->args);
+        return 1;
+    }
+    if (strcmp(jobName, "wait") == 0) {
+        noteExitStatus(W_EXITCODE(runWait(jobsQueue, job->args), 0));
+        removeCompletedJobs(jobsQueue);
         return 1;
     }
     if (strcmp(jobName, "cd") == 0) {
@@ -291,54 +486,267 @@ int checkJobName(Job *job, JobsQueue *jobsQueue) {
         printf("%d\n", getpid());
         return 1;
     }
+    if (strcmp(jobName, "pushd") == 0) {
+        if (pushd(job->args) == 0) printDirs();
+        return 1;
+    }
+    if (strcmp(jobName, "popd") == 0) {
+        if (popd() == 0) printDirs();
+        return 1;
+    }
+    if (strcmp(jobName, "dirs") == 0) {
+        printDirs();
+        return 1;
+    }
+    // these wait for their commands or items in the shell, so a trailing &
+    // can't put them in the background
+    if (!wait && (strcmp(jobName, "cache") == 0 || strcmp(jobName, "map") == 0 ||
+                  strcmp(jobName, "batch") == 0 || strcmp(jobName, "search") == 0)) {
+        fprintf(stderr, "%s: can't run in the background\n", jobName);
+        noteExitStatus(W_EXITCODE(2, 0));
+        return 1;
+    }
+    if (strcmp(jobName, "cache") == 0) {
+        int status = runCached(job->args, cwd.path, job->stdinFd);
+        noteExitStatus(status >= 0 ? status : W_EXITCODE(2, 0));
+        return 1;
+    }
+    if (strcmp(jobName, "map") == 0) {
+        // like xargs, 1 if any item failed and 2 on a usage error
+        int failed = runMap(job->args, job->stdinFd);
+        noteExitStatus(W_EXITCODE(failed < 0 ? 2 : failed > 0, 0));
+        return 1;
+    }
+    if (strcmp(jobName, "batch") == 0) {
+        // like xargs, the chunks read /dev/null, several run at once
+        if (job->stdinFd >= 0) {
+            fprintf(stderr, "batch: stdin can't be redirected, the chunks read /dev/null\n");
+            noteExitStatus(W_EXITCODE(2, 0));
+            return 1;
+        }
+        noteExitStatus(W_EXITCODE(runBatch(job->args, &job->launch), 0));
+        return 1;
+    }
+    if (strcmp(jobName, "shutdown") == 0) {
+        runShutdownPolicy(job->args);
+        return 1;
+    }
+    if (strcmp(jobName, "timeout") == 0) {
+        runTimeoutDefault(job->args);
+        return 1;
+    }
+    if (strcmp(jobName, "rewrite") == 0) {
+        runRewrite(job->args, job->stdinFd, NULL, 0);
+        job->stdinFd = -1;
+        return 1;
+    }
+    if (strcmp(jobName, "buf") == 0) {
+        runBuf(job->args, job->stdinFd);
+        return 1;
+    }
+    if (strcmp(jobName, "search") == 0) {
+        noteExitStatus(W_EXITCODE(runSearch(job->argc, job->args, job->stdinFd), 0));
+        return 1;
+    }
+    if (strcmp(jobName, "prefetch") == 0) {
+        runPrefetch(job->args);
+        return 1;
+    }
+    if (strcmp(jobName, "builtins") == 0) {
+        switchBuiltins(job->args);
+        return 1;
+    }
+    if (strcmp(jobName, "stats") == 0) {
+        printMetrics(job->args[1] && strcmp(job->args[1], "--json") == 0);
+        return 1;
+    }
+    if (strcmp(jobName, "pwd") == 0) {
+        printf("%s\n", cwd.path);
+        return 1;
+    }
     return 0;
 }
 
-void printJobs(JobsQueue *jobsQueue) {
-    Job *job = jobsQueue->first;
-    while (job) {
-        printf("%d\t", job->pid);
-        int i = 0;
-        while (job->args[i]) printf("%s ", job->args[i++]);
-        printf("\n");
-        job = job->next;
+int cd(char *args[]) {
+    const char *path = args[1];
+    if (!path) path = getenv("HOME");
+    if (!path) {
+        fprintf(stderr, NO_HOME);
+        return -1;
     }
+    Dir dir;
+    if (openDir(path, &dir) < 0) return -1;
+    return enterDir(dir);
 }
 
-void removeCompletedJobs(JobsQueue *jobsQueue) {
-    Job *curr = jobsQueue->first;
-    if (!curr) return;
-    Job *next = curr->next;
-    while (next) {
-        if ((getpgid(next->pid) < 0)) {
-            curr->next = next->next;
-            deleteJob(next);
+int initCwd() {
+    cwd.fd = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (cwd.fd < 0) return -1;
+    // trust $PWD when it names this directory so symlinked paths survive
+    const char *pwd = getenv("PWD");
+    struct stat pwdStat, dotStat;
+    if (pwd && pwd[0] == '/' && stat(pwd, &pwdStat) == 0 && fstat(cwd.fd, &dotStat) == 0
+        && pwdStat.st_dev == dotStat.st_dev && pwdStat.st_ino == dotStat.st_ino) {
+        cwd.path = joinPath("/", pwd);
+    } else {
+        cwd.path = getcwd(NULL, 0);
+    }
+    return cwd.path ? 0 : -1;
+}
+
+char *joinPath(const char *base, const char *path) {
+    size_t baseLen = (path[0] == '/') ? 0 : strlen(base);
+    char *joined = (char *)malloc(baseLen + strlen(path) + 3);
+    if (!joined) {
+        perror(BAD_ALLOC);
+        return NULL;
+    }
+    size_t len = 0;
+    const char *parts[2] = {path[0] == '/' ? path : base, path[0] == '/' ? NULL : path};
+    int p;
+    for (p = 0; p < 2 && parts[p]; p++) {
+        const char *curr = parts[p];
+        while (*curr) {
+            while (*curr == '/') curr++;
+            const char *end = curr;
+            while (*end && *end != '/') end++;
+            size_t partLen = end - curr;
+            if (partLen == 0 || (partLen == 1 && curr[0] == '.')) {
+                // nothing to add
+            } else if (partLen == 2 && curr[0] == '.' && curr[1] == '.') {
+                while (len > 0 && joined[len - 1] != '/') len--;
+                if (len > 0) len--;
+            } else {
+                joined[len++] = '/';
+                memcpy(joined + len, curr, partLen);
+                len += partLen;
+            }
+            curr = end;
         }
-        curr = curr->next;
-        if (curr) next = curr->next;
-        else next = NULL;
     }
-    if (jobsQueue->first && (getpgid(jobsQueue->first->pid) < 0)) {
-        curr = jobsQueue->first;
-        jobsQueue->first = jobsQueue->first->next;
-        deleteJob(curr);
+    if (len == 0) joined[len++] = '/';
+    joined[len] = 0;
+    return joined;
+}
+
+/**
+ * The function returns 1 if a path has a .. component and 0 else.
+ */
+static int hasDotDot(const char *path) {
+    const char *p = path;
+    while ((p = strstr(p, "..")) != NULL) {
+        if ((p == path || p[-1] == '/') && (p[2] == 0 || p[2] == '/')) return 1;
+        p += 2;
     }
+    return 0;
 }
 
-int cd(char *args[]) {
-    char *pth = args[1];//what if no path
-    char path[MAX_PATH_SIZE];
-    strcpy(path,pth);
+/**
+ * The function returns the physical path of a directory fd.
+ * @return The path or NULL on failure.
+ */
+static char *fdPath(int fd) {
+    char link[64], path[PATH_MAX];
+    snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+    ssize_t len = readlink(link, path, sizeof(path) - 1);
+    if (len <= 0) return NULL;
+    path[len] = 0;
+    return strdup(path);
+}
 
-    char cwd[MAX_PATH_SIZE];
-    if(pth[0] != '/')
-    {// true for the dir in cwd
-        getcwd(cwd,sizeof(cwd));
-        strcat(cwd,"/");
-        strcat(cwd,path);
-        chdir(cwd);
-    }else{//true for dir w.r.t. /
-        chdir(pth);
+int openDir(const char *path, Dir *dir) {
+    char *logical = joinPath(cwd.path, path);
+    if (!logical) return -1;
+    // like cd -L, a .. drops the logical path's last component rather than
+    // going to the physical parent, so the path opened is the one PWD names;
+    // without a .. both are the same directory and the walk starts at cwd
+    int fd = hasDotDot(path) ? open(logical, O_PATH | O_DIRECTORY | O_CLOEXEC)
+                             : openat(cwd.fd, path, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0 && hasDotDot(path)) {
+        // the logical path is gone, so like bash the physical one is used,
+        // and named by its physical path
+        fd = openat(cwd.fd, path, O_PATH | O_DIRECTORY | O_CLOEXEC);
+        free(logical);
+        logical = fd >= 0 ? fdPath(fd) : NULL;
+        if (fd >= 0 && !logical) {
+            close(fd);
+            fd = -1;
+        }
     }
+    if (fd < 0) {
+        perror(SYS_CALL_ERR);
+        free(logical);
+        return -1;
+    }
+    dir->fd = fd;
+    dir->path = logical;
+    return 0;
+}
+
+int enterDir(Dir dir) {
+    if (fchdir(dir.fd) < 0) {
+        perror(SYS_CALL_ERR);
+        close(dir.fd);
+        free(dir.path);
+        return -1;
+    }
+    close(cwd.fd);
+    free(cwd.path);
+    cwd = dir;
+    setenv("PWD", cwd.path, 1);
     return 0;
 }
+
+int pushd(char *args[]) {
+    Dir dir;
+    if (!args[1]) {
+        if (dirStackSize == 0) {
+            fprintf(stderr, DIR_STACK_EMPTY);
+            return -1;
+        }
+        dir = dirStack[dirStackSize - 1];
+        if (fchdir(dir.fd) < 0) {
+            perror(SYS_CALL_ERR);
+            return -1;
+        }
+        dirStack[dirStackSize - 1] = cwd;
+        cwd = dir;
+        setenv("PWD", cwd.path, 1);
+        return 0;
+    }
+    if (dirStackSize == DIR_STACK_SIZE) {
+        fprintf(stderr, DIR_STACK_FULL);
+        return -1;
+    }
+    if (openDir(args[1], &dir) < 0) return -1;
+    if (fchdir(dir.fd) < 0) {
+        perror(SYS_CALL_ERR);
+        close(dir.fd);
+        free(dir.path);
+        return -1;
+    }
+    dirStack[dirStackSize++] = cwd;
+    cwd = dir;
+    setenv("PWD", cwd.path, 1);
+    return 0;
+}
+
+int popd() {
+    if (dirStackSize == 0) {
+        fprintf(stderr, DIR_STACK_EMPTY);
+        return -1;
+    }
+    if (enterDir(dirStack[dirStackSize - 1]) < 0) {
+        dirStackSize--;
+        return -1;
+    }
+    dirStackSize--;
+    return 0;
+}
+
+void printDirs() {
+    printf("%s", cwd.path);
+    int i;
+    for (i = dirStackSize - 1; i >= 0; i--) printf(" %s", dirStack[i].path);
+    printf("\n");
+}
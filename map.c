@@ -0,0 +1,439 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <wait.h>
+#include "reap.h"
+#include "metrics.h"
+#include "trace.h"
+#include "record.h"
+#include "batch.h"
+#include "map.h"
+
+/* lines are dealt to the slots' deques this many at a time */
+#define DEAL_CHUNK 4
+#define MAP_EVENTS 64
+
+typedef struct {
+    char *data;
+    size_t size;
+    size_t capacity;
+} Buffer;
+
+typedef struct {
+    long seq;
+    char *line;
+    pid_t pid;
+    int outFd;
+    int errFd;
+    Buffer out;
+    Buffer err;
+    /* the child and output watches that did not end yet */
+    int pending;
+    int status;
+    int slot;
+} Item;
+
+/* a ring of items, its owner pops the front and thieves pop the back */
+typedef struct {
+    Item **items;
+    int head;
+    int count;
+    int capacity;
+} Deque;
+
+typedef struct {
+    char **cmd;
+    int slots;
+    int keepOrder;
+    FILE *input;
+    int eof;
+    int dealNext;
+    Deque *deques;
+    int queued;
+    int running;
+    Reaper *reaper;
+    long nextSeq;
+    /* -k: items that ended, indexed by seq, until the earlier ones end */
+    Item **done;
+    long doneCapacity;
+    long nextEmit;
+    int failed;
+} Map;
+
+/**
+ * The function appends bytes to a buffer.
+ * @return 0 on success or -1 on bad alloc.
+ */
+static int append(Buffer *buffer, const char *bytes, size_t size) {
+    if (buffer->size + size > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity : 4096;
+        while (buffer->size + size > capacity) capacity *= 2;
+        char *data = (char *)realloc(buffer->data, capacity);
+        if (!data) return -1;
+        buffer->data = data;
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->data + buffer->size, bytes, size);
+    buffer->size += size;
+    return 0;
+}
+
+/**
+ * The function appends an item to the back of a deque.
+ * @return 0 on success or -1 on bad alloc.
+ */
+static int pushBack(Deque *deque, Item *item) {
+    if (deque->count == deque->capacity) {
+        int capacity = deque->capacity ? deque->capacity * 2 : 16;
+        Item **items = (Item **)malloc(capacity * sizeof(Item *));
+        if (!items) return -1;
+        int i;
+        for (i = 0; i < deque->count; i++) items[i] = deque->items[(deque->head + i) % deque->capacity];
+        free(deque->items);
+        deque->items = items;
+        deque->head = 0;
+        deque->capacity = capacity;
+    }
+    deque->items[(deque->head + deque->count++) % deque->capacity] = item;
+    return 0;
+}
+
+static Item *popFront(Deque *deque) {
+    if (!deque->count) return NULL;
+    Item *item = deque->items[deque->head];
+    deque->head = (deque->head + 1) % deque->capacity;
+    deque->count--;
+    return item;
+}
+
+static Item *popBack(Deque *deque) {
+    if (!deque->count) return NULL;
+    return deque->items[(deque->head + --deque->count) % deque->capacity];
+}
+
+static void freeItem(Item *item) {
+    free(item->line);
+    free(item->out.data);
+    free(item->err.data);
+    free(item);
+}
+
+/**
+ * The function reads lines until every slot has some queued, dealing them
+ * round robin in chunks so neighbouring lines tend to run on one slot.
+ * @return 0 on success or -1 on bad alloc.
+ */
+static int fillDeques(Map *map) {
+    char *line = NULL;
+    size_t lineCapacity = 0;
+    int dealt = 0;
+    while (!map->eof && map->queued < map->slots * DEAL_CHUNK) {
+        ssize_t len = getline(&line, &lineCapacity, map->input);
+        if (len < 0) {
+            map->eof = 1;
+            break;
+        }
+        if (len > 0 && line[len - 1] == '\n') line[--len] = 0;
+        // the lines taken from the shell's own stdin are part of its session
+        if (map->input == stdin) recordLine(1, line);
+        Item *item = (Item *)calloc(1, sizeof(Item));
+        if (!item || !(item->line = strdup(line)) || pushBack(&map->deques[map->dealNext], item) < 0) {
+            if (item) free(item->line);
+            free(item);
+            free(line);
+            return -1;
+        }
+        item->seq = map->nextSeq++;
+        map->queued++;
+        if (++dealt % DEAL_CHUNK == 0) map->dealNext = (map->dealNext + 1) % map->slots;
+    }
+    free(line);
+    return 0;
+}
+
+/**
+ * The function returns a slot's next item: the front of its own deque, or
+ * else the back of the fullest other deque.
+ * @return The item or NULL if every deque is empty.
+ */
+static Item *nextItem(Map *map, int slot) {
+    if (map->deques[slot].count == 0 && fillDeques(map) < 0) perror("map");
+    Item *item = popFront(&map->deques[slot]);
+    if (!item) {
+        int victim = -1, i;
+        for (i = 0; i < map->slots; i++) {
+            if (map->deques[i].count && (victim < 0 || map->deques[i].count > map->deques[victim].count)) victim = i;
+        }
+        if (victim >= 0) item = popBack(&map->deques[victim]);
+    }
+    if (item) map->queued--;
+    return item;
+}
+
+/**
+ * The function replaces every {} in a word with the line.
+ * @return A newly allocated word or NULL on bad alloc.
+ */
+static char *substitute(const char *word, const char *line) {
+    size_t lineLen = strlen(line), len = 0;
+    const char *p;
+    for (p = word; *p; p++, len++) {
+        if (p[0] == '{' && p[1] == '}') {
+            len += lineLen - 1;
+            p++;
+        }
+    }
+    char *result = (char *)malloc(len + 1), *out = result;
+    if (!result) return NULL;
+    for (p = word; *p; p++) {
+        if (p[0] == '{' && p[1] == '}') {
+            memcpy(out, line, lineLen);
+            out += lineLen;
+            p++;
+        } else {
+            *out++ = *p;
+        }
+    }
+    *out = 0;
+    return result;
+}
+
+/**
+ * The function builds an item's argv from the command's template.
+ * @return The NULL terminated argv or NULL on bad alloc.
+ */
+static char **buildArgs(char **cmd, const char *line) {
+    int argc = 0, placeholders = 0, i;
+    while (cmd[argc]) {
+        if (strstr(cmd[argc], "{}")) placeholders = 1;
+        argc++;
+    }
+    char **args = (char **)calloc(argc + 2, sizeof(char *));
+    if (!args) return NULL;
+    for (i = 0; i < argc + !placeholders; i++) {
+        args[i] = i < argc ? substitute(cmd[i], line) : strdup(line);
+        if (!args[i]) {
+            while (i--) free(args[i]);
+            free(args);
+            return NULL;
+        }
+    }
+    return args;
+}
+
+/**
+ * The function writes out an item's buffered output and frees it.
+ */
+static void emitItem(Item *item) {
+    fwrite(item->out.data, 1, item->out.size, stdout);
+    fflush(stdout);
+    fwrite(item->err.data, 1, item->err.size, stderr);
+    freeItem(item);
+}
+
+/**
+ * The function handles an item that ended, emitting it and, with -k, the
+ * ended items it was holding back.
+ */
+static void finishItem(Map *map, Item *item) {
+    if (!WIFEXITED(item->status) || WEXITSTATUS(item->status) != 0) map->failed++;
+    if (!map->keepOrder) {
+        emitItem(item);
+        return;
+    }
+    if (item->seq >= map->doneCapacity) {
+        long capacity = map->doneCapacity ? map->doneCapacity : 64;
+        while (item->seq >= capacity) capacity *= 2;
+        Item **done = (Item **)realloc(map->done, capacity * sizeof(Item *));
+        if (!done) {
+            perror("map");
+            emitItem(item);
+            return;
+        }
+        memset(done + map->doneCapacity, 0, (capacity - map->doneCapacity) * sizeof(Item *));
+        map->done = done;
+        map->doneCapacity = capacity;
+    }
+    map->done[item->seq] = item;
+    while (map->nextEmit < map->doneCapacity && map->done[map->nextEmit]) {
+        emitItem(map->done[map->nextEmit]);
+        map->done[map->nextEmit++] = NULL;
+    }
+}
+
+/**
+ * The function starts an item's command on a slot.
+ * @return 0 if it started, -1 if it ended already.
+ */
+static int startItem(Map *map, int slot, Item *item) {
+    item->slot = slot;
+    item->status = 127 << 8;
+    char **args = buildArgs(map->cmd, item->line);
+    int out[2], err[2];
+    if (!args || pipe2(out, O_CLOEXEC) < 0) {
+        perror("map");
+        free(args);
+        return -1;
+    }
+    if (pipe2(err, O_CLOEXEC) < 0) {
+        perror("map");
+        close(out[0]);
+        close(out[1]);
+        free(args);
+        return -1;
+    }
+    long long started = nowNs();
+    pid_t pid = fork();
+    if (pid == 0) {
+        int devNull = open("/dev/null", O_RDONLY);
+        if (devNull > 0) {
+            dup2(devNull, 0);
+            close(devNull);
+        }
+        dup2(out[1], 1);
+        dup2(err[1], 2);
+        execvp(args[0], args);
+        perror(args[0]);
+        _exit(127);
+    }
+    int i;
+    for (i = 0; args[i]; i++) free(args[i]);
+    free(args);
+    close(out[1]);
+    close(err[1]);
+    if (pid < 0) {
+        metrics.forkFailures++;
+        perror("map");
+        close(out[0]);
+        close(err[0]);
+        return -1;
+    }
+    metrics.commandsLaunched++;
+    TRACE_AT(TRACE_FORK, started, pid, 0);
+    item->pid = pid;
+    item->outFd = out[0];
+    item->errFd = err[0];
+    if (watchChild(map->reaper, pid, item) == 0) item->pending++;
+    else waitpid(pid, &item->status, 0);
+    if (watchOutput(map->reaper, out[0], item) == 0) item->pending++;
+    else close(out[0]);
+    if (watchOutput(map->reaper, err[0], item) == 0) item->pending++;
+    else close(err[0]);
+    if (!item->pending) return -1;
+    map->running++;
+    return 0;
+}
+
+/**
+ * The function keeps a slot busy until the input runs out.
+ */
+static void fillSlot(Map *map, int slot) {
+    Item *item;
+    while ((item = nextItem(map, slot))) {
+        if (startItem(map, slot, item) == 0) return;
+        finishItem(map, item);
+    }
+}
+
+/**
+ * The function handles the reaper's events, refilling the slots that free up.
+ */
+static void handleEvents(Map *map, ReapEvent *events, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        Item *item = (Item *)events[i].tag;
+        if (events[i].kind == REAP_OUTPUT && events[i].size > 0) {
+            Buffer *buffer = events[i].fd == item->outFd ? &item->out : &item->err;
+            if (append(buffer, events[i].data, events[i].size) < 0) perror("map");
+            continue;
+        }
+        if (events[i].kind == REAP_OUTPUT) {
+            close(events[i].fd);
+        } else {
+            item->status = events[i].status;
+            TRACE(TRACE_CHILD_EXIT, item->pid, item->status);
+        }
+        if (--item->pending > 0) continue;
+        int slot = item->slot;
+        map->running--;
+        finishItem(map, item);
+        fillSlot(map, slot);
+    }
+}
+
+/**
+ * The function closes the map's input, or for the shell's stdin clears the
+ * EOF it hit, so the prompt can read again.
+ */
+static void closeInput(Map *map) {
+    if (map->input == stdin) clearerr(stdin);
+    else fclose(map->input);
+}
+
+int runMap(char **args, int in) {
+    Map map;
+    memset(&map, 0, sizeof(map));
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    map.slots = cpus < 1 ? 1 : cpus > INT_MAX ? INT_MAX : (int)cpus;
+    map.input = stdin;
+    const char *path = NULL;
+    int i = 1;
+    for (; args[i] && args[i][0] == '-'; i++) {
+        if (strcmp(args[i], "--") == 0) {
+            i++;
+            break;
+        }
+        if (strcmp(args[i], "-k") == 0) map.keepOrder = 1;
+        else if (strcmp(args[i], "-j") == 0 && args[i + 1]) map.slots = parseSlots(args[++i]);
+        else if (strcmp(args[i], "-f") == 0 && args[i + 1]) path = args[++i];
+        else break;
+    }
+    if (!args[i] || args[i][0] == '-' || map.slots < 1) {
+        fprintf(stderr, MAP_USAGE);
+        return -1;
+    }
+    map.cmd = args + i;
+    if (path) {
+        map.input = fopen(path, "re");
+    } else if (in >= 0) {
+        int fd = fcntl(in, F_DUPFD_CLOEXEC, 0);
+        map.input = fd >= 0 ? fdopen(fd, "r") : NULL;
+        if (!map.input && fd >= 0) close(fd);
+    }
+    if (!map.input) {
+        perror(path ? path : "map");
+        return -1;
+    }
+    map.deques = (Deque *)calloc(map.slots, sizeof(Deque));
+    map.reaper = createReaper(REAP_AUTO);
+    if (!map.deques || !map.reaper) {
+        perror("map");
+        free(map.deques);
+        if (map.reaper) freeReaper(map.reaper);
+        closeInput(&map);
+        return -1;
+    }
+    fflush(stdout);
+    for (i = 0; i < map.slots; i++) fillSlot(&map, i);
+    ReapEvent events[MAP_EVENTS];
+    while (map.running > 0) {
+        flushReaper(map.reaper);
+        int n = reapEvents(map.reaper, events, MAP_EVENTS, -1);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            perror("map");
+            break;
+        }
+        handleEvents(&map, events, n);
+    }
+    for (i = 0; i < map.slots; i++) free(map.deques[i].items);
+    free(map.deques);
+    free(map.done);
+    freeReaper(map.reaper);
+    closeInput(&map);
+    return map.failed;
+}
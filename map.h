@@ -0,0 +1,19 @@
+#ifndef EX2_MAP_H
+#define EX2_MAP_H
+
+#define MAP_USAGE "usage: map [-j N] [-k] [-f FILE] CMD [ARGS...]\n"
+
+/**
+ * The function runs the map builtin, which runs the command once per line of
+ * the file (the redirected stdin, else the shell's stdin, by default), with every {} in its words replaced by the
+ * line, or the line appended when no word has {}. Up to N (the number of
+ * CPUs by default) commands run at once. Each item's stdout and stderr are
+ * buffered and written whole when it ends, in completion order or with -k
+ * in input order.
+ * @param args The builtin's NULL terminated argv, starting with "map".
+ * @param in The redirected stdin, or -1. It stays open.
+ * @return The number of items that failed, or -1 on a usage error.
+ */
+int runMap(char **args, int in);
+
+#endif
@@ -0,0 +1,338 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <wait.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include "script.h"
+#include "metrics.h"
+#include "redir.h"
+#include "sha256.h"
+#include "memo.h"
+
+#define MEMO_MAGIC 0x4d325845
+#define MEMO_VERSION 3
+#define COPY_BUF_SIZE 65536
+
+/*
+ * An entry is the header followed by its key, the stdout and the stderr
+ * bytes. The key is everything the command's output may depend on, each
+ * part tagged and sized, with files and stdin as their SHA-256 digests so
+ * the key stays small, and the entry's file is named by its hash; the key
+ * is compared on a hit, so two commands whose hashes collide never replay
+ * each other's output.
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    int32_t status;
+    uint32_t reserved;
+    uint64_t keySize;
+    uint64_t outSize;
+    uint64_t errSize;
+} MemoHeader;
+
+typedef struct {
+    char *data;
+    size_t size;
+    size_t capacity;
+    /* 1 once an input couldn't be read, which makes the command uncacheable */
+    int failed;
+} Key;
+
+/**
+ * The function appends a tagged part to the key, the tag keeps "-e X" and
+ * "-f X" apart and the size keeps the parts from running into each other.
+ */
+static void appendKey(Key *key, char tag, const void *data, size_t size) {
+    uint64_t size64 = size;
+    size_t needed = key->size + 1 + sizeof(size64) + size;
+    if (key->failed) return;
+    if (needed > key->capacity) {
+        size_t capacity = key->capacity ? key->capacity : 4096;
+        while (needed > capacity) capacity *= 2;
+        char *grown = (char *)realloc(key->data, capacity);
+        if (!grown) {
+            key->failed = 1;
+            return;
+        }
+        key->data = grown;
+        key->capacity = capacity;
+    }
+    key->data[key->size] = tag;
+    memcpy(key->data + key->size + 1, &size64, sizeof(size64));
+    if (size) memcpy(key->data + key->size + 1 + sizeof(size64), data, size);
+    key->size = needed;
+}
+
+static void appendString(Key *key, char tag, const char *string) {
+    appendKey(key, tag, string, strlen(string));
+}
+
+/**
+ * The function adds a file's name and the digest of its content to the key.
+ */
+static void keyContent(Key *key, const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        if (fd >= 0) close(fd);
+        key->failed = 1;
+        return;
+    }
+    appendString(key, 'f', path);
+    void *data = st.st_size > 0 ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+    close(fd);
+    if (data == MAP_FAILED) {
+        key->failed = 1;
+        return;
+    }
+    unsigned char digest[SHA256_SIZE];
+    sha256(data, st.st_size, digest);
+    if (data) munmap(data, st.st_size);
+    appendKey(key, 'F', digest, sizeof(digest));
+}
+
+/**
+ * The function adds a file's name, identity and modification time to the
+ * key.
+ */
+static void keyMtime(Key *key, const char *path) {
+    struct stat st;
+    if (stat(path, &st) < 0) {
+        key->failed = 1;
+        return;
+    }
+    appendString(key, 'm', path);
+    int64_t stamp[5] = {st.st_dev, st.st_ino, st.st_size, st.st_mtim.tv_sec, st.st_mtim.tv_nsec};
+    appendKey(key, 'M', stamp, sizeof(stamp));
+}
+
+/**
+ * The function reads the command's redirected stdin and adds its digest to
+ * the key.
+ * @return An fd at the start of the same bytes for the command, or -1 on
+ * failure.
+ */
+static int keyInput(Key *key, int in) {
+    char *data = NULL;
+    size_t size = 0, capacity = 0;
+    int done = 0;
+    while (!done) {
+        if (size == capacity) {
+            capacity = capacity ? capacity * 2 : COPY_BUF_SIZE;
+            char *grown = (char *)realloc(data, capacity);
+            if (!grown) break;
+            data = grown;
+        }
+        ssize_t n = read(in, data + size, capacity - size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) break;
+        done = n == 0;
+        size += n;
+    }
+    int fd = -1;
+    if (done) {
+        unsigned char digest[SHA256_SIZE];
+        sha256(data, size, digest);
+        appendKey(key, 'i', digest, sizeof(digest));
+        // a file or a buffer is read again, a pipe's bytes are kept
+        fd = lseek(in, 0, SEEK_SET) == 0 ? fcntl(in, F_DUPFD_CLOEXEC, 0) : sealedMemfd("cache-stdin", data, size);
+    }
+    if (fd < 0) perror("cache: stdin");
+    free(data);
+    return fd;
+}
+
+/**
+ * The function copies a range of one file to another fd, with sendfile when
+ * the kernel allows it.
+ * @return 0 on success or -1 on failure.
+ */
+static int copyRange(int in, off_t offset, uint64_t size, int out) {
+    while (size > 0) {
+        ssize_t n = sendfile(out, in, &offset, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EINVAL || errno == ENOSYS)) break;
+        if (n <= 0) return -1;
+        size -= n;
+    }
+    char buf[COPY_BUF_SIZE];
+    while (size > 0) {
+        ssize_t n = pread(in, buf, size < sizeof(buf) ? size : sizeof(buf), offset);
+        if (n <= 0) return -1;
+        ssize_t written = 0;
+        while (written < n) {
+            ssize_t w = write(out, buf + written, n - written);
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) return -1;
+            written += w;
+        }
+        offset += n;
+        size -= n;
+    }
+    return 0;
+}
+
+/**
+ * The function replays a stored entry.
+ * @return The stored wait status or -1 if there is no valid entry for the
+ * key.
+ */
+static int replayEntry(const char *path, const Key *key) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    MemoHeader header;
+    struct stat st;
+    if (pread(fd, &header, sizeof(header), 0) != sizeof(header) || fstat(fd, &st) < 0 ||
+        header.magic != MEMO_MAGIC || header.version != MEMO_VERSION || header.keySize != key->size ||
+        (uint64_t)st.st_size != sizeof(header) + header.keySize + header.outSize + header.errSize) {
+        close(fd);
+        return -1;
+    }
+    char *stored = (char *)malloc(key->size + 1);
+    int same = stored && pread(fd, stored, key->size, sizeof(header)) == (ssize_t)key->size &&
+               memcmp(stored, key->data, key->size) == 0;
+    free(stored);
+    if (!same) {
+        close(fd);
+        return -1;
+    }
+    off_t offset = sizeof(header) + header.keySize;
+    fflush(stdout);
+    copyRange(fd, offset, header.outSize, 1);
+    copyRange(fd, offset + header.outSize, header.errSize, 2);
+    close(fd);
+    return header.status;
+}
+
+/**
+ * The function stores the captured output, through a temporary file so a
+ * concurrent run never replays a half written entry.
+ */
+static void storeEntry(const char *path, const Key *key, int status, int out, int err) {
+    MemoHeader header = {MEMO_MAGIC, MEMO_VERSION, status, 0, key->size, 0, 0};
+    header.outSize = lseek(out, 0, SEEK_END);
+    header.errSize = lseek(err, 0, SEEK_END);
+    size_t len = strlen(path) + 8;
+    char tmpPath[len];
+    snprintf(tmpPath, len, "%s.XXXXXX", path);
+    int fd = mkostemp(tmpPath, O_CLOEXEC);
+    if (fd < 0) return;
+    int ok = write(fd, &header, sizeof(header)) == sizeof(header) &&
+             write(fd, key->data, key->size) == (ssize_t)key->size && copyRange(out, 0, header.outSize, fd) == 0 &&
+             copyRange(err, 0, header.errSize, fd) == 0;
+    close(fd);
+    if (!ok || rename(tmpPath, path) < 0) unlink(tmpPath);
+}
+
+/**
+ * The function runs the command with its stdout and stderr captured in
+ * memfds, then replays them.
+ * @param in The command's stdin, or -1 for /dev/null.
+ * @param entryPath The entry to store the output in, or NULL.
+ * @return The wait status or -1 on failure.
+ */
+static int runCapturing(char **cmd, int in, const Key *key, const char *entryPath) {
+    int out = memfd_create("cache-stdout", MFD_CLOEXEC);
+    int err = memfd_create("cache-stderr", MFD_CLOEXEC);
+    if (out < 0 || err < 0) {
+        if (out >= 0) close(out);
+        perror("memfd_create");
+        return -1;
+    }
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        int null = in < 0 ? open("/dev/null", O_RDONLY) : in;
+        if (null > 0) {
+            dup2(null, 0);
+            close(null);
+        }
+        dup2(out, 1);
+        dup2(err, 2);
+        execvp(cmd[0], cmd);
+        perror(cmd[0]);
+        _exit(127);
+    }
+    int status = -1;
+    if (pid < 0) {
+        metrics.forkFailures++;
+        perror("fork");
+    } else {
+        metrics.commandsLaunched++;
+        while (waitpid(pid, &status, 0) < 0 && errno == EINTR);
+        copyRange(out, 0, lseek(out, 0, SEEK_END), 1);
+        copyRange(err, 0, lseek(err, 0, SEEK_END), 2);
+        if (entryPath && WIFEXITED(status) && WEXITSTATUS(status) != 127) storeEntry(entryPath, key, status, out, err);
+    }
+    close(out);
+    close(err);
+    return status;
+}
+
+int runCached(char **args, const char *cwd, int in) {
+    Key key = {NULL, 0, 0, 0};
+    appendString(&key, 'c', cwd);
+    int i = 1;
+    for (; args[i] && args[i][0] == '-'; i++) {
+        if (strcmp(args[i], "--") == 0) {
+            i++;
+            break;
+        }
+        const char *value = args[i + 1];
+        if (!value || (strcmp(args[i], "-e") && strcmp(args[i], "-f") && strcmp(args[i], "-m"))) {
+            fprintf(stderr, MEMO_USAGE);
+            free(key.data);
+            return -1;
+        }
+        i++;
+        // an input that can't be read makes the command uncacheable, not wrong
+        if (args[i - 1][1] == 'e') {
+            const char *env = getenv(value);
+            appendString(&key, 'e', value);
+            if (env) appendString(&key, '=', env);
+            else appendKey(&key, '-', NULL, 0);
+        } else if (args[i - 1][1] == 'f') {
+            keyContent(&key, value);
+        } else {
+            keyMtime(&key, value);
+        }
+    }
+    if (!args[i]) {
+        fprintf(stderr, MEMO_USAGE);
+        free(key.data);
+        return -1;
+    }
+    char **cmd = args + i;
+    for (; args[i]; i++) appendString(&key, 'a', args[i]);
+    int commandIn = -1;
+    if (in >= 0) {
+        commandIn = keyInput(&key, in);
+        if (commandIn < 0) {
+            free(key.data);
+            return -1;
+        }
+    } else {
+        appendKey(&key, 'n', NULL, 0);
+    }
+    char *dir = key.failed ? NULL : cacheDir("memo");
+    char entryPath[dir ? strlen(dir) + 24 : 1];
+    entryPath[0] = 0;
+    int status = -1;
+    if (dir) {
+        snprintf(entryPath, sizeof(entryPath), "%s/%016llx", dir,
+                 (unsigned long long)hashBytes(key.data, key.size));
+        free(dir);
+        status = replayEntry(entryPath, &key);
+    }
+    if (status < 0) status = runCapturing(cmd, commandIn, &key, entryPath[0] ? entryPath : NULL);
+    if (commandIn >= 0) close(commandIn);
+    free(key.data);
+    return status;
+}
@@ -0,0 +1,21 @@
+#ifndef EX2_MEMO_H
+#define EX2_MEMO_H
+
+#define MEMO_USAGE "usage: cache [-e VAR] [-f FILE] [-m FILE] [--] CMD [ARGS...]\n"
+
+/**
+ * The function runs the cache builtin. The command's key is its argv, the
+ * shell's logical working directory, the variables named with -e, the
+ * content of the files named with -f, the mtime of the files named with -m
+ * and the content of its redirected stdin; without a redirection it reads
+ * /dev/null. When the cache has an entry for the key its stdout, stderr and
+ * exit status are replayed, else the command runs in the foreground and a
+ * normal exit is stored. Exit status 127 (exec failed) is never stored.
+ * @param args The builtin's NULL terminated argv, starting with "cache".
+ * @param cwd The shell's logical working directory.
+ * @param in The command's redirected stdin, or -1. It stays open.
+ * @return The command's wait status, or -1 on a usage error or failure.
+ */
+int runCached(char **args, const char *cwd, int in);
+
+#endif
@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "metrics.h"
+
+#define METRICS_BUF_SIZE 8192
+#define DEFAULT_INTERVAL_SEC 10
+
+Metrics metrics;
+
+/* upper bounds of the buckets in seconds, the last bucket is +Inf */
+static const double spawnBounds[SPAWN_BUCKETS - 1] = {
+    0.00005, 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1};
+static const double runtimeBounds[RUNTIME_BUCKETS - 1] = {0.001, 0.01, 0.1, 1, 10, 60, 600};
+
+static long long lastFlush = 0;
+
+long long nowNs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+/**
+ * The function adds an observation to a histogram.
+ */
+static void observe(Histogram *histogram, const double *bounds, int buckets, long long ns) {
+    double seconds = ns / 1e9;
+    int i = 0;
+    while (i < buckets - 1 && seconds > bounds[i]) i++;
+    histogram->counts[i]++;
+    histogram->count++;
+    histogram->sum += seconds;
+}
+
+void observeSpawn(long long ns) { observe(&metrics.spawnLatency, spawnBounds, SPAWN_BUCKETS, ns); }
+
+void observeRuntime(long long ns) { observe(&metrics.jobRuntime, runtimeBounds, RUNTIME_BUCKETS, ns); }
+
+/**
+ * The function appends formatted text to a buffer, truncating at its end.
+ */
+static void appendf(char *buf, size_t size, size_t *len, const char *format, ...) {
+    if (*len >= size) return;
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(buf + *len, size - *len, format, args);
+    va_end(args);
+    if (n > 0) *len += n;
+    if (*len > size) *len = size;
+}
+
+/**
+ * The function renders a histogram in the Prometheus text format.
+ */
+static void renderHistogram(char *buf, size_t size, size_t *len, const char *name, const char *help,
+                            const Histogram *histogram, const double *bounds, int buckets) {
+    appendf(buf, size, len, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+    unsigned long cumulative = 0;
+    int i;
+    for (i = 0; i < buckets; i++) {
+        cumulative += histogram->counts[i];
+        if (i < buckets - 1) appendf(buf, size, len, "%s_bucket{le=\"%g\"} %lu\n", name, bounds[i], cumulative);
+        else appendf(buf, size, len, "%s_bucket{le=\"+Inf\"} %lu\n", name, cumulative);
+    }
+    appendf(buf, size, len, "%s_sum %.9f\n%s_count %lu\n", name, histogram->sum, name, histogram->count);
+}
+
+/**
+ * The function renders a histogram as a JSON object.
+ */
+static void renderJsonHistogram(char *buf, size_t size, size_t *len, const char *name,
+                                const Histogram *histogram, const double *bounds, int buckets) {
+    appendf(buf, size, len, "  \"%s\": {\"count\": %lu, \"sum\": %.9f, \"buckets\": [", name, histogram->count,
+            histogram->sum);
+    int i;
+    for (i = 0; i < buckets; i++) {
+        if (i < buckets - 1) appendf(buf, size, len, "[%g, %lu], ", bounds[i], histogram->counts[i]);
+        else appendf(buf, size, len, "[\"+Inf\", %lu]", histogram->counts[i]);
+    }
+    appendf(buf, size, len, "]}");
+}
+
+/**
+ * The function renders all the metrics.
+ * @return The rendered length.
+ */
+static size_t renderMetrics(char *buf, size_t size, int json) {
+    size_t len = 0;
+    if (json) {
+        appendf(buf, size, &len,
+                "{\n  \"commands_launched\": %lu,\n  \"fork_failures\": %lu,\n  \"exec_failures\": %lu,\n"
+                "  \"builtins_run\": %lu,\n  \"jobs_running\": %ld,\n  \"jobs_pending\": %ld,\n"
+                "  \"jobs_reaped\": %lu,\n  \"job_cpu_seconds\": %.6f,\n  \"jobs_timed_out\": %lu,\n",
+                metrics.commandsLaunched, metrics.forkFailures, metrics.execFailures, metrics.builtinsRun,
+                metrics.jobsRunning, metrics.jobsPending, metrics.jobsReaped, metrics.jobCpuSeconds,
+                metrics.jobsTimedOut);
+        renderJsonHistogram(buf, size, &len, "spawn_latency_seconds", &metrics.spawnLatency, spawnBounds,
+                            SPAWN_BUCKETS);
+        appendf(buf, size, &len, ",\n");
+        renderJsonHistogram(buf, size, &len, "job_runtime_seconds", &metrics.jobRuntime, runtimeBounds,
+                            RUNTIME_BUCKETS);
+        appendf(buf, size, &len, "\n}\n");
+        return len;
+    }
+    appendf(buf, size, &len,
+            "# HELP ex2_commands_launched_total Commands forked.\n# TYPE ex2_commands_launched_total counter\n"
+            "ex2_commands_launched_total %lu\n"
+            "# HELP ex2_fork_failures_total Failed forks.\n# TYPE ex2_fork_failures_total counter\n"
+            "ex2_fork_failures_total %lu\n"
+            "# HELP ex2_exec_failures_total Children whose exec failed.\n"
+            "# TYPE ex2_exec_failures_total counter\nex2_exec_failures_total %lu\n"
+            "# HELP ex2_builtins_run_total Builtins run in the shell.\n# TYPE ex2_builtins_run_total counter\n"
+            "ex2_builtins_run_total %lu\n"
+            "# HELP ex2_jobs_running Jobs in the job table.\n# TYPE ex2_jobs_running gauge\n"
+            "ex2_jobs_running %ld\n"
+            "# HELP ex2_jobs_pending Exited jobs whose output is still drained.\n# TYPE ex2_jobs_pending gauge\n"
+            "ex2_jobs_pending %ld\n"
+            "# HELP ex2_jobs_reaped_total Jobs reaped.\n# TYPE ex2_jobs_reaped_total counter\n"
+            "ex2_jobs_reaped_total %lu\n"
+            "# HELP ex2_job_cpu_seconds_total CPU time of the background jobs reaped.\n"
+            "# TYPE ex2_job_cpu_seconds_total counter\nex2_job_cpu_seconds_total %.6f\n"
+            "# HELP ex2_jobs_timed_out_total Jobs terminated because their timeout passed.\n"
+            "# TYPE ex2_jobs_timed_out_total counter\nex2_jobs_timed_out_total %lu\n",
+            metrics.commandsLaunched, metrics.forkFailures, metrics.execFailures, metrics.builtinsRun,
+            metrics.jobsRunning, metrics.jobsPending, metrics.jobsReaped, metrics.jobCpuSeconds,
+            metrics.jobsTimedOut);
+    renderHistogram(buf, size, &len, "ex2_spawn_latency_seconds", "Time from fork until exec succeeded.",
+                    &metrics.spawnLatency, spawnBounds, SPAWN_BUCKETS);
+    renderHistogram(buf, size, &len, "ex2_job_runtime_seconds", "Time from fork until the job was reaped.",
+                    &metrics.jobRuntime, runtimeBounds, RUNTIME_BUCKETS);
+    return len;
+}
+
+void printMetrics(int json) {
+    char buf[METRICS_BUF_SIZE];
+    size_t len = renderMetrics(buf, sizeof(buf), json);
+    fflush(stdout);
+    fwrite(buf, 1, len, stdout);
+    fflush(stdout);
+}
+
+/**
+ * The function returns the metrics file's interval.
+ * @return The interval in nanoseconds.
+ */
+static long long metricsInterval() {
+    const char *interval = getenv("EX2_METRICS_INTERVAL");
+    double seconds = interval ? atof(interval) : DEFAULT_INTERVAL_SEC;
+    if (seconds <= 0) seconds = DEFAULT_INTERVAL_SEC;
+    return (long long)(seconds * 1e9);
+}
+
+int metricsDueMs() {
+    if (!getenv("EX2_METRICS_FILE")) return -1;
+    long long left = lastFlush + metricsInterval() - nowNs();
+    return left <= 0 ? 0 : (int)(left / 1000000) + 1;
+}
+
+void flushMetrics(int force) {
+    const char *path = getenv("EX2_METRICS_FILE");
+    if (!path || !*path) return;
+    long long now = nowNs();
+    if (!force && now - lastFlush < metricsInterval()) return;
+    lastFlush = now;
+    char buf[METRICS_BUF_SIZE];
+    size_t len = renderMetrics(buf, sizeof(buf), 0);
+    size_t pathLen = strlen(path) + 8;
+    char tmpPath[pathLen];
+    snprintf(tmpPath, pathLen, "%s.XXXXXX", path);
+    int fd = mkostemp(tmpPath, O_CLOEXEC);
+    if (fd < 0) return;
+    fchmod(fd, 0644);
+    int ok = write(fd, buf, len) == (ssize_t)len;
+    close(fd);
+    if (!ok || rename(tmpPath, path) < 0) unlink(tmpPath);
+}
@@ -0,0 +1,71 @@
+#ifndef EX2_METRICS_H
+#define EX2_METRICS_H
+
+#define SPAWN_BUCKETS 12
+#define RUNTIME_BUCKETS 8
+
+typedef struct {
+    unsigned long counts[SPAWN_BUCKETS > RUNTIME_BUCKETS ? SPAWN_BUCKETS : RUNTIME_BUCKETS];
+    unsigned long count;
+    double sum;
+} Histogram;
+
+/*
+ * The shell's counters. They are bumped with plain increments on the hot path
+ * and only formatted when stats runs or the metrics file is due.
+ */
+typedef struct {
+    unsigned long commandsLaunched;
+    unsigned long forkFailures;
+    unsigned long execFailures;
+    unsigned long builtinsRun;
+    unsigned long jobsReaped;
+    long jobsRunning;
+    /* jobs that exited but whose output is still being drained */
+    long jobsPending;
+    /* the user and system CPU time of the jobs the SIGCHLD handler reaped */
+    double jobCpuSeconds;
+    /* jobs sent SIGTERM because their timeout passed */
+    unsigned long jobsTimedOut;
+    /* from fork until the child's exec succeeded */
+    Histogram spawnLatency;
+    /* from fork until the job was reaped */
+    Histogram jobRuntime;
+} Metrics;
+
+extern Metrics metrics;
+
+/**
+ * The function returns the monotonic time in nanoseconds.
+ * @return The time.
+ */
+long long nowNs();
+/**
+ * The function records a spawn latency.
+ * @param ns The latency in nanoseconds.
+ */
+void observeSpawn(long long ns);
+/**
+ * The function records a job's runtime.
+ * @param ns The runtime in nanoseconds.
+ */
+void observeRuntime(long long ns);
+/**
+ * The function prints the metrics.
+ * @param json 1 for JSON and 0 for the Prometheus text format.
+ */
+void printMetrics(int json);
+/**
+ * The function writes the metrics file if EX2_METRICS_FILE is set and
+ * EX2_METRICS_INTERVAL seconds (10 by default) passed since the last write.
+ * The file is replaced atomically so a collector never reads half of it.
+ * @param force 1 to write even if the interval did not pass.
+ */
+void flushMetrics(int force);
+/**
+ * The function returns how long until the metrics file is due.
+ * @return The time in milliseconds, or -1 if there is no metrics file.
+ */
+int metricsDueMs();
+
+#endif
@@ -0,0 +1,485 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <wait.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "builtins.h"
+#include "metrics.h"
+#include "trace.h"
+#include "prefetch.h"
+#include "jobtable.h"
+#include "sigchld.h"
+#include "launch.h"
+#include "timeout.h"
+#include "shutdown.h"
+#include "redir.h"
+#include "pipeline.h"
+
+#define RULE_CAT_REDIRECT 0
+#define RULE_FUSE_BUILTINS 1
+#define RULE_DROP_CAT 2
+#define RULE_COUNT 3
+
+static const char *ruleNames[RULE_COUNT] = {"cat-redirect", "fuse-builtins", "drop-cat"};
+/* 1 if a rule is on, -1 until EX2_REWRITE_OFF was read */
+static int ruleEnabled[RULE_COUNT] = {-1, -1, -1};
+
+/* the builtins that never read their stdin, so only the last of a run of
+ * them matters */
+static const char *fusable[] = {"echo", "printf", "true", "false", "test", "["};
+
+typedef struct {
+    /* the command's argv, whose strings belong to the job */
+    char **args;
+    int argc;
+    /* the fd the command reads instead of a pipe, or -1 */
+    int inFd;
+    /* what the command reads instead of a pipe, "" for the pipe */
+    const char *inName;
+} Stage;
+
+typedef struct {
+    Stage *stages;
+    int count;
+    /* 1 to print the rewrites and not run anything */
+    int explain;
+} Pipeline;
+
+/**
+ * The function returns 1 if a rule is on and 0 else.
+ */
+static int ruleOn(int rule) {
+    if (ruleEnabled[rule] < 0) {
+        const char *off = getenv("EX2_REWRITE_OFF");
+        size_t len = strlen(ruleNames[rule]);
+        ruleEnabled[rule] = 1;
+        while (off && *off) {
+            size_t n = strcspn(off, ",");
+            if (n == len && strncmp(off, ruleNames[rule], len) == 0) ruleEnabled[rule] = 0;
+            off += n + (off[n] == ',');
+        }
+    }
+    return ruleEnabled[rule];
+}
+
+/**
+ * The function returns a rule's index or -1 if there is no such rule.
+ */
+static int findRule(const char *name) {
+    int i;
+    for (i = 0; i < RULE_COUNT; i++) {
+        if (strcmp(ruleNames[i], name) == 0) return i;
+    }
+    return -1;
+}
+
+int isPipeline(Job *job) {
+    int i;
+    for (i = 0; i < job->argc; i++) {
+        if (strcmp(job->args[i], "|") == 0) return 1;
+    }
+    return 0;
+}
+
+static void freePipeline(Pipeline *pipeline) {
+    int i;
+    for (i = 0; i < pipeline->count; i++) {
+        if (pipeline->stages[i].inFd >= 0) close(pipeline->stages[i].inFd);
+        free(pipeline->stages[i].args);
+    }
+    free(pipeline->stages);
+    pipeline->stages = NULL;
+    pipeline->count = 0;
+}
+
+/**
+ * The function splits words at the | words into stages.
+ * @param in The fd the first stage reads, or -1, the pipeline takes it.
+ * @param stageFds The fds the later stages read, -1 for a pipe, or NULL;
+ * the pipeline takes them and the array.
+ * @param stageCount The size of stageFds.
+ * @return 0 on success or -1 on a syntax error or bad alloc.
+ */
+static int splitStages(char **args, int in, int *stageFds, int stageCount, Pipeline *pipeline) {
+    int i, count = 1;
+    for (i = 0; args[i]; i++) count += strcmp(args[i], "|") == 0;
+    pipeline->count = 0;
+    pipeline->stages = (Stage *)malloc(count * sizeof(Stage));
+    if (!pipeline->stages) {
+        perror(BAD_ALLOC);
+        closeRedirections(in, stageFds, stageCount);
+        return -1;
+    }
+    char **start = args;
+    for (i = 0; i < count; i++) {
+        int argc = 0;
+        while (start[argc] && strcmp(start[argc], "|") != 0) argc++;
+        Stage *stage = &pipeline->stages[pipeline->count++];
+        stage->args = NULL;
+        stage->argc = argc;
+        stage->inFd = i == 0 ? in : -1;
+        if (i > 0 && i <= stageCount) {
+            stage->inFd = stageFds[i - 1];
+            stageFds[i - 1] = -1;
+        }
+        stage->inName = stage->inFd >= 0 ? "(redirect)" : "";
+        if (argc == 0) {
+            fprintf(stderr, "syntax error near |\n");
+            freePipeline(pipeline);
+            closeRedirections(-1, stageFds, stageCount);
+            return -1;
+        }
+        stage->args = (char **)malloc((argc + 1) * sizeof(char *));
+        if (!stage->args) {
+            perror(BAD_ALLOC);
+            freePipeline(pipeline);
+            closeRedirections(-1, stageFds, stageCount);
+            return -1;
+        }
+        memcpy(stage->args, start, argc * sizeof(char *));
+        stage->args[argc] = NULL;
+        start += argc + (start[argc] != NULL);
+    }
+    free(stageFds);
+    return 0;
+}
+
+static void printPipeline(const Pipeline *pipeline) {
+    int i, j;
+    if (pipeline->count == 0) printf("(the shell)");
+    for (i = 0; i < pipeline->count; i++) {
+        if (i) printf(" | ");
+        for (j = 0; j < pipeline->stages[i].argc; j++) printf(j ? " %s" : "%s", pipeline->stages[i].args[j]);
+        if (pipeline->stages[i].inName[0]) printf(" < %s", pipeline->stages[i].inName);
+    }
+}
+
+/**
+ * The function prints the pipeline before a rule rewrites it.
+ */
+static void explainBefore(const Pipeline *pipeline, int rule) {
+    if (!pipeline->explain) return;
+    printf("%s: ", ruleNames[rule]);
+    printPipeline(pipeline);
+}
+
+/**
+ * The function prints the pipeline after a rule rewrote it.
+ */
+static void explainAfter(const Pipeline *pipeline) {
+    if (!pipeline->explain) return;
+    printf(" -> ");
+    printPipeline(pipeline);
+    printf("\n");
+}
+
+static void removeStage(Pipeline *pipeline, int index) {
+    if (pipeline->stages[index].inFd >= 0) close(pipeline->stages[index].inFd);
+    free(pipeline->stages[index].args);
+    pipeline->count--;
+    memmove(pipeline->stages + index, pipeline->stages + index + 1, (pipeline->count - index) * sizeof(Stage));
+}
+
+static int isCat(const Stage *stage) { return strcmp(stage->args[0], "cat") == 0; }
+
+/**
+ * The function turns a leading cat FILE | CMD into CMD < FILE, and a
+ * leading cat < FILE | CMD the same way.
+ */
+static void rewriteCatRedirect(Pipeline *pipeline) {
+    while (pipeline->count > 1 && isCat(&pipeline->stages[0])) {
+        Stage *cat = &pipeline->stages[0], *next = &pipeline->stages[1];
+        int fd;
+        const char *name;
+        // a command with a redirection of its own doesn't read the cat
+        if (next->inName[0]) return;
+        if (cat->argc == 2 && cat->args[1][0] != '-' && !cat->inName[0]) {
+            // a file cat can't read is left to cat, which reports it
+            struct stat st;
+            fd = open(cat->args[1], O_RDONLY | O_CLOEXEC);
+            if (fd < 0) return;
+            if (fstat(fd, &st) < 0 || S_ISDIR(st.st_mode)) {
+                close(fd);
+                return;
+            }
+            name = cat->args[1];
+        } else if (cat->argc == 1 && cat->inName[0]) {
+            fd = cat->inFd;
+            name = cat->inName;
+            cat->inFd = -1;
+        } else {
+            return;
+        }
+        explainBefore(pipeline, RULE_CAT_REDIRECT);
+        next->inFd = fd;
+        next->inName = name;
+        removeStage(pipeline, 0);
+        explainAfter(pipeline);
+    }
+}
+
+static int isFusable(const Stage *stage) {
+    size_t i;
+    for (i = 0; i < sizeof(fusable) / sizeof(fusable[0]); i++) {
+        if (strcmp(fusable[i], stage->args[0]) == 0) return findBuiltin(stage->args[0]) != NULL;
+    }
+    return 0;
+}
+
+/**
+ * The function runs a builtin in the shell with its stdout in a memfd.
+ * @return The memfd, read from its start, or -1 on failure.
+ */
+static int captureBuiltin(const Stage *stage) {
+    int fd = memfd_create("pipeline", MFD_CLOEXEC);
+    if (fd < 0) return -1;
+    fflush(stdout);
+    int saved = dup(1);
+    if (saved < 0 || dup2(fd, 1) < 0) {
+        if (saved >= 0) close(saved);
+        close(fd);
+        return -1;
+    }
+    findBuiltin(stage->args[0])(stage->argc, stage->args, stage->inFd);
+    fflush(stdout);
+    dup2(saved, 1);
+    close(saved);
+    lseek(fd, 0, SEEK_SET);
+    return fd;
+}
+
+/**
+ * The function runs the leading builtins that don't read their stdin in the
+ * shell. Only the last of them matters: its output goes to the next command
+ * through a memfd, or to stdout if the whole pipeline is builtins.
+ * @return 0 on success or -1 if the builtin's output can't be captured.
+ */
+static int rewriteFuseBuiltins(Pipeline *pipeline) {
+    int run = 0, i;
+    while (run < pipeline->count && isFusable(&pipeline->stages[run])) run++;
+    if (run == 0) return 0;
+    explainBefore(pipeline, RULE_FUSE_BUILTINS);
+    Stage *last = &pipeline->stages[run - 1];
+    if (run == pipeline->count) {
+        if (!pipeline->explain) {
+            noteExitStatus(W_EXITCODE(findBuiltin(last->args[0])(last->argc, last->args, last->inFd), 0));
+            fflush(stdout);
+        }
+    } else if (pipeline->stages[run].inName[0]) {
+        // the next command reads its own redirection, the output goes nowhere
+    } else if (pipeline->explain) {
+        pipeline->stages[run].inName = "(memfd)";
+    } else {
+        int fd = captureBuiltin(last);
+        if (fd < 0) {
+            perror(SYS_CALL_ERR);
+            return -1;
+        }
+        pipeline->stages[run].inFd = fd;
+        pipeline->stages[run].inName = "(memfd)";
+    }
+    for (i = 0; i < run; i++) removeStage(pipeline, 0);
+    explainAfter(pipeline);
+    return 0;
+}
+
+/**
+ * The function drops a cat without arguments that reads a pipe and writes
+ * one, since the command after it can read the pipe before it.
+ */
+static void rewriteDropCat(Pipeline *pipeline) {
+    struct stat st;
+    int stdoutPipe = fstat(STDOUT_FILENO, &st) == 0 && S_ISFIFO(st.st_mode);
+    int i;
+    for (i = 1; i < pipeline->count; i++) {
+        Stage *stage = &pipeline->stages[i];
+        if (!isCat(stage) || stage->argc != 1 || stage->inName[0]) continue;
+        if (i == pipeline->count - 1 && !stdoutPipe) continue;
+        explainBefore(pipeline, RULE_DROP_CAT);
+        removeStage(pipeline, i--);
+        explainAfter(pipeline);
+    }
+}
+
+/**
+ * The function runs the rewrite pass.
+ * @return 0 on success or -1 on failure.
+ */
+static int rewritePipeline(Pipeline *pipeline) {
+    // fusing may leave a cat reading a memfd first, which cat-redirect drops
+    if (ruleOn(RULE_FUSE_BUILTINS) && rewriteFuseBuiltins(pipeline) < 0) return -1;
+    if (ruleOn(RULE_CAT_REDIRECT)) rewriteCatRedirect(pipeline);
+    if (ruleOn(RULE_DROP_CAT)) rewriteDropCat(pipeline);
+    return 0;
+}
+
+/**
+ * The function forks and execs the stages, each reading the one before it.
+ * A background pipeline's stages are reaped by the SIGCHLD handler.
+ * @param pids The array to fill with the stages' pids.
+ * @param watched Set to 1 if the handler watches the last stage.
+ * @return The number of stages started.
+ */
+static int launchStages(Pipeline *pipeline, const LaunchOptions *launch, pid_t *pids, int wait, int *watched) {
+    int i, in = -1;
+    *watched = 0;
+    fflush(stdout);
+    for (i = 0; i < pipeline->count; i++) {
+        Stage *stage = &pipeline->stages[i];
+        int out[2] = {-1, -1};
+        if (i < pipeline->count - 1 && pipe2(out, O_CLOEXEC) < 0) {
+            perror(SYS_CALL_ERR);
+            break;
+        }
+        if (stage->inFd >= 0) {
+            // the stage reads its file rather than the pipe before it
+            if (in >= 0) close(in);
+            in = stage->inFd;
+            stage->inFd = -1;
+        }
+        noteLaunch(stage->args[0]);
+        long long started = nowNs();
+        // in the background or with a timeout the stages join the first
+        // one's process group
+        pid_t group = i ? pids[0] : 0;
+        if (!wait) holdChildExits(1);
+        pid_t pid = fork();
+        if (pid == 0) {
+            if (!wait) holdChildExits(0);
+            if (!wait || launch->timeoutNs > 0) setpgid(0, group);
+            if (in >= 0) dup2(in, STDIN_FILENO);
+            if (out[1] >= 0) dup2(out[1], STDOUT_FILENO);
+            if (applyLaunchOptions(launch) < 0) _exit(126);
+            execvp(stage->args[0], stage->args);
+            perror(stage->args[0]);
+            _exit(errno == ENOENT ? 127 : 126);
+        }
+        if (!wait) {
+            if (pid > 0) *watched = watchExit(pid) == 0;
+            holdChildExits(0);
+        }
+        if (pid > 0 && (!wait || launch->timeoutNs > 0)) setpgid(pid, group ? group : pid);
+        if (in >= 0) close(in);
+        if (out[1] >= 0) close(out[1]);
+        in = out[0];
+        if (pid < 0) {
+            metrics.forkFailures++;
+            perror(UNSUCCESSFUL_FORK);
+            break;
+        }
+        pids[i] = pid;
+        metrics.commandsLaunched++;
+        TRACE_AT(TRACE_FORK, started, pid, 0);
+    }
+    if (in >= 0) close(in);
+    return i;
+}
+
+JobsQueue *runPipeline(JobsQueue *jobsQueue, Job *job, int wait) {
+    if (strcmp(job->jobName, "rewrite") == 0) {
+        runRewrite(job->args, job->stdinFd, job->stageFds, job->stageFdCount);
+        job->stdinFd = -1;
+        job->stageFds = NULL;
+        job->stageFdCount = 0;
+        deleteJob(job);
+        return jobsQueue;
+    }
+    Pipeline pipeline;
+    pipeline.explain = 0;
+    int in = job->stdinFd, *stageFds = job->stageFds, stageCount = job->stageFdCount;
+    job->stdinFd = -1;
+    job->stageFds = NULL;
+    job->stageFdCount = 0;
+    pid_t *pids = NULL;
+    int started = 0, watched, i;
+    int parsed = splitStages(job->args, in, stageFds, stageCount, &pipeline) == 0;
+    if (parsed && rewritePipeline(&pipeline) == 0 && pipeline.count > 0) {
+        pids = (pid_t *)malloc(pipeline.count * sizeof(pid_t));
+        if (!pids) perror(BAD_ALLOC);
+    }
+    if (pids) {
+        job->started = nowNs();
+        started = launchStages(&pipeline, &job->launch, pids, wait, &watched);
+    }
+    if (started == 0) {
+        // a pipeline the builtins ran whole noted its status already
+        if (!parsed) noteExitStatus(W_EXITCODE(2, 0));
+        else if (pipeline.count > 0) noteExitStatus(W_EXITCODE(126, 0));
+        free(pids);
+        freePipeline(&pipeline);
+        deleteJob(job);
+        return jobsQueue;
+    }
+    job->pid = pids[started - 1];
+    if (!wait || job->launch.timeoutNs > 0) job->pgid = pids[0];
+    if (job->launch.timeoutNs > 0) addTimeout(job);
+    printf("%d\n", job->pid);
+    metrics.jobsRunning++;
+    if (!wait && started == pipeline.count) {
+        job->watched = watched;
+        jobsQueue = addJob(jobsQueue, job);
+        recordJob(job);
+    } else {
+        // a pipeline that failed to start is waited for, not left running
+        int status;
+        for (i = 0; i < started; i++) {
+            if (waitChild(pids[i], &status) <= 0) continue;
+            TRACE(TRACE_CHILD_EXIT, pids[i], status);
+            // the pipeline's status is its last command's
+            if (i == pipeline.count - 1) noteExitStatus(status);
+        }
+        // the last command never started
+        if (started < pipeline.count) noteExitStatus(W_EXITCODE(126, 0));
+        metrics.jobsReaped++;
+        metrics.jobsRunning--;
+        observeRuntime(nowNs() - job->started);
+        deleteJob(job);
+    }
+    free(pids);
+    freePipeline(&pipeline);
+    return jobsQueue;
+}
+
+int runRewrite(char **args, int in, int *stageFds, int stageCount) {
+    int i;
+    if (!args[1]) {
+        for (i = 0; i < RULE_COUNT; i++) printf("%s %s\n", ruleNames[i], ruleOn(i) ? "on" : "off");
+        closeRedirections(in, stageFds, stageCount);
+        return 0;
+    }
+    if (strcmp(args[1], "--explain") == 0 && args[2]) {
+        Pipeline pipeline;
+        pipeline.explain = 1;
+        if (splitStages(args + 2, in, stageFds, stageCount, &pipeline) < 0) return 2;
+        int anyOff = 0;
+        for (i = 0; i < RULE_COUNT; i++) anyOff |= !ruleOn(i);
+        fflush(stdout);
+        rewritePipeline(&pipeline);
+        printf("run: ");
+        printPipeline(&pipeline);
+        printf("\n");
+        if (anyOff) {
+            printf("off:");
+            for (i = 0; i < RULE_COUNT; i++) {
+                if (!ruleOn(i)) printf(" %s", ruleNames[i]);
+            }
+            printf("\n");
+        }
+        fflush(stdout);
+        freePipeline(&pipeline);
+        return 0;
+    }
+    closeRedirections(in, stageFds, stageCount);
+    int rule = args[2] && !args[3] ? findRule(args[2]) : -1;
+    if (rule < 0 || (strcmp(args[1], "on") != 0 && strcmp(args[1], "off") != 0)) {
+        fprintf(stderr, REWRITE_USAGE);
+        return 2;
+    }
+    ruleOn(rule);
+    ruleEnabled[rule] = strcmp(args[1], "on") == 0;
+    return 0;
+}
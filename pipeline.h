@@ -0,0 +1,46 @@
+#ifndef EX2_PIPELINE_H
+#define EX2_PIPELINE_H
+
+#include "jobs.h"
+
+#define REWRITE_USAGE "usage: rewrite [on|off RULE]\n" \
+                      "       rewrite --explain CMD [| CMD...]\n"
+
+/**
+ * The function returns 1 if a job is a pipeline, whose commands are
+ * separated by | words, and 0 else.
+ * @param job The job.
+ * @return 1 if the job is a pipeline and 0 else.
+ */
+int isPipeline(Job *job);
+/**
+ * The function runs a pipeline. Before it is launched a rewrite pass drops
+ * the processes that aren't needed:
+ * cat-redirect turns a leading cat FILE | into a < FILE of the next command,
+ * fuse-builtins runs leading in-process builtins (echo, printf, true, false,
+ * test) in the shell and feeds their output to the next command from a
+ * memfd, and drop-cat drops a cat without arguments between two pipes.
+ * Each rule can be switched off with the rewrite builtin or by listing it
+ * in EX2_REWRITE_OFF. Every command reads its own stdin redirection, if it
+ * has one, rather than the pipe before it, and the job's launch options
+ * apply to every command. The job is tracked by the last command's pid.
+ * @param jobsQueue The jobsQueue.
+ * @param job The job, the function takes ownership of it.
+ * @param wait Flag for a foreground job.
+ * @return The jobsQueue.
+ */
+JobsQueue *runPipeline(JobsQueue *jobsQueue, Job *job, int wait);
+/**
+ * The function runs the rewrite builtin, which lists the rewrite rules,
+ * switches one, or with --explain prints what the rewrite pass does to a
+ * pipeline without running it.
+ * @param args The builtin's NULL terminated argv, starting with "rewrite".
+ * @param in The fd stdin is redirected from, or -1, it is closed.
+ * @param stageFds For a pipeline, the fds the later commands are redirected
+ * from, or NULL, they are closed and the array freed.
+ * @param stageCount The size of stageFds.
+ * @return 0 on success or 2 on a usage error.
+ */
+int runRewrite(char **args, int in, int *stageFds, int stageCount);
+
+#endif
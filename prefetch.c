@@ -0,0 +1,364 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <wait.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "script.h"
+#include "metrics.h"
+#include "prefetch.h"
+
+#define MAX_COMMANDS 256
+#define MAX_PREFETCHED 256
+#define DEFAULT_TOP 8
+/* how deep the shared libraries' own dependencies are followed */
+#define MAX_LIB_DEPTH 4
+#define CHECK_INTERVAL_NS 5000000000LL
+
+typedef struct {
+    char *name;
+    unsigned long count;
+} LaunchCount;
+
+/* the files one prefetch touched, so shared libraries are read once */
+typedef struct {
+    char *paths[MAX_PREFETCHED];
+    int size;
+    /* drop the files from the page cache instead */
+    int evict;
+} Visited;
+
+static LaunchCount counts[MAX_COMMANDS];
+static int countsSize = 0, dirty = 0;
+static int enabled = 0, top = DEFAULT_TOP;
+/* the most launched executable, read with RWF_NOWAIT to spot a cache drop */
+static int probeFd = -1;
+static long long lastCheck = 0;
+
+static const char *libDirs[] = {"/lib/x86_64-linux-gnu", "/usr/lib/x86_64-linux-gnu", "/lib/aarch64-linux-gnu",
+                                "/usr/lib/aarch64-linux-gnu", "/lib64", "/usr/lib64", "/lib", "/usr/lib",
+                                "/usr/local/lib", NULL};
+
+/**
+ * The function returns the launch counts' path.
+ * @return A newly allocated path or NULL.
+ */
+static char *countsPath() {
+    char *dir = cacheDir(NULL);
+    if (!dir) return NULL;
+    size_t len = strlen(dir) + sizeof("/launches");
+    char *path = (char *)malloc(len);
+    if (path) snprintf(path, len, "%s/launches", dir);
+    free(dir);
+    return path;
+}
+
+/**
+ * The function finds a command the way execvp would.
+ * @return 0 if path was set or -1 if the command wasn't found.
+ */
+static int resolveCommand(const char *name, char *path, size_t size) {
+    if (strchr(name, '/')) {
+        snprintf(path, size, "%s", name);
+        return access(path, X_OK);
+    }
+    const char *dirs = getenv("PATH");
+    if (!dirs) dirs = "/usr/local/bin:/usr/bin:/bin";
+    while (*dirs) {
+        size_t len = strcspn(dirs, ":");
+        snprintf(path, size, "%.*s/%s", (int)len, dirs, name);
+        if (len && access(path, X_OK) == 0) return 0;
+        dirs += len + (dirs[len] == ':');
+    }
+    return -1;
+}
+
+/**
+ * The function finds a shared library in LD_LIBRARY_PATH and the usual
+ * directories.
+ * @return 0 if path was set or -1 if the library wasn't found.
+ */
+static int resolveLibrary(const char *name, char *path, size_t size) {
+    if (strchr(name, '/')) {
+        snprintf(path, size, "%s", name);
+        return access(path, R_OK);
+    }
+    const char *dirs = getenv("LD_LIBRARY_PATH");
+    while (dirs && *dirs) {
+        size_t len = strcspn(dirs, ":");
+        snprintf(path, size, "%.*s/%s", (int)len, dirs, name);
+        if (len && access(path, R_OK) == 0) return 0;
+        dirs += len + (dirs[len] == ':');
+    }
+    int i;
+    for (i = 0; libDirs[i]; i++) {
+        snprintf(path, size, "%s/%s", libDirs[i], name);
+        if (access(path, R_OK) == 0) return 0;
+    }
+    return -1;
+}
+
+/**
+ * The function translates a virtual address of an ELF file to its offset.
+ * @return The offset or 0 if no loaded segment has the address.
+ */
+static uint64_t vaddrOffset(const Elf64_Phdr *phdrs, int count, uint64_t vaddr) {
+    int i;
+    for (i = 0; i < count; i++) {
+        if (phdrs[i].p_type == PT_LOAD && vaddr >= phdrs[i].p_vaddr &&
+            vaddr < phdrs[i].p_vaddr + phdrs[i].p_filesz) {
+            return vaddr - phdrs[i].p_vaddr + phdrs[i].p_offset;
+        }
+    }
+    return 0;
+}
+
+static int prefetchFile(const char *path, Visited *visited, int depth, int verbose);
+
+/**
+ * The function prefetches an ELF file's interpreter and DT_NEEDED libraries.
+ */
+static void prefetchDependencies(const char *data, size_t size, Visited *visited, int depth, int verbose) {
+    const Elf64_Ehdr *ehdr = (const Elf64_Ehdr *)data;
+    if (size < sizeof(*ehdr) || memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0 || ehdr->e_ident[EI_CLASS] != ELFCLASS64 ||
+        ehdr->e_phentsize != sizeof(Elf64_Phdr) || ehdr->e_phoff + ehdr->e_phnum * sizeof(Elf64_Phdr) > size) {
+        return;
+    }
+    const Elf64_Phdr *phdrs = (const Elf64_Phdr *)(data + ehdr->e_phoff);
+    const Elf64_Dyn *dyn = NULL;
+    size_t dynCount = 0;
+    char lib[PATH_MAX];
+    int i;
+    for (i = 0; i < ehdr->e_phnum; i++) {
+        if (phdrs[i].p_offset + phdrs[i].p_filesz > size) continue;
+        if (phdrs[i].p_type == PT_INTERP && phdrs[i].p_filesz > 1 && phdrs[i].p_filesz < sizeof(lib)) {
+            memcpy(lib, data + phdrs[i].p_offset, phdrs[i].p_filesz);
+            lib[phdrs[i].p_filesz - 1] = 0;
+            prefetchFile(lib, visited, depth + 1, verbose);
+        } else if (phdrs[i].p_type == PT_DYNAMIC) {
+            dyn = (const Elf64_Dyn *)(data + phdrs[i].p_offset);
+            dynCount = phdrs[i].p_filesz / sizeof(Elf64_Dyn);
+        }
+    }
+    uint64_t strtab = 0, strsz = 0;
+    size_t j;
+    for (j = 0; j < dynCount && dyn[j].d_tag != DT_NULL; j++) {
+        if (dyn[j].d_tag == DT_STRTAB) strtab = vaddrOffset(phdrs, ehdr->e_phnum, dyn[j].d_un.d_ptr);
+        else if (dyn[j].d_tag == DT_STRSZ) strsz = dyn[j].d_un.d_val;
+    }
+    if (!strtab || strtab + strsz > size) return;
+    for (j = 0; j < dynCount && dyn[j].d_tag != DT_NULL; j++) {
+        if (dyn[j].d_tag != DT_NEEDED || dyn[j].d_un.d_val >= strsz) continue;
+        const char *name = data + strtab + dyn[j].d_un.d_val;
+        if (memchr(name, 0, strsz - dyn[j].d_un.d_val) && resolveLibrary(name, lib, sizeof(lib)) == 0) {
+            prefetchFile(lib, visited, depth + 1, verbose);
+        }
+    }
+}
+
+/**
+ * The function starts reading a file into the page cache, then follows its
+ * dependencies if it is an ELF file.
+ * @return The number of files prefetched.
+ */
+static int prefetchFile(const char *path, Visited *visited, int depth, int verbose) {
+    int i;
+    for (i = 0; i < visited->size; i++) {
+        if (strcmp(visited->paths[i], path) == 0) return 0;
+    }
+    if (visited->size == MAX_PREFETCHED || !(visited->paths[visited->size] = strdup(path))) return 0;
+    visited->size++;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+        if (fd >= 0) close(fd);
+        return 0;
+    }
+    if (!visited->evict && readahead(fd, 0, st.st_size) < 0) posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    if (verbose) printf("%s\n", path);
+    int files = 1;
+    if (depth < MAX_LIB_DEPTH && st.st_size > 0) {
+        char *data = (char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            int before = visited->size;
+            prefetchDependencies(data, st.st_size, visited, depth, verbose);
+            files += visited->size - before;
+            munmap(data, st.st_size);
+        }
+    }
+    // evicting last, as reading the headers brought their pages back
+    if (visited->evict) posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+    return files;
+}
+
+int prefetchExecutable(const char *path, int verbose) {
+    Visited visited;
+    visited.size = 0;
+    visited.evict = 0;
+    int files = prefetchFile(path, &visited, 0, verbose);
+    while (visited.size) free(visited.paths[--visited.size]);
+    return files;
+}
+
+int evictExecutable(const char *path) {
+    Visited visited;
+    visited.size = 0;
+    visited.evict = 1;
+    int files = prefetchFile(path, &visited, 0, 0);
+    while (visited.size) free(visited.paths[--visited.size]);
+    return files;
+}
+
+static int compareCounts(const void *a, const void *b) {
+    unsigned long x = ((const LaunchCount *)a)->count, y = ((const LaunchCount *)b)->count;
+    return (y > x) - (y < x);
+}
+
+/**
+ * The function prefetches the n most launched executables and their
+ * libraries.
+ * @return The number of files prefetched.
+ */
+static int prefetchTop(int n, int verbose) {
+    qsort(counts, countsSize, sizeof(LaunchCount), compareCounts);
+    Visited visited;
+    visited.size = 0;
+    visited.evict = 0;
+    int files = 0, i;
+    char path[PATH_MAX];
+    for (i = 0; i < countsSize && i < n; i++) {
+        if (resolveCommand(counts[i].name, path, sizeof(path)) == 0) files += prefetchFile(path, &visited, 0, verbose);
+    }
+    while (visited.size) free(visited.paths[--visited.size]);
+    return files;
+}
+
+/**
+ * The function prefetches from a detached grandchild at low priority, so the
+ * prompt never waits for the disk, and reopens the probe.
+ */
+static void prefetchInBackground() {
+    qsort(counts, countsSize, sizeof(LaunchCount), compareCounts);
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (fork() == 0) {
+            setpriority(PRIO_PROCESS, 0, 19);
+            prefetchTop(top, 0);
+        }
+        _exit(0);
+    }
+    if (pid > 0) waitpid(pid, NULL, 0);
+    if (probeFd >= 0) close(probeFd);
+    probeFd = -1;
+    char path[PATH_MAX];
+    if (countsSize && resolveCommand(counts[0].name, path, sizeof(path)) == 0) {
+        probeFd = open(path, O_RDONLY | O_CLOEXEC);
+    }
+    lastCheck = nowNs();
+}
+
+void initPrefetch() {
+    const char *setting = getenv("EX2_PREFETCH");
+    enabled = !setting || strcmp(setting, "0") != 0;
+    const char *topSetting = getenv("EX2_PREFETCH_TOP");
+    if (topSetting && atoi(topSetting) > 0) top = atoi(topSetting);
+    char *path = countsPath();
+    FILE *file = path ? fopen(path, "r") : NULL;
+    free(path);
+    if (!file) return;
+    unsigned long count;
+    char name[PATH_MAX];
+    while (countsSize < MAX_COMMANDS && fscanf(file, "%lu %4095s", &count, name) == 2) {
+        if (!(counts[countsSize].name = strdup(name))) break;
+        counts[countsSize++].count = count;
+    }
+    fclose(file);
+    if (enabled && countsSize) prefetchInBackground();
+}
+
+void noteLaunch(const char *name) {
+    // relative paths mean something else in another directory
+    if (strchr(name, '/') && name[0] != '/') return;
+    int i, least = 0;
+    for (i = 0; i < countsSize; i++) {
+        if (strcmp(counts[i].name, name) == 0) {
+            counts[i].count++;
+            dirty = 1;
+            return;
+        }
+        if (counts[i].count < counts[least].count) least = i;
+    }
+    char *copy = strdup(name);
+    if (!copy) return;
+    if (countsSize == MAX_COMMANDS) free(counts[least].name);
+    else least = countsSize++;
+    counts[least].name = copy;
+    counts[least].count = 1;
+    dirty = 1;
+}
+
+void checkPrefetch() {
+    if (!enabled || probeFd < 0) return;
+    long long now = nowNs();
+    if (now - lastCheck < CHECK_INTERVAL_NS) return;
+    lastCheck = now;
+    char byte;
+    struct iovec iov = {&byte, 1};
+    if (preadv2(probeFd, &iov, 1, 0, RWF_NOWAIT) >= 0) return;
+    if (errno == EAGAIN) prefetchInBackground();
+    else {
+        // the filesystem can't tell, so there is nothing to probe with
+        close(probeFd);
+        probeFd = -1;
+    }
+}
+
+void savePrefetch() {
+    if (!dirty) return;
+    char *path = countsPath();
+    if (!path) return;
+    size_t len = strlen(path) + 8;
+    char tmpPath[len];
+    snprintf(tmpPath, len, "%s.XXXXXX", path);
+    int fd = mkostemp(tmpPath, O_CLOEXEC);
+    FILE *file = fd >= 0 ? fdopen(fd, "w") : NULL;
+    if (!file) {
+        if (fd >= 0) close(fd);
+        free(path);
+        return;
+    }
+    int i;
+    for (i = 0; i < countsSize; i++) fprintf(file, "%lu %s\n", counts[i].count, counts[i].name);
+    if (fclose(file) == 0 && rename(tmpPath, path) == 0) dirty = 0;
+    else unlink(tmpPath);
+    free(path);
+}
+
+int runPrefetch(char **args) {
+    int verbose = 0, n = top, i;
+    if (args[1] && strcmp(args[1], "counts") == 0 && !args[2]) {
+        qsort(counts, countsSize, sizeof(LaunchCount), compareCounts);
+        for (i = 0; i < countsSize; i++) printf("%lu\t%s\n", counts[i].count, counts[i].name);
+        return 0;
+    }
+    for (i = 1; args[i]; i++) {
+        if (strcmp(args[i], "-v") == 0) verbose = 1;
+        else if (strcmp(args[i], "-n") == 0 && args[i + 1] && atoi(args[i + 1]) > 0) n = atoi(args[++i]);
+        else {
+            fprintf(stderr, PREFETCH_USAGE);
+            return 2;
+        }
+    }
+    int files = prefetchTop(n, verbose);
+    printf("prefetched %d files\n", files);
+    return 0;
+}
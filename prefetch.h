@@ -0,0 +1,52 @@
+#ifndef EX2_PREFETCH_H
+#define EX2_PREFETCH_H
+
+#define PREFETCH_USAGE "usage: prefetch [-v] [-n TOP]\n" \
+                       "       prefetch counts\n"
+
+/**
+ * The function loads the launch counts kept in the cache directory and
+ * prefetches the most launched executables in the background. Setting
+ * EX2_PREFETCH=0 turns the prefetcher off and EX2_PREFETCH_TOP sets how many
+ * executables are prefetched (8 by default).
+ */
+void initPrefetch();
+/**
+ * The function counts a launch of a command.
+ * @param name The command's name as it was typed.
+ */
+void noteLaunch(const char *name);
+/**
+ * The function prefetches again, in the background, when the most launched
+ * executable dropped out of the page cache. It checks at most every few
+ * seconds and costs a single non-blocking read.
+ */
+void checkPrefetch();
+/**
+ * The function saves the launch counts.
+ */
+void savePrefetch();
+/**
+ * The function asks the kernel to read an executable, its interpreter and
+ * the shared libraries it needs (recursively) into the page cache.
+ * @param path The executable's path.
+ * @param verbose 1 to print every file.
+ * @return The number of files prefetched.
+ */
+int prefetchExecutable(const char *path, int verbose);
+/**
+ * The function drops an executable and its libraries from the page cache,
+ * as far as no process maps them, to measure cold starts.
+ * @param path The executable's path.
+ * @return The number of files advised.
+ */
+int evictExecutable(const char *path);
+/**
+ * The function runs the prefetch builtin, which prefetches the top
+ * executables now, or prints the launch counts.
+ * @param args The builtin's NULL terminated argv.
+ * @return 0 on success or 2 on a usage error.
+ */
+int runPrefetch(char **args);
+
+#endif
@@ -0,0 +1,424 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <wait.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "reap.h"
+
+#define RING_ENTRIES 4096
+#define EPOLL_BATCH 256
+/* IORING_OP_WAITID is 6.7+, older headers do not have it */
+#define OP_WAITID 50
+
+typedef struct {
+    int kind;
+    int fd;
+    pid_t pid;
+    void *tag;
+    siginfo_t info;
+    char *buffer;
+} Watch;
+
+struct Reaper {
+    int backend;
+    int fd;
+    int active;
+    /* io_uring state */
+    int hasWaitid;
+    unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+    unsigned sqEntries, sqLocalTail, pending;
+    unsigned *cqHead, *cqTail, *cqMask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sqRing, *cqRing;
+    size_t sqRingSize, cqRingSize, sqesSize;
+};
+
+/**
+ * The function converts a waitid result to a waitpid style status.
+ * @param info The waitid result.
+ * @return The status.
+ */
+static int waitStatus(const siginfo_t *info) {
+    if (info->si_code == CLD_EXITED) return (info->si_status & 0xff) << 8;
+    if (info->si_code == CLD_DUMPED) return (info->si_status & 0x7f) | 0x80;
+    return info->si_status & 0x7f;
+}
+
+/**
+ * The function allocates a watch.
+ * @return The watch or NULL on bad alloc.
+ */
+static Watch *newWatch(int kind, int fd, pid_t pid, void *tag) {
+    Watch *watch = (Watch *)calloc(1, sizeof(Watch));
+    if (!watch) return NULL;
+    if (kind == REAP_OUTPUT) {
+        watch->buffer = (char *)malloc(REAP_BUFFER_SIZE);
+        if (!watch->buffer) {
+            free(watch);
+            return NULL;
+        }
+    }
+    watch->kind = kind;
+    watch->fd = fd;
+    watch->pid = pid;
+    watch->tag = tag;
+    return watch;
+}
+
+static void freeWatch(Watch *watch) {
+    free(watch->buffer);
+    free(watch);
+}
+
+/**
+ * The function sets up an io_uring and maps its rings.
+ * @return 0 on success or -1 when io_uring is not available.
+ */
+static int setupRing(Reaper *reaper) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = syscall(SYS_io_uring_setup, RING_ENTRIES, &params);
+    if (fd < 0) return -1;
+    reaper->fd = fd;
+    reaper->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    reaper->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (reaper->cqRingSize > reaper->sqRingSize) reaper->sqRingSize = reaper->cqRingSize;
+        reaper->cqRingSize = reaper->sqRingSize;
+    }
+    reaper->sqRing = mmap(NULL, reaper->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                          IORING_OFF_SQ_RING);
+    if (reaper->sqRing == MAP_FAILED) goto fail;
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        reaper->cqRing = reaper->sqRing;
+    } else {
+        reaper->cqRing = mmap(NULL, reaper->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                              IORING_OFF_CQ_RING);
+        if (reaper->cqRing == MAP_FAILED) goto fail;
+    }
+    reaper->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    reaper->sqes = (struct io_uring_sqe *)mmap(NULL, reaper->sqesSize, PROT_READ | PROT_WRITE,
+                                               MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (reaper->sqes == MAP_FAILED) goto fail;
+    char *sq = (char *)reaper->sqRing, *cq = (char *)reaper->cqRing;
+    reaper->sqHead = (unsigned *)(sq + params.sq_off.head);
+    reaper->sqTail = (unsigned *)(sq + params.sq_off.tail);
+    reaper->sqMask = (unsigned *)(sq + params.sq_off.ring_mask);
+    reaper->sqArray = (unsigned *)(sq + params.sq_off.array);
+    reaper->sqEntries = params.sq_entries;
+    reaper->sqLocalTail = *reaper->sqTail;
+    reaper->cqHead = (unsigned *)(cq + params.cq_off.head);
+    reaper->cqTail = (unsigned *)(cq + params.cq_off.tail);
+    reaper->cqMask = (unsigned *)(cq + params.cq_off.ring_mask);
+    reaper->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    size_t probeSize = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = (struct io_uring_probe *)calloc(1, probeSize);
+    if (probe && syscall(SYS_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) == 0) {
+        reaper->hasWaitid = probe->last_op >= OP_WAITID && (probe->ops[OP_WAITID].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    return 0;
+fail:
+    if (reaper->sqRing && reaper->sqRing != MAP_FAILED) munmap(reaper->sqRing, reaper->sqRingSize);
+    if (reaper->cqRing && reaper->cqRing != MAP_FAILED && reaper->cqRing != reaper->sqRing) {
+        munmap(reaper->cqRing, reaper->cqRingSize);
+    }
+    close(fd);
+    return -1;
+}
+
+Reaper *createReaper(int backend) {
+    const char *forced = getenv("EX2_REAPER");
+    if (backend == REAP_AUTO && forced) {
+        if (strcmp(forced, "epoll") == 0) backend = REAP_EPOLL;
+        else if (strcmp(forced, "uring") == 0) backend = REAP_URING;
+    }
+    Reaper *reaper = (Reaper *)calloc(1, sizeof(Reaper));
+    if (!reaper) return NULL;
+    if (backend != REAP_EPOLL && setupRing(reaper) == 0) {
+        reaper->backend = REAP_URING;
+        return reaper;
+    }
+    reaper->backend = REAP_EPOLL;
+    reaper->fd = epoll_create1(EPOLL_CLOEXEC);
+    if (reaper->fd < 0) {
+        free(reaper);
+        return NULL;
+    }
+    return reaper;
+}
+
+const char *reaperBackend(Reaper *reaper) {
+    if (reaper->backend == REAP_EPOLL) return "epoll";
+    return reaper->hasWaitid ? "io_uring" : "io_uring+poll";
+}
+
+int reaperFd(Reaper *reaper) { return reaper->fd; }
+
+int activeWatches(Reaper *reaper) { return reaper->active; }
+
+/**
+ * The function hands the queued sqes to the kernel, optionally waiting for
+ * completions in the same call.
+ * @return 0 on success or -1 on failure.
+ */
+static int enterRing(Reaper *reaper, unsigned minComplete) {
+    __atomic_store_n(reaper->sqTail, reaper->sqLocalTail, __ATOMIC_RELEASE);
+    unsigned flags = minComplete ? IORING_ENTER_GETEVENTS : 0;
+    for (;;) {
+        long n = syscall(SYS_io_uring_enter, reaper->fd, reaper->pending, minComplete, flags, NULL, 0);
+        if (n >= 0) {
+            reaper->pending -= (n < (long)reaper->pending) ? n : reaper->pending;
+            return 0;
+        }
+        if (errno != EINTR) return -1;
+        if (minComplete) return 0;
+    }
+}
+
+/**
+ * The function returns a free sqe, submitting the queued ones if the
+ * submission ring is full.
+ * @return The sqe or NULL on failure.
+ */
+static struct io_uring_sqe *getSqe(Reaper *reaper) {
+    unsigned head = __atomic_load_n(reaper->sqHead, __ATOMIC_ACQUIRE);
+    if (reaper->sqLocalTail - head >= reaper->sqEntries) {
+        if (enterRing(reaper, 0) < 0) return NULL;
+        head = __atomic_load_n(reaper->sqHead, __ATOMIC_ACQUIRE);
+        if (reaper->sqLocalTail - head >= reaper->sqEntries) return NULL;
+    }
+    unsigned index = reaper->sqLocalTail & *reaper->sqMask;
+    struct io_uring_sqe *sqe = &reaper->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    reaper->sqArray[index] = index;
+    reaper->sqLocalTail++;
+    reaper->pending++;
+    return sqe;
+}
+
+/**
+ * The function queues the sqe that waits for a watched child.
+ * @return 0 on success or -1 on failure.
+ */
+static int queueChild(Reaper *reaper, Watch *watch) {
+    struct io_uring_sqe *sqe = getSqe(reaper);
+    if (!sqe) return -1;
+    if (reaper->hasWaitid) {
+        sqe->opcode = OP_WAITID;
+        sqe->fd = watch->pid;
+        sqe->len = P_PID;
+        sqe->file_index = WEXITED;
+        sqe->addr2 = (unsigned long)&watch->info;
+    } else {
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = watch->fd;
+        sqe->poll32_events = POLLIN;
+    }
+    sqe->user_data = (unsigned long)watch;
+    return 0;
+}
+
+/**
+ * The function queues the next read of a watched fd.
+ * @return 0 on success or -1 on failure.
+ */
+static int queueRead(Reaper *reaper, Watch *watch) {
+    struct io_uring_sqe *sqe = getSqe(reaper);
+    if (!sqe) return -1;
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = watch->fd;
+    sqe->addr = (unsigned long)watch->buffer;
+    sqe->len = REAP_BUFFER_SIZE;
+    sqe->off = (__u64)-1;
+    sqe->user_data = (unsigned long)watch;
+    return 0;
+}
+
+int watchChild(Reaper *reaper, pid_t pid, void *tag) {
+    int fd = -1;
+    if (reaper->backend == REAP_EPOLL || !reaper->hasWaitid) {
+        fd = syscall(SYS_pidfd_open, pid, 0);
+        if (fd < 0) return -1;
+    }
+    Watch *watch = newWatch(REAP_EXITED, fd, pid, tag);
+    if (!watch) {
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    int err;
+    if (reaper->backend == REAP_URING) {
+        err = queueChild(reaper, watch);
+    } else {
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = watch;
+        err = epoll_ctl(reaper->fd, EPOLL_CTL_ADD, fd, &event);
+    }
+    if (err < 0) {
+        if (fd >= 0) close(fd);
+        freeWatch(watch);
+        return -1;
+    }
+    reaper->active++;
+    return 0;
+}
+
+int watchOutput(Reaper *reaper, int fd, void *tag) {
+    Watch *watch = newWatch(REAP_OUTPUT, fd, 0, tag);
+    if (!watch) return -1;
+    int err;
+    if (reaper->backend == REAP_URING) {
+        err = queueRead(reaper, watch);
+    } else {
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = watch;
+        err = epoll_ctl(reaper->fd, EPOLL_CTL_ADD, fd, &event);
+    }
+    if (err < 0) {
+        freeWatch(watch);
+        return -1;
+    }
+    reaper->active++;
+    return 0;
+}
+
+void flushReaper(Reaper *reaper) {
+    if (reaper->backend == REAP_URING && reaper->pending) enterRing(reaper, 0);
+}
+
+/**
+ * The function fills an event for a child that exited and drops its watch.
+ * @param status The child's status, or -1 if it could not be waited for.
+ */
+static void childExited(Reaper *reaper, Watch *watch, int status, ReapEvent *event) {
+    event->kind = REAP_EXITED;
+    event->tag = watch->tag;
+    event->pid = watch->pid;
+    event->status = status;
+    event->data = NULL;
+    event->size = 0;
+    event->fd = -1;
+    if (watch->fd >= 0) close(watch->fd);
+    freeWatch(watch);
+    reaper->active--;
+}
+
+/**
+ * The function fills an event for data read from a watched fd, dropping the
+ * watch at EOF.
+ */
+static void outputRead(Reaper *reaper, Watch *watch, ssize_t size, ReapEvent *event) {
+    event->kind = REAP_OUTPUT;
+    event->tag = watch->tag;
+    event->pid = 0;
+    event->status = 0;
+    event->data = size > 0 ? watch->buffer : NULL;
+    event->size = size > 0 ? size : 0;
+    event->fd = watch->fd;
+    if (size <= 0) {
+        freeWatch(watch);
+        reaper->active--;
+    }
+}
+
+/**
+ * The function waits for a child whose pidfd polled readable.
+ * @return The child's status or -1.
+ */
+static int waitPidfd(Watch *watch) {
+    siginfo_t info;
+    memset(&info, 0, sizeof(info));
+    while (waitid(P_PIDFD, watch->fd, &info, WEXITED) < 0) {
+        if (errno != EINTR) return -1;
+    }
+    return waitStatus(&info);
+}
+
+static int reapEpoll(Reaper *reaper, ReapEvent *events, int max, int timeoutMs) {
+    struct epoll_event ready[EPOLL_BATCH];
+    if (max > EPOLL_BATCH) max = EPOLL_BATCH;
+    int n = epoll_wait(reaper->fd, ready, max, timeoutMs);
+    if (n < 0) return errno == EINTR ? 0 : -1;
+    int i, count = 0;
+    for (i = 0; i < n; i++) {
+        Watch *watch = (Watch *)ready[i].data.ptr;
+        if (watch->kind == REAP_EXITED) {
+            epoll_ctl(reaper->fd, EPOLL_CTL_DEL, watch->fd, NULL);
+            childExited(reaper, watch, waitPidfd(watch), &events[count++]);
+            continue;
+        }
+        ssize_t size;
+        do {
+            size = read(watch->fd, watch->buffer, REAP_BUFFER_SIZE);
+        } while (size < 0 && errno == EINTR);
+        if (size < 0 && errno == EAGAIN) continue;
+        if (size <= 0) epoll_ctl(reaper->fd, EPOLL_CTL_DEL, watch->fd, NULL);
+        outputRead(reaper, watch, size, &events[count++]);
+    }
+    return count;
+}
+
+static int reapUring(Reaper *reaper, ReapEvent *events, int max, int timeoutMs) {
+    unsigned head = *reaper->cqHead;
+    unsigned tail = __atomic_load_n(reaper->cqTail, __ATOMIC_ACQUIRE);
+    if (head == tail || reaper->pending) {
+        // one syscall submits everything queued and, if need be, waits
+        if (enterRing(reaper, (head == tail && timeoutMs < 0) ? 1 : 0) < 0) return -1;
+        tail = __atomic_load_n(reaper->cqTail, __ATOMIC_ACQUIRE);
+    }
+    if (head == tail && timeoutMs > 0) {
+        struct pollfd pollFd = {reaper->fd, POLLIN, 0};
+        poll(&pollFd, 1, timeoutMs);
+        tail = __atomic_load_n(reaper->cqTail, __ATOMIC_ACQUIRE);
+    }
+    int n = 0;
+    while (head != tail && n < max) {
+        struct io_uring_cqe *cqe = &reaper->cqes[head & *reaper->cqMask];
+        Watch *watch = (Watch *)(unsigned long)cqe->user_data;
+        int res = cqe->res;
+        head++;
+        if (watch->kind == REAP_EXITED) {
+            int status;
+            if (reaper->hasWaitid) status = res < 0 ? -1 : waitStatus(&watch->info);
+            else status = res < 0 ? -1 : waitPidfd(watch);
+            childExited(reaper, watch, status, &events[n++]);
+            continue;
+        }
+        if (res == -EINTR || res == -EAGAIN) {
+            queueRead(reaper, watch);
+            continue;
+        }
+        // the next read is only submitted by the next call, so data stays put
+        if (res > 0) queueRead(reaper, watch);
+        outputRead(reaper, watch, res, &events[n++]);
+    }
+    __atomic_store_n(reaper->cqHead, head, __ATOMIC_RELEASE);
+    return n;
+}
+
+int reapEvents(Reaper *reaper, ReapEvent *events, int max, int timeoutMs) {
+    if (reaper->active == 0) return 0;
+    if (reaper->backend == REAP_URING) return reapUring(reaper, events, max, timeoutMs);
+    return reapEpoll(reaper, events, max, timeoutMs);
+}
+
+void freeReaper(Reaper *reaper) {
+    if (!reaper) return;
+    if (reaper->backend == REAP_URING) {
+        munmap(reaper->sqes, reaper->sqesSize);
+        if (reaper->cqRing != reaper->sqRing) munmap(reaper->cqRing, reaper->cqRingSize);
+        munmap(reaper->sqRing, reaper->sqRingSize);
+    }
+    close(reaper->fd);
+    free(reaper);
+}
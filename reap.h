@@ -0,0 +1,101 @@
+#ifndef EX2_REAP_H
+#define EX2_REAP_H
+
+#include <sys/types.h>
+
+/* backends a reaper can be created with */
+#define REAP_AUTO 0
+#define REAP_EPOLL 1
+#define REAP_URING 2
+
+/* kinds of events */
+#define REAP_EXITED 1
+#define REAP_OUTPUT 2
+
+#define REAP_BUFFER_SIZE 65536
+
+typedef struct Reaper Reaper;
+
+typedef struct {
+    int kind;
+    void *tag;
+    /* REAP_EXITED: the reaped child and its wait status */
+    pid_t pid;
+    int status;
+    /* REAP_OUTPUT: bytes read, valid until the next reapEvents. A size of 0
+     * means EOF (or a read error), the watch is dropped and the caller may
+     * close the fd. */
+    const char *data;
+    ssize_t size;
+    int fd;
+} ReapEvent;
+
+/**
+ * The function creates a reaper, which waits for children to exit and reads
+ * their captured output. REAP_AUTO and REAP_URING use io_uring when the
+ * kernel allows it and fall back to epoll and pidfds else. The EX2_REAPER
+ * environment variable (epoll or uring) overrides REAP_AUTO.
+ * @param backend The backend to prefer.
+ * @return The reaper or NULL on failure.
+ */
+Reaper *createReaper(int backend);
+/**
+ * The function returns the name of the reaper's backend.
+ * @param reaper The reaper.
+ * @return "io_uring", "io_uring+poll" when the kernel lacks IORING_OP_WAITID,
+ * or "epoll".
+ */
+const char *reaperBackend(Reaper *reaper);
+/**
+ * The function returns an fd that polls readable while the reaper has
+ * events, so the reaper can be driven from another event loop.
+ * @param reaper The reaper.
+ * @return The fd.
+ */
+int reaperFd(Reaper *reaper);
+/**
+ * The function watches a child of this process, which the reaper will reap.
+ * Nothing else may wait for the child.
+ * @param reaper The reaper.
+ * @param pid The child.
+ * @param tag Returned with the child's event.
+ * @return 0 on success or -1 on failure.
+ */
+int watchChild(Reaper *reaper, pid_t pid, void *tag);
+/**
+ * The function reads an fd until EOF, returning the data as events.
+ * @param reaper The reaper.
+ * @param fd The fd, it stays owned by the caller.
+ * @param tag Returned with the fd's events.
+ * @return 0 on success or -1 on failure.
+ */
+int watchOutput(Reaper *reaper, int fd, void *tag);
+/**
+ * The function submits watches queued since the last call, so they are in
+ * flight before the caller blocks elsewhere.
+ * @param reaper The reaper.
+ */
+void flushReaper(Reaper *reaper);
+/**
+ * The function waits for events. With io_uring all the queued work is
+ * submitted and the completions are harvested with a single io_uring_enter.
+ * @param reaper The reaper.
+ * @param events The array to fill.
+ * @param max The array's size.
+ * @param timeoutMs How long to wait, -1 for ever and 0 not at all.
+ * @return The number of events or -1 on failure.
+ */
+int reapEvents(Reaper *reaper, ReapEvent *events, int max, int timeoutMs);
+/**
+ * The function returns the number of watches that have not ended.
+ * @param reaper The reaper.
+ * @return The number of watches.
+ */
+int activeWatches(Reaper *reaper);
+/**
+ * The function frees the reaper, children still watched are not reaped.
+ * @param reaper The reaper.
+ */
+void freeReaper(Reaper *reaper);
+
+#endif
@@ -0,0 +1,57 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "metrics.h"
+#include "record.h"
+
+extern char **environ;
+
+static FILE *recordFile = NULL;
+static long long startedAt = 0;
+
+/**
+ * The function writes a field with its backslashes and newlines escaped.
+ */
+static void writeEscaped(const char *text, size_t len) {
+    size_t i;
+    for (i = 0; i < len; i++) {
+        if (text[i] == '\\') fputs("\\\\", recordFile);
+        else if (text[i] == '\n') fputs("\\n", recordFile);
+        else putc(text[i], recordFile);
+    }
+}
+
+void initRecord() {
+    const char *path = getenv("EX2_RECORD_FILE");
+    if (!path || !*path) return;
+    startedAt = nowNs();
+    recordFile = fopen(path, "we");
+    if (!recordFile) {
+        perror(path);
+        return;
+    }
+    fprintf(recordFile, "%s\nC\t", RECORD_MAGIC);
+    char *dir = getcwd(NULL, 0);
+    if (dir) writeEscaped(dir, strlen(dir));
+    free(dir);
+    putc('\n', recordFile);
+    char **variable;
+    for (variable = environ; *variable; variable++) {
+        fputs("E\t", recordFile);
+        writeEscaped(*variable, strlen(*variable));
+        putc('\n', recordFile);
+    }
+    fflush(recordFile);
+}
+
+void recordLine(int heredoc, const char *line) {
+    if (!recordFile) return;
+    fprintf(recordFile, "%c\t%lld\t", heredoc ? 'H' : 'L', nowNs() - startedAt);
+    size_t len = strlen(line);
+    if (len && line[len - 1] == '\n') len--;
+    writeEscaped(line, len);
+    putc('\n', recordFile);
+    // flushed with each line, so a shell that is killed leaves its session
+    fflush(recordFile);
+}
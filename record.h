@@ -0,0 +1,31 @@
+#ifndef EX2_RECORD_H
+#define EX2_RECORD_H
+
+/*
+ * A recording is a text file of one entry per line, a kind and its fields
+ * separated by tabs:
+ *   RECORD_MAGIC                  the first line
+ *   C <tab> DIR                   the directory the shell started in
+ *   E <tab> NAME=VALUE            an environment variable, one per line
+ *   L <tab> NS <tab> LINE         a line read at the prompt
+ *   H <tab> NS <tab> LINE         a line of a heredoc
+ * NS is the time the line was read in nanoseconds since the shell started.
+ * Backslashes and newlines in DIR, NAME=VALUE and LINE are written as \\ and
+ * \n. tools/replay.c feeds a recording back to a shell.
+ */
+#define RECORD_MAGIC "# ex2 recording 1"
+
+/**
+ * The function starts recording the session if EX2_RECORD_FILE names a
+ * file, which is truncated: it writes the shell's directory and
+ * environment, and every line read from stdin from then on.
+ */
+void initRecord();
+/**
+ * The function records a line read from stdin, if the session is recorded.
+ * @param heredoc 1 for a line of a heredoc and 0 for a line at the prompt.
+ * @param line The line, its newline isn't recorded.
+ */
+void recordLine(int heredoc, const char *line);
+
+#endif
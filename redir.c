@@ -0,0 +1,299 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <wait.h>
+#include <sys/mman.h>
+#include "metrics.h"
+#include "redir.h"
+
+#define SEALS (F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL)
+
+typedef struct {
+    char *name;
+    /* a sealed memfd, every reader opens its own read-only description */
+    int fd;
+    size_t size;
+} NamedBuffer;
+
+static NamedBuffer *buffers = NULL;
+static int bufferCount = 0, bufferCapacity = 0;
+
+/**
+ * The function opens a new read-only description of a memfd, with its own
+ * offset, so readers never disturb each other.
+ * @return The fd or -1 on failure.
+ */
+static int reopenReadOnly(int fd) {
+    char path[32];
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+    return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+int sealedMemfd(const char *name, const char *data, size_t size) {
+    int fd = memfd_create(name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) return -1;
+    while (size > 0) {
+        ssize_t n = write(fd, data, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            close(fd);
+            return -1;
+        }
+        data += n;
+        size -= n;
+    }
+    if (fcntl(fd, F_ADD_SEALS, SEALS) < 0) {
+        close(fd);
+        return -1;
+    }
+    int readOnly = reopenReadOnly(fd);
+    // without /proc the sealed fd itself is handed out, rewound
+    if (readOnly < 0 && lseek(fd, 0, SEEK_SET) == 0) return fd;
+    close(fd);
+    return readOnly;
+}
+
+/**
+ * The function finds a saved buffer.
+ * @return Its index or -1.
+ */
+static int findBuffer(const char *name) {
+    int i;
+    for (i = 0; i < bufferCount; i++) {
+        if (strcmp(buffers[i].name, name) == 0) return i;
+    }
+    return -1;
+}
+
+const char *heredocDelimiter(const ArgList *list) {
+    int i;
+    for (i = 0; i + 1 < list->size; i++) {
+        if (list->args[i] && strcmp(list->args[i], "<<") == 0) return list->args[i + 1];
+    }
+    return NULL;
+}
+
+/**
+ * The function opens the target of <, a file or @NAME.
+ * @return The fd or -1 on failure, which was reported.
+ */
+static int openInput(const char *target) {
+    if (target[0] != '@') {
+        int fd = open(target, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) perror(target);
+        return fd;
+    }
+    int i = findBuffer(target + 1);
+    if (i < 0) {
+        fprintf(stderr, "%s: no such buffer\n", target + 1);
+        return -1;
+    }
+    int fd = reopenReadOnly(buffers[i].fd);
+    if (fd < 0) perror(target);
+    return fd;
+}
+
+/**
+ * The function joins words with spaces into a here-string's line.
+ * @return The memfd or -1 on failure.
+ */
+static int hereString(char **words, int count) {
+    size_t len = 1;
+    int i;
+    for (i = 0; i < count; i++) len += strlen(words[i]) + 1;
+    char *line = (char *)malloc(len), *out = line;
+    if (!line) return -1;
+    for (i = 0; i < count; i++) {
+        size_t wordLen = strlen(words[i]);
+        memcpy(out, words[i], wordLen);
+        out += wordLen;
+        *out++ = i + 1 < count ? ' ' : '\n';
+    }
+    if (count == 0) *out++ = '\n';
+    int fd = sealedMemfd("here-string", line, out - line);
+    free(line);
+    return fd;
+}
+
+void closeRedirections(int fd, int *stageFds, int stageCount) {
+    int i;
+    if (fd >= 0) close(fd);
+    for (i = 0; stageFds && i < stageCount; i++) {
+        if (stageFds[i] >= 0) close(stageFds[i]);
+    }
+    free(stageFds);
+}
+
+int takeRedirections(ArgList *list, const char *heredoc, int *fd, int **stageFds, int *stageCount) {
+    *fd = -1;
+    *stageFds = NULL;
+    *stageCount = 0;
+    if (list->size == 0) return 0;
+    int i = 0, kept = 0, pipes = 0, stage = 0;
+    for (i = 0; i < list->size; i++) pipes += strcmp(list->args[i], "|") == 0;
+    i = 0;
+    // buf save NAME < CMD keeps its <, which introduces the command, and
+    // the redirections after it are the command's
+    if (strcmp(list->args[0], "buf") == 0 && list->size > 3 && strcmp(list->args[3], "<") == 0) i = kept = 4;
+    while (i < list->size) {
+        char *word = list->args[i];
+        int taken = 0, next = -1, j;
+        // every command of a pipeline has its own redirections
+        if (strcmp(word, "|") == 0) {
+            stage++;
+            list->args[kept++] = list->args[i++];
+            continue;
+        }
+        int hasTarget = i + 1 < list->size && strcmp(list->args[i + 1], "|") != 0;
+        if (strcmp(word, "<<<") == 0) {
+            for (j = i + 1; j < list->size && strcmp(list->args[j], "|") != 0; j++);
+            next = hereString(list->args + i + 1, j - i - 1);
+            if (next < 0) perror("here-string");
+            taken = j - i;
+        } else if (strcmp(word, "<<") == 0 && hasTarget) {
+            next = sealedMemfd("here-doc", heredoc ? heredoc : "", heredoc ? strlen(heredoc) : 0);
+            if (next < 0) perror("here-doc");
+            taken = 2;
+        } else if (strcmp(word, "<") == 0 && hasTarget) {
+            next = openInput(list->args[i + 1]);
+            taken = 2;
+        }
+        if (!taken) {
+            list->args[kept++] = list->args[i++];
+            continue;
+        }
+        if (next >= 0 && stage > 0 && !*stageFds) {
+            *stageFds = (int *)malloc(pipes * sizeof(int));
+            if (!*stageFds) {
+                perror("pipeline");
+                close(next);
+                next = -1;
+            }
+            for (j = 0; *stageFds && j < pipes; j++) (*stageFds)[j] = -1;
+        }
+        if (next < 0) {
+            closeRedirections(*fd, *stageFds, pipes);
+            *fd = -1;
+            *stageFds = NULL;
+            while (i < list->size) list->args[kept++] = list->args[i++];
+            list->size = kept;
+            return -1;
+        }
+        // like sh, the last redirection wins
+        int *target = stage ? &(*stageFds)[stage - 1] : fd;
+        if (*target >= 0) close(*target);
+        *target = next;
+        for (j = 0; j < taken; j++) free(list->args[i + j]);
+        i += taken;
+    }
+    list->size = kept;
+    if (*stageFds) *stageCount = pipes;
+    return 0;
+}
+
+/**
+ * The function runs a command with its stdout in a new memfd.
+ * @return The unsealed memfd or -1 on failure, which was reported.
+ */
+static int captureCommand(char **cmd, int in) {
+    int fd = memfd_create("buf", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) {
+        perror("buf");
+        return -1;
+    }
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (in >= 0) dup2(in, 0);
+        dup2(fd, 1);
+        execvp(cmd[0], cmd);
+        perror(cmd[0]);
+        _exit(127);
+    }
+    if (pid < 0) {
+        metrics.forkFailures++;
+        perror("buf");
+        close(fd);
+        return -1;
+    }
+    metrics.commandsLaunched++;
+    int status;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR);
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 127) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * The function saves a command's output as a named buffer, replacing the
+ * buffer of that name.
+ * @return 0 on success or -1 on failure.
+ */
+static int saveBuffer(const char *name, char **cmd, int in) {
+    int fd = captureCommand(cmd, in);
+    if (fd < 0) return -1;
+    off_t size = lseek(fd, 0, SEEK_END);
+    if (fcntl(fd, F_ADD_SEALS, SEALS) < 0) {
+        perror("buf");
+        close(fd);
+        return -1;
+    }
+    int i = findBuffer(name);
+    if (i >= 0) {
+        close(buffers[i].fd);
+        buffers[i].fd = fd;
+        buffers[i].size = size;
+        return 0;
+    }
+    if (bufferCount == bufferCapacity) {
+        int capacity = bufferCapacity ? bufferCapacity * 2 : 8;
+        NamedBuffer *grown = (NamedBuffer *)realloc(buffers, capacity * sizeof(NamedBuffer));
+        if (!grown) {
+            close(fd);
+            return -1;
+        }
+        buffers = grown;
+        bufferCapacity = capacity;
+    }
+    buffers[bufferCount].name = strdup(name);
+    if (!buffers[bufferCount].name) {
+        close(fd);
+        return -1;
+    }
+    buffers[bufferCount].fd = fd;
+    buffers[bufferCount++].size = size;
+    return 0;
+}
+
+int runBuf(char **args, int in) {
+    if (args[1] && strcmp(args[1], "save") == 0 && args[2] && args[3] && strcmp(args[3], "<") == 0 && args[4]) {
+        return saveBuffer(args[2], args + 4, in);
+    }
+    if (in >= 0) {
+        fprintf(stderr, "buf: only the command of buf save reads stdin\n");
+        return -1;
+    }
+    if (args[1] && strcmp(args[1], "drop") == 0 && args[2]) {
+        int i = findBuffer(args[2]);
+        if (i < 0) {
+            fprintf(stderr, "%s: no such buffer\n", args[2]);
+            return -1;
+        }
+        close(buffers[i].fd);
+        free(buffers[i].name);
+        buffers[i] = buffers[--bufferCount];
+        return 0;
+    }
+    if (args[1] && strcmp(args[1], "list") == 0) {
+        int i;
+        for (i = 0; i < bufferCount; i++) printf("%s\t%zu\n", buffers[i].name, buffers[i].size);
+        return 0;
+    }
+    fprintf(stderr, BUF_USAGE);
+    return -1;
+}
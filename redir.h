@@ -0,0 +1,60 @@
+#ifndef EX2_REDIR_H
+#define EX2_REDIR_H
+
+#include <stddef.h>
+#include "expand.h"
+
+#define BUF_USAGE "usage: buf save NAME < CMD [ARGS...]\n" \
+                  "       buf drop NAME\n" \
+                  "       buf list\n"
+
+/**
+ * The function returns the delimiter of a command's here-doc, so the caller
+ * can read the body before the command is parsed.
+ * @param list The command's words.
+ * @return The word after <<, or NULL if there is no here-doc.
+ */
+const char *heredocDelimiter(const ArgList *list);
+/**
+ * The function takes a command's stdin redirection out of its words:
+ * < FILE, < @NAME for a saved buffer, << DELIM for a here-doc, and <<< for a
+ * here-string made of the words up to the next |. Here-strings and
+ * here-docs are sealed memfds, so no file is written and no process feeds a
+ * pipe. In a pipeline every command, the words between | words, has its own
+ * redirections. The < of buf save NAME < CMD is left alone, it introduces
+ * the command to save, and the redirections after it are the command's.
+ * @param list The command's words, without the NULL terminator.
+ * @param heredoc The here-doc's body, or NULL.
+ * @param fd Set to a close-on-exec fd for the first command's stdin, or -1.
+ * @param stageFds Set to an array of close-on-exec fds, one for each
+ * command after the first, -1 for the ones without a redirection, or to
+ * NULL if none of them has one.
+ * @param stageCount Set to the size of stageFds.
+ * @return 0 on success or -1 on failure, which was reported.
+ */
+int takeRedirections(ArgList *list, const char *heredoc, int *fd, int **stageFds, int *stageCount);
+/**
+ * The function closes the fds takeRedirections returned.
+ * @param fd The first command's fd, or -1.
+ * @param stageFds The later commands' fds, or NULL.
+ * @param stageCount The size of stageFds.
+ */
+void closeRedirections(int fd, int *stageFds, int stageCount);
+/**
+ * The function creates a sealed, read-only memfd holding the data.
+ * @param name The memfd's name, for /proc.
+ * @param data The data.
+ * @param size The data's size.
+ * @return A close-on-exec fd at offset 0 or -1 on failure.
+ */
+int sealedMemfd(const char *name, const char *data, size_t size);
+/**
+ * The function runs the buf builtin, which keeps commands' output in named
+ * in-memory buffers that later commands read with < @NAME.
+ * @param args The builtin's NULL terminated argv, starting with "buf".
+ * @param in The stdin of the command buf save runs, or -1. It stays open.
+ * @return 0 on success or -1 on failure.
+ */
+int runBuf(char **args, int in);
+
+#endif
@@ -0,0 +1,332 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "expand.h"
+#include "script.h"
+#include "sha256.h"
+
+#define SCRIPT_MAGIC 0x53325845u
+#define SCRIPT_VERSION 4
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+/*
+ * A parsed script is a header followed by one record per command. Every
+ * record is three uint32s (argc, flags, size of the words) and the words,
+ * padded to 4 bytes, so the mapped file is walked without any copying. A
+ * here-doc's body follows the words as one more NUL terminated string.
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    /* the source's SHA-256 digest, the entry's name is its first 8 bytes */
+    unsigned char digest[SHA256_SIZE];
+    uint64_t sourceSize;
+    uint32_t count;
+    uint32_t reserved;
+} ScriptHeader;
+
+typedef struct {
+    char *data;
+    size_t size;
+    size_t capacity;
+} Buffer;
+
+/**
+ * The function appends bytes to a buffer.
+ * @return 0 on success or -1 on bad alloc.
+ */
+static int appendBytes(Buffer *buffer, const void *bytes, size_t size) {
+    if (buffer->size + size > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity : 4096;
+        while (buffer->size + size > capacity) capacity *= 2;
+        char *data = (char *)realloc(buffer->data, capacity);
+        if (!data) return -1;
+        buffer->data = data;
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->data + buffer->size, bytes, size);
+    buffer->size += size;
+    return 0;
+}
+
+/**
+ * The function parses a script's source the same way the prompt splits a
+ * line: words are separated by spaces, a last word of & runs the command in
+ * the background. Empty lines and lines whose first word starts with # are
+ * skipped. The lines after a command with << DELIM, up to a line of DELIM,
+ * are its here-doc.
+ * @param source The source.
+ * @param size The source's size.
+ * @param digest The source's digest.
+ * @param buffer The buffer to write the parsed script to.
+ * @return 0 on success or -1 on bad alloc.
+ */
+static int parseScript(const char *source, size_t size, const unsigned char *digest, Buffer *buffer) {
+    ScriptHeader header = {SCRIPT_MAGIC, SCRIPT_VERSION, {0}, size, 0, 0};
+    memcpy(header.digest, digest, SHA256_SIZE);
+    if (appendBytes(buffer, &header, sizeof(header)) < 0) return -1;
+    const char *line = source, *end = source + size;
+    static const char padding[4] = {0};
+    while (line < end) {
+        const char *lineEnd = memchr(line, '\n', end - line);
+        if (!lineEnd) lineEnd = end;
+        // the record is patched once the line's words are known
+        size_t recordOffset = buffer->size, lastWord = 0, delim = 0;
+        uint32_t record[3] = {0, 0, 0};
+        if (appendBytes(buffer, record, sizeof(record)) < 0) return -1;
+        const char *curr = line;
+        while (curr < lineEnd) {
+            while (curr < lineEnd && *curr == ' ') curr++;
+            // an indented comment is a comment too
+            if (curr == lineEnd || (record[0] == 0 && *curr == '#')) break;
+            const char *wordEnd = curr;
+            while (wordEnd < lineEnd && *wordEnd != ' ') wordEnd++;
+            if (lastWord && strcmp(buffer->data + lastWord, "<<") == 0) delim = buffer->size;
+            lastWord = buffer->size;
+            if (appendBytes(buffer, curr, wordEnd - curr) < 0 || appendBytes(buffer, "", 1) < 0) return -1;
+            if (hasGlob(buffer->data + lastWord)) record[1] |= CMD_HAS_GLOB;
+            record[0]++;
+            curr = wordEnd;
+        }
+        line = lineEnd + 1;
+        if (record[0] > 0 && strcmp(buffer->data + lastWord, "&") == 0) {
+            record[1] |= CMD_BACKGROUND;
+            record[0]--;
+            buffer->size = lastWord;
+        }
+        if (record[0] == 0) {
+            buffer->size = recordOffset;
+            continue;
+        }
+        if (delim && delim < buffer->size) {
+            size_t delimLen = strlen(buffer->data + delim);
+            while (line < end) {
+                const char *bodyEnd = memchr(line, '\n', end - line);
+                if (!bodyEnd) bodyEnd = end;
+                const char *next = bodyEnd + 1;
+                if ((size_t)(bodyEnd - line) == delimLen && memcmp(line, buffer->data + delim, delimLen) == 0) {
+                    line = next;
+                    break;
+                }
+                if (appendBytes(buffer, line, bodyEnd - line) < 0 || appendBytes(buffer, "\n", 1) < 0) return -1;
+                line = next;
+            }
+            if (appendBytes(buffer, "", 1) < 0) return -1;
+            record[1] |= CMD_HEREDOC;
+        }
+        record[2] = buffer->size - recordOffset - sizeof(record);
+        memcpy(buffer->data + recordOffset, record, sizeof(record));
+        if (appendBytes(buffer, padding, (4 - record[2] % 4) % 4) < 0) return -1;
+        ((ScriptHeader *)buffer->data)->count++;
+    }
+    return 0;
+}
+
+uint64_t hashBytes(const void *data, size_t size) {
+    return hashMore(FNV_OFFSET, data, size);
+}
+
+uint64_t hashMore(uint64_t hash, const void *data, size_t size) {
+    const unsigned char *bytes = (const unsigned char *)data;
+    size_t i;
+    for (i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+/**
+ * The function creates every missing directory on a path.
+ * @param path The path, it is modified and restored.
+ * @return 0 on success or -1 on failure.
+ */
+static int makeDirs(char *path) {
+    char *slash;
+    for (slash = strchr(path + 1, '/'); slash; slash = strchr(slash + 1, '/')) {
+        *slash = 0;
+        int err = mkdir(path, 0700);
+        *slash = '/';
+        if (err < 0 && errno != EEXIST) return -1;
+    }
+    if (mkdir(path, 0700) < 0 && errno != EEXIST) return -1;
+    return 0;
+}
+
+char *cacheDir(const char *sub) {
+    const char *base = getenv("EX2_CACHE_DIR");
+    const char *suffix = "";
+    if (!base || !*base) {
+        base = getenv("XDG_CACHE_HOME");
+        suffix = "/ex2";
+    }
+    if (!base || !*base) {
+        base = getenv("HOME");
+        suffix = "/.cache/ex2";
+    }
+    if (!base || !*base) return NULL;
+    size_t len = strlen(base) + strlen(suffix) + (sub ? strlen(sub) + 1 : 0) + 1;
+    char *path = (char *)malloc(len);
+    if (!path) return NULL;
+    snprintf(path, len, "%s%s%s%s", base, suffix, sub ? "/" : "", sub ? sub : "");
+    if (makeDirs(path) < 0) {
+        free(path);
+        return NULL;
+    }
+    return path;
+}
+
+/**
+ * The function returns the size of a NUL terminated string within a buffer,
+ * or -1 if the buffer ends before the NUL.
+ */
+static ssize_t boundedLen(const char *data, size_t size) {
+    const char *nul = memchr(data, 0, size);
+    return nul ? nul - data : -1;
+}
+
+/**
+ * The function checks that a mapped parsed script belongs to the source,
+ * and that every record lies within the file, so a truncated or corrupt
+ * cache entry is parsed again rather than read past its end.
+ * @return 1 if it does and 0 else.
+ */
+static int validScript(const char *data, size_t size, const unsigned char *digest, size_t sourceSize) {
+    if (size < sizeof(ScriptHeader)) return 0;
+    const ScriptHeader *header = (const ScriptHeader *)data;
+    // entries share a name when the first 8 bytes of their digests do, the
+    // whole digest tells the sources apart
+    if (header->magic != SCRIPT_MAGIC || header->version != SCRIPT_VERSION ||
+        memcmp(header->digest, digest, SHA256_SIZE) || header->sourceSize != sourceSize) {
+        return 0;
+    }
+    size_t at = sizeof(ScriptHeader);
+    uint32_t i, w;
+    for (i = 0; i < header->count; i++) {
+        uint32_t record[3];
+        if (size - at < sizeof(record)) return 0;
+        memcpy(record, data + at, sizeof(record));
+        at += sizeof(record);
+        if (record[2] > size - at || record[0] == 0) return 0;
+        // the words, and the here-doc's body, must fill the record exactly
+        const char *words = data + at;
+        size_t used = 0;
+        for (w = 0; w < record[0] + !!(record[1] & CMD_HEREDOC); w++) {
+            ssize_t len = boundedLen(words + used, record[2] - used);
+            if (len < 0) return 0;
+            used += len + 1;
+        }
+        if (used != record[2]) return 0;
+        size_t padded = record[2] + (4 - record[2] % 4) % 4;
+        if (padded > size - at) return 0;
+        at += padded;
+    }
+    return 1;
+}
+
+/**
+ * The function writes the parsed script to the cache, through a temporary
+ * file so a concurrent run never maps a half written entry.
+ */
+static void storeScript(const char *cachePath, const Buffer *buffer) {
+    size_t len = strlen(cachePath) + 8;
+    char tmpPath[len];
+    snprintf(tmpPath, len, "%s.XXXXXX", cachePath);
+    int fd = mkstemp(tmpPath);
+    if (fd < 0) return;
+    size_t written = 0;
+    while (written < buffer->size) {
+        ssize_t n = write(fd, buffer->data + written, buffer->size - written);
+        if (n <= 0) break;
+        written += n;
+    }
+    close(fd);
+    if (written != buffer->size || rename(tmpPath, cachePath) < 0) unlink(tmpPath);
+}
+
+int openScript(const char *path, Script *script) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return -1;
+    }
+    size_t sourceSize = st.st_size;
+    char *source = sourceSize ? (char *)mmap(NULL, sourceSize, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+    close(fd);
+    if (sourceSize && source == MAP_FAILED) return -1;
+    unsigned char digest[SHA256_SIZE];
+    sha256(source, sourceSize, digest);
+
+    char *dir = cacheDir("scripts");
+    char cachePath[dir ? strlen(dir) + 24 : 1];
+    cachePath[0] = 0;
+    if (dir) {
+        int n = snprintf(cachePath, sizeof(cachePath), "%s/", dir), i;
+        for (i = 0; i < 8; i++) n += snprintf(cachePath + n, sizeof(cachePath) - n, "%02x", digest[i]);
+        free(dir);
+        int cacheFd = open(cachePath, O_RDONLY | O_CLOEXEC);
+        if (cacheFd >= 0 && fstat(cacheFd, &st) == 0 && st.st_size > 0) {
+            char *data = (char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, cacheFd, 0);
+            close(cacheFd);
+            if (data != MAP_FAILED && validScript(data, st.st_size, digest, sourceSize)) {
+                if (source) munmap(source, sourceSize);
+                script->data = data;
+                script->size = st.st_size;
+                script->mapped = 1;
+                script->cursor = data + sizeof(ScriptHeader);
+                script->remaining = ((ScriptHeader *)data)->count;
+                return 0;
+            }
+            if (data != MAP_FAILED) munmap(data, st.st_size);
+        } else if (cacheFd >= 0) {
+            close(cacheFd);
+        }
+    }
+
+    Buffer buffer = {NULL, 0, 0};
+    int err = parseScript(source, sourceSize, digest, &buffer);
+    if (source) munmap(source, sourceSize);
+    if (err < 0) {
+        free(buffer.data);
+        return -1;
+    }
+    if (cachePath[0]) storeScript(cachePath, &buffer);
+    script->data = buffer.data;
+    script->size = buffer.size;
+    script->mapped = 0;
+    script->cursor = buffer.data + sizeof(ScriptHeader);
+    script->remaining = ((ScriptHeader *)buffer.data)->count;
+    return 0;
+}
+
+int nextScriptCommand(Script *script, ScriptCommand *command) {
+    if (script->remaining == 0) return 0;
+    const uint32_t *record = (const uint32_t *)script->cursor;
+    command->argc = record[0];
+    command->flags = record[1];
+    command->words = script->cursor + 3 * sizeof(uint32_t);
+    command->heredoc = NULL;
+    if (command->flags & CMD_HEREDOC) {
+        const char *word = command->words;
+        uint32_t i;
+        for (i = 0; i < command->argc; i++) word += strlen(word) + 1;
+        command->heredoc = word;
+    }
+    script->cursor = command->words + record[2] + (4 - record[2] % 4) % 4;
+    script->remaining--;
+    return 1;
+}
+
+void closeScript(Script *script) {
+    if (script->mapped) munmap(script->data, script->size);
+    else free(script->data);
+    script->data = NULL;
+}
@@ -0,0 +1,75 @@
+#ifndef EX2_SCRIPT_H
+#define EX2_SCRIPT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* the command has a word that needs glob expansion */
+#define CMD_HAS_GLOB 1
+/* the command ended with & */
+#define CMD_BACKGROUND 2
+/* the command has a here-doc */
+#define CMD_HEREDOC 4
+
+typedef struct {
+    char *data;
+    size_t size;
+    int mapped;
+    const char *cursor;
+    uint32_t remaining;
+} Script;
+
+typedef struct {
+    uint32_t argc;
+    uint32_t flags;
+    /* argc consecutive NUL terminated words */
+    const char *words;
+    /* the here-doc's body, or NULL */
+    const char *heredoc;
+} ScriptCommand;
+
+/**
+ * The function returns the FNV-1a hash of a buffer.
+ * @param data The buffer.
+ * @param size The buffer's size.
+ * @return The hash.
+ */
+uint64_t hashBytes(const void *data, size_t size);
+/**
+ * The function continues a hash with another buffer, so hashing buffers one
+ * after another gives the hash of their concatenation.
+ * @param hash The hash so far.
+ * @param data The buffer.
+ * @param size The buffer's size.
+ * @return The hash.
+ */
+uint64_t hashMore(uint64_t hash, const void *data, size_t size);
+/**
+ * The function returns the shell's cache directory, creating it if needed.
+ * @param sub A sub directory of the cache to create and return, or NULL.
+ * @return A newly allocated path or NULL if there is no usable directory.
+ */
+char *cacheDir(const char *sub);
+/**
+ * The function opens a script, mapping its parsed form from the cache when
+ * the cache has an entry for the script's content, and parsing and storing
+ * it else.
+ * @param path The script's path.
+ * @param script The opened script.
+ * @return 0 on success or -1 on failure.
+ */
+int openScript(const char *path, Script *script);
+/**
+ * The function returns the script's next command.
+ * @param script The script.
+ * @param command The command, its words point into the script.
+ * @return 1 if a command was returned and 0 at the end of the script.
+ */
+int nextScriptCommand(Script *script, ScriptCommand *command);
+/**
+ * The function releases the script's parsed form.
+ * @param script The script.
+ */
+void closeScript(Script *script);
+
+#endif
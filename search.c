@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+#include "search.h"
+
+#define READ_BUF_SIZE 65536
+
+typedef const char *(*FindFunction)(const char *, size_t, const char *, size_t);
+
+/**
+ * The function confirms the candidates of a block. Bit i of mask is set when
+ * the needle's first and last bytes match at haystack + i.
+ */
+static inline const char *confirm(const char *haystack, unsigned mask, const char *needle, size_t needleSize) {
+    while (mask) {
+        int bit = __builtin_ctz(mask);
+        // the first and last bytes matched already
+        if (needleSize <= 2 || memcmp(haystack + bit + 1, needle + 1, needleSize - 2) == 0) return haystack + bit;
+        mask &= mask - 1;
+    }
+    return NULL;
+}
+
+static const char *findScalar(const char *haystack, size_t size, const char *needle, size_t needleSize) {
+    return (const char *)memmem(haystack, size, needle, needleSize);
+}
+
+#if defined(__x86_64__)
+static const char *findSse2(const char *haystack, size_t size, const char *needle, size_t needleSize) {
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[needleSize - 1]);
+    size_t i = 0;
+    for (; i + needleSize - 1 + 16 <= size; i += 16) {
+        __m128i blockFirst = _mm_loadu_si128((const __m128i *)(haystack + i));
+        __m128i blockLast = _mm_loadu_si128((const __m128i *)(haystack + i + needleSize - 1));
+        __m128i eq = _mm_and_si128(_mm_cmpeq_epi8(first, blockFirst), _mm_cmpeq_epi8(last, blockLast));
+        unsigned mask = _mm_movemask_epi8(eq);
+        const char *match = mask ? confirm(haystack + i, mask, needle, needleSize) : NULL;
+        if (match) return match;
+    }
+    return findScalar(haystack + i, size - i, needle, needleSize);
+}
+
+__attribute__((target("avx2")))
+static const char *findAvx2(const char *haystack, size_t size, const char *needle, size_t needleSize) {
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[needleSize - 1]);
+    size_t i = 0;
+    for (; i + needleSize - 1 + 32 <= size; i += 32) {
+        __m256i blockFirst = _mm256_loadu_si256((const __m256i *)(haystack + i));
+        __m256i blockLast = _mm256_loadu_si256((const __m256i *)(haystack + i + needleSize - 1));
+        __m256i eq = _mm256_and_si256(_mm256_cmpeq_epi8(first, blockFirst), _mm256_cmpeq_epi8(last, blockLast));
+        unsigned mask = _mm256_movemask_epi8(eq);
+        const char *match = mask ? confirm(haystack + i, mask, needle, needleSize) : NULL;
+        if (match) return match;
+    }
+    return findSse2(haystack + i, size - i, needle, needleSize);
+}
+#endif
+
+/**
+ * The function picks the widest filter the CPU supports, once.
+ */
+static FindFunction findFunction() {
+    static FindFunction function = NULL;
+    if (function) return function;
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    function = __builtin_cpu_supports("avx2") ? findAvx2 : findSse2;
+    if (getenv("EX2_SEARCH_SCALAR")) function = findScalar;
+#else
+    function = findScalar;
+#endif
+    return function;
+}
+
+const char *findString(const char *haystack, size_t size, const char *needle, size_t needleSize) {
+    if (needleSize == 0) return haystack;
+    if (needleSize > size) return NULL;
+    if (needleSize == 1) return (const char *)memchr(haystack, needle[0], size);
+    return findFunction()(haystack, size, needle, needleSize);
+}
+
+/**
+ * The function counts or prints the lines of a buffer that contain the
+ * pattern. After a match the scan skips to the next line, so every line is
+ * counted once.
+ * @param name The file's name to prefix printed lines with, or NULL.
+ * @return The number of matching lines.
+ */
+static long searchBuffer(const char *data, size_t size, const char *pattern, int printLines, const char *name) {
+    size_t patternSize = strlen(pattern);
+    const char *cursor = data, *end = data + size;
+    long count = 0;
+    while (cursor < end) {
+        const char *match = findString(cursor, end - cursor, pattern, patternSize);
+        if (!match) break;
+        const char *lineEnd = (const char *)memchr(match, '\n', end - match);
+        if (!lineEnd) lineEnd = end;
+        count++;
+        if (printLines) {
+            const char *lineStart = match;
+            while (lineStart > cursor && lineStart[-1] != '\n') lineStart--;
+            if (name) printf("%s:", name);
+            fwrite(lineStart, 1, lineEnd - lineStart, stdout);
+            putchar('\n');
+        }
+        cursor = lineEnd + 1;
+    }
+    return count;
+}
+
+/**
+ * The function reads an fd or stream that can't be mapped, like a pipe.
+ * @return The data, or NULL on failure.
+ */
+static char *readAll(int fd, size_t *size) {
+    size_t capacity = READ_BUF_SIZE;
+    char *data = (char *)malloc(capacity);
+    *size = 0;
+    while (data) {
+        if (*size == capacity) {
+            char *grown = (char *)realloc(data, capacity *= 2);
+            if (!grown) break;
+            data = grown;
+        }
+        ssize_t n = fd >= 0 ? read(fd, data + *size, capacity - *size)
+                            : (ssize_t)fread(data + *size, 1, capacity - *size, stdin);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) break;
+        if (n == 0) {
+            if (fd < 0) clearerr(stdin);
+            return data;
+        }
+        *size += n;
+    }
+    free(data);
+    return NULL;
+}
+
+/**
+ * The function searches one file, mapping it when it is a regular file.
+ * @return The number of matching lines or -1 on failure.
+ */
+static long searchFile(int fd, const char *pattern, int printLines, const char *name) {
+    struct stat st;
+    if (fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        if (st.st_size == 0) return 0;
+        char *data = (char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) return -1;
+        madvise(data, st.st_size, MADV_SEQUENTIAL);
+        long count = searchBuffer(data, st.st_size, pattern, printLines, name);
+        munmap(data, st.st_size);
+        return count;
+    }
+    size_t size;
+    char *data = readAll(fd, &size);
+    if (!data) return -1;
+    long count = searchBuffer(data, size, pattern, printLines, name);
+    free(data);
+    return count;
+}
+
+int runSearch(int argc, char **argv, int in) {
+    int printLines = 0, i = 1;
+    if (i < argc && strcmp(argv[i], "-p") == 0) {
+        printLines = 1;
+        i++;
+    }
+    if (i >= argc) {
+        fprintf(stderr, SEARCH_USAGE);
+        return 2;
+    }
+    const char *pattern = argv[i++];
+    int files = argc - i, status = 1;
+    if (files == 0) {
+        long count = searchFile(in, pattern, printLines, NULL);
+        if (count < 0) perror("search");
+        else if (!printLines) printf("%ld\n", count);
+        fflush(stdout);
+        return count < 0 ? 2 : count > 0 ? 0 : 1;
+    }
+    for (; i < argc; i++) {
+        int fd = open(argv[i], O_RDONLY | O_CLOEXEC);
+        long count = fd >= 0 ? searchFile(fd, pattern, printLines, files > 1 ? argv[i] : NULL) : -1;
+        if (fd >= 0) close(fd);
+        if (count < 0) {
+            perror(argv[i]);
+            status = 2;
+            continue;
+        }
+        if (!printLines && files > 1) printf("%s:%ld\n", argv[i], count);
+        else if (!printLines) printf("%ld\n", count);
+        if (count > 0 && status == 1) status = 0;
+    }
+    fflush(stdout);
+    return status;
+}
@@ -0,0 +1,31 @@
+#ifndef EX2_SEARCH_H
+#define EX2_SEARCH_H
+
+#include <stddef.h>
+
+#define SEARCH_USAGE "usage: search [-p] PATTERN [FILE...]\n"
+
+/**
+ * The function finds the first occurrence of a fixed string. On x86-64 the
+ * haystack is filtered 32 (AVX2) or 16 (SSE2) positions at a time by
+ * comparing the needle's first and last bytes, and only the positions where
+ * both match are compared in full.
+ * @param haystack The bytes to search.
+ * @param size The haystack's size.
+ * @param needle The string to find.
+ * @param needleSize The needle's size.
+ * @return The occurrence or NULL.
+ */
+const char *findString(const char *haystack, size_t size, const char *needle, size_t needleSize);
+/**
+ * The function runs the search builtin, which counts the lines of the files
+ * (stdin when none are given) that contain the pattern, or with -p prints
+ * them. The files are mapped, not read.
+ * @param argc The number of arguments.
+ * @param argv The NULL terminated arguments, starting with "search".
+ * @param in The fd stdin is redirected from, or -1 for the shell's stdin.
+ * @return 0 if a line matched, 1 if none did or 2 on an error.
+ */
+int runSearch(int argc, char **argv, int in);
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef EX2_SHA256_H
+#define EX2_SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_SIZE 32
+
+typedef struct {
+    uint32_t state[8];
+    /* the bytes hashed so far */
+    uint64_t length;
+    unsigned char block[64];
+    size_t used;
+} Sha256;
+
+/**
+ * The function starts a SHA-256 digest.
+ * @param ctx The digest.
+ */
+void sha256Init(Sha256 *ctx);
+/**
+ * The function adds a buffer to a SHA-256 digest.
+ * @param ctx The digest.
+ * @param data The buffer.
+ * @param size The buffer's size.
+ */
+void sha256Update(Sha256 *ctx, const void *data, size_t size);
+/**
+ * The function finishes a SHA-256 digest.
+ * @param ctx The digest.
+ * @param digest Gets the SHA256_SIZE bytes of the digest.
+ */
+void sha256Final(Sha256 *ctx, unsigned char *digest);
+/**
+ * The function returns the SHA-256 digest of a buffer. Unlike hashBytes it
+ * resists collisions, so equal digests are taken to mean equal bytes.
+ * @param data The buffer.
+ * @param size The buffer's size.
+ * @param digest Gets the SHA256_SIZE bytes of the digest.
+ */
+void sha256(const void *data, size_t size, unsigned char *digest);
+
+#endif
@@ -0,0 +1,248 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <wait.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include "metrics.h"
+#include "jobtable.h"
+#include "sigchld.h"
+#include "timeout.h"
+#include "shutdown.h"
+
+#define EVENT_BATCH 256
+/* how often jobs without a pidfd in the epoll set are checked on */
+#define UNWATCHED_POLL_MS 10
+/* how long the jobs get to die after SIGKILL */
+#define KILL_DEADLINE_NS 1000000000LL
+
+static const char *policyNames[] = {"wait", "signal", "detach"};
+/* the policy, or -1 for the default */
+static int policy = -1;
+/* the deadline, or 0 for the policy's default */
+static long long deadlineNs = 0;
+static int lastStatus = 0;
+
+typedef struct {
+    int epollFd;
+    /* the fds in the epoll set, -1 once they fired */
+    int *fds;
+    /* 1 for a pidfd that was opened for the shutdown, 0 for a job's own */
+    char *owned;
+    int count;
+    /* how many fds are still in the epoll set */
+    int watching;
+} Watch;
+
+/**
+ * The function parses a policy and an optional deadline.
+ * @return 0 on success or -1 on failure.
+ */
+static int setPolicy(const char *name, const char *deadline) {
+    int i;
+    long long ns = 0;
+    for (i = 0; i < 3 && strcmp(policyNames[i], name) != 0; i++);
+    if (i == 3 || (deadline && parseDuration(deadline, &ns) < 0)) return -1;
+    policy = i;
+    deadlineNs = ns;
+    return 0;
+}
+
+void initShutdown() {
+    const char *value = getenv("EX2_SHUTDOWN");
+    if (!value || !*value) return;
+    char *copy = strdup(value);
+    if (!copy) return;
+    char *deadline = strchr(copy, ':');
+    if (deadline) *deadline++ = 0;
+    if (setPolicy(copy, deadline) < 0) fprintf(stderr, "EX2_SHUTDOWN: bad policy %s\n", value);
+    free(copy);
+}
+
+void noteExitStatus(int status) {
+    lastStatus = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+/**
+ * The function returns the policy in effect.
+ */
+static int currentPolicy() {
+    if (policy >= 0) return policy;
+    return jobTableOpen() ? SHUTDOWN_DETACH : SHUTDOWN_WAIT;
+}
+
+/**
+ * The function returns the deadline of a policy in nanoseconds.
+ */
+static long long policyDeadline(int current) {
+    if (deadlineNs) return deadlineNs;
+    return current == SHUTDOWN_SIGNAL ? DEFAULT_SIGNAL_DEADLINE_NS : DEFAULT_WAIT_DEADLINE_NS;
+}
+
+int runShutdownPolicy(char **args) {
+    if (!args[1]) {
+        int current = currentPolicy();
+        if (current == SHUTDOWN_DETACH) printf("shutdown detach\n");
+        else printf("shutdown %s %gs\n", policyNames[current], policyDeadline(current) / 1e9);
+        return 0;
+    }
+    if ((args[2] && args[3]) || setPolicy(args[1], args[2]) < 0) {
+        fprintf(stderr, SHUTDOWN_USAGE);
+        return 2;
+    }
+    return 0;
+}
+
+/**
+ * The function sends a signal to every job that is still running, to its
+ * process group if it leads one.
+ */
+static void signalJobs(JobsQueue *jobsQueue, int sig) {
+    removeCompletedJobs(jobsQueue);
+    // no job is reaped while they are signalled, so no pid can be reused
+    holdChildExits(1);
+    Job *job;
+    for (job = jobsQueue->first; job; job = job->next) {
+        if (!job->started) continue;
+        if (job->pidfd >= 0) {
+            // a reattached job isn't our child, its pidfd tells if it is gone
+            struct pollfd exited = {job->pidfd, POLLIN, 0};
+            if (poll(&exited, 1, 0) > 0) continue;
+            if (job->pgid <= 0) {
+                syscall(SYS_pidfd_send_signal, job->pidfd, sig, NULL, 0);
+                continue;
+            }
+        } else {
+            siginfo_t info;
+            info.si_pid = 0;
+            if (waitid(P_PID, job->pid, &info, WEXITED | WNOHANG | WNOWAIT) < 0 || info.si_pid) continue;
+        }
+        pid_t target = job->pgid > 0 ? -job->pgid : job->pid;
+        kill(target, sig);
+        // a stopped job is continued, so it can handle the SIGTERM
+        if (sig == SIGTERM) kill(target, SIGCONT);
+    }
+    holdChildExits(0);
+}
+
+/**
+ * The function puts a pidfd of every running job in one epoll set. A job
+ * whose pidfd can't be opened, once the fds run out, is checked on every
+ * UNWATCHED_POLL_MS instead.
+ * @return 0 on success or -1 on failure.
+ */
+static int openWatch(JobsQueue *jobsQueue, Watch *watch) {
+    memset(watch, 0, sizeof(*watch));
+    watch->epollFd = epoll_create1(EPOLL_CLOEXEC);
+    watch->fds = (int *)malloc((jobsQueue->size + 1) * sizeof(int));
+    watch->owned = (char *)malloc(jobsQueue->size + 1);
+    if (watch->epollFd < 0 || !watch->fds || !watch->owned) {
+        perror(SYS_CALL_ERR);
+        return -1;
+    }
+    Job *job;
+    for (job = jobsQueue->first; job; job = job->next) {
+        if (!job->started) continue;
+        int owned = job->pidfd < 0;
+        int fd = owned ? syscall(SYS_pidfd_open, job->pid, 0) : job->pidfd;
+        if (fd < 0) continue;
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.u32 = watch->count;
+        if (epoll_ctl(watch->epollFd, EPOLL_CTL_ADD, fd, &event) < 0) {
+            if (owned) close(fd);
+            continue;
+        }
+        watch->fds[watch->count] = fd;
+        watch->owned[watch->count++] = owned;
+        watch->watching++;
+    }
+    return 0;
+}
+
+static void closeWatch(Watch *watch) {
+    int i;
+    for (i = 0; i < watch->count; i++) {
+        if (watch->fds[i] >= 0 && watch->owned[i]) close(watch->fds[i]);
+    }
+    if (watch->epollFd >= 0) close(watch->epollFd);
+    free(watch->fds);
+    free(watch->owned);
+}
+
+/**
+ * The function waits until every job exited or the deadline passed.
+ */
+static void waitJobs(JobsQueue *jobsQueue, Watch *watch, long long deadline) {
+    struct epoll_event events[EVENT_BATCH];
+    removeCompletedJobs(jobsQueue);
+    while (!isEmpty(jobsQueue)) {
+        long long left = deadline - nowNs();
+        if (left <= 0) break;
+        int ms = (int)(left / 1000000) + 1;
+        // the jobs outside the set, or whose exit wasn't collected yet, are
+        // checked on by the sweep
+        if (watch->watching < jobsQueue->size && ms > UNWATCHED_POLL_MS) ms = UNWATCHED_POLL_MS;
+        int n = epoll_wait(watch->epollFd, events, EVENT_BATCH, ms);
+        if (n < 0 && errno != EINTR) {
+            perror(SYS_CALL_ERR);
+            break;
+        }
+        int e;
+        for (e = 0; e < n; e++) {
+            int i = events[e].data.u32;
+            if (watch->fds[i] < 0) continue;
+            epoll_ctl(watch->epollFd, EPOLL_CTL_DEL, watch->fds[i], NULL);
+            if (watch->owned[i]) close(watch->fds[i]);
+            watch->fds[i] = -1;
+            watch->watching--;
+        }
+        removeCompletedJobs(jobsQueue);
+    }
+}
+
+int shutdownShell(JobsQueue *jobsQueue, const char *code) {
+    int exitCode = lastStatus;
+    if (code) {
+        char *end;
+        long value = strtol(code, &end, 10);
+        if (*end || end == code) {
+            fprintf(stderr, "exit: %s: numeric argument required\n", code);
+            value = 2;
+        }
+        exitCode = (int)(value & 0xff);
+    }
+    int current = currentPolicy();
+    removeCompletedJobs(jobsQueue);
+    if (current == SHUTDOWN_DETACH) {
+        // a job the table couldn't take is left running without a record
+        int untracked = 0;
+        Job *job;
+        for (job = jobsQueue->first; job; job = job->next) untracked += job->slot < 0;
+        if (untracked) fprintf(stderr, "shutdown: %d jobs left running aren't in the job table\n", untracked);
+    }
+    if (current == SHUTDOWN_DETACH || isEmpty(jobsQueue)) return exitCode;
+    Watch watch;
+    if (openWatch(jobsQueue, &watch) < 0) {
+        closeWatch(&watch);
+        return code ? exitCode : 1;
+    }
+    if (current == SHUTDOWN_SIGNAL) signalJobs(jobsQueue, SIGTERM);
+    waitJobs(jobsQueue, &watch, nowNs() + policyDeadline(current));
+    if (!isEmpty(jobsQueue) && current == SHUTDOWN_WAIT) {
+        signalJobs(jobsQueue, SIGTERM);
+        waitJobs(jobsQueue, &watch, nowNs() + DEFAULT_GRACE_NS);
+    }
+    int forced = !isEmpty(jobsQueue);
+    if (forced) {
+        signalJobs(jobsQueue, SIGKILL);
+        waitJobs(jobsQueue, &watch, nowNs() + KILL_DEADLINE_NS);
+    }
+    closeWatch(&watch);
+    if (!isEmpty(jobsQueue)) fprintf(stderr, "shutdown: %d jobs left running\n", jobsQueue->size);
+    return code || exitCode ? exitCode : forced;
+}
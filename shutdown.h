@@ -0,0 +1,52 @@
+#ifndef EX2_SHUTDOWN_H
+#define EX2_SHUTDOWN_H
+
+#include "jobs.h"
+
+#define SHUTDOWN_USAGE "usage: shutdown [wait|signal|detach] [DEADLINE]\n"
+#define SHUTDOWN_WAIT 0
+#define SHUTDOWN_SIGNAL 1
+#define SHUTDOWN_DETACH 2
+/* how long the jobs get by default: wait until it gives up on them, signal
+ * from the SIGTERM until the SIGKILL */
+#define DEFAULT_WAIT_DEADLINE_NS 30000000000LL
+#define DEFAULT_SIGNAL_DEADLINE_NS 5000000000LL
+
+/**
+ * The function reads the shutdown policy from EX2_SHUTDOWN, which is a
+ * policy optionally followed by :DEADLINE, like signal:10s. Without one the
+ * shell detaches if the job table is open, so the next shell reattaches the
+ * jobs, and waits else.
+ */
+void initShutdown();
+/**
+ * The function records the wait status of the last foreground job, which
+ * is the shell's exit code unless exit is given one.
+ * @param status The wait status.
+ */
+void noteExitStatus(int status);
+/**
+ * The function runs the shutdown builtin, which prints or sets the policy
+ * the shell ends its background jobs with when it exits:
+ * wait waits for them until the deadline, then terminates them like signal,
+ * signal sends their process groups SIGTERM and SIGKILL once the deadline
+ * passed, and detach leaves them running.
+ * @param args The builtin's NULL terminated argv, starting with "shutdown".
+ * @return 0 on success or 2 on a usage error.
+ */
+int runShutdownPolicy(char **args);
+/**
+ * The function ends the background jobs by the shutdown policy. The jobs
+ * are waited for with one epoll set of pidfds, and each step is bounded by
+ * its deadline, so the shutdown takes bounded time however many jobs there
+ * are.
+ * @param jobsQueue The jobsQueue.
+ * @param code The exit code exit was given, or NULL.
+ * @return The shell's exit code: the given code, else the last foreground
+ * job's status (128 + the signal for a killed job), else 1 if jobs had to
+ * be killed or survived the shutdown and 0 if not. A code that isn't a
+ * number gives 2.
+ */
+int shutdownShell(JobsQueue *jobsQueue, const char *code);
+
+#endif
@@ -0,0 +1,159 @@
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include "sigchld.h"
+
+/*
+ * The ring has a single producer, the handler, which SIGCHLD can't
+ * interrupt, or the main loop with SIGCHLD held. The consumer is the main
+ * loop. head and tail only grow, the slot is their value modulo the size.
+ */
+static ChildExit ring[EXIT_RING_SIZE];
+static unsigned head = 0, tail = 0;
+/* set by the handler when it left children unreaped because the ring was full */
+static volatile sig_atomic_t overflowed = 0;
+
+/* the pids the handler reaps, an open-addressed hash with linear probing
+ * where 0 is a free slot, only changed by the handler or with SIGCHLD held */
+static pid_t watched[WATCH_SLOTS];
+static int watchedCount = 0;
+/* set by the handler when a zombie it doesn't watch hid the ones after it */
+static volatile sig_atomic_t hidden = 0;
+static int installed = 0;
+
+/**
+ * The function returns a pid's slot in the watched pids, or the free slot
+ * it would take.
+ */
+static int watchedSlot(pid_t pid) {
+    int i = pidHash(pid) & (WATCH_SLOTS - 1);
+    while (watched[i] && watched[i] != pid) i = (i + 1) & (WATCH_SLOTS - 1);
+    return i;
+}
+
+/**
+ * The function frees a slot of the watched pids, moving the pids probed
+ * past it back so no probe stops short of them.
+ */
+static void unwatch(int hole) {
+    int i = hole, j = hole;
+    for (;;) {
+        j = (j + 1) & (WATCH_SLOTS - 1);
+        if (!watched[j]) break;
+        int home = pidHash(watched[j]) & (WATCH_SLOTS - 1);
+        // the pid can fill the hole unless the hole is before its home
+        if (((j - home) & (WATCH_SLOTS - 1)) >= ((j - i) & (WATCH_SLOTS - 1))) {
+            watched[i] = watched[j];
+            i = j;
+        }
+    }
+    watched[i] = 0;
+    watchedCount--;
+}
+
+/**
+ * The function reaps a watched child and queues its exit.
+ * @return 1 if it was reaped, 0 if it is running or -1 if the ring is full.
+ */
+static int reapWatched(int index) {
+    unsigned at = __atomic_load_n(&head, __ATOMIC_RELAXED);
+    if (at - __atomic_load_n(&tail, __ATOMIC_ACQUIRE) == EXIT_RING_SIZE) {
+        overflowed = 1;
+        return -1;
+    }
+    ChildExit *slot = &ring[at % EXIT_RING_SIZE];
+    pid_t pid = wait4(watched[index], &slot->status, WNOHANG, &slot->usage);
+    if (pid <= 0) return 0;
+    slot->pid = pid;
+    __atomic_store_n(&head, at + 1, __ATOMIC_RELEASE);
+    unwatch(index);
+    return 1;
+}
+
+/**
+ * The function reaps the watched children that exited. It peeks at the
+ * next zombie without reaping it, and reaps it if it is watched. A zombie
+ * that isn't watched, because someone else waits for it, hides the ones
+ * after it; the handler leaves them for takeChildExits then, which tries
+ * every watched child, so the handler's work stays constant per exit.
+ * Only async-signal-safe calls are made.
+ * @param sweep 0 in the handler and 1 in takeChildExits.
+ */
+static void reapChildren(int sweep) {
+    for (;;) {
+        siginfo_t info;
+        info.si_pid = 0;
+        if (waitid(P_ALL, 0, &info, WEXITED | WNOHANG | WNOWAIT) < 0 || info.si_pid == 0) return;
+        int index = watchedSlot(info.si_pid);
+        if (!watched[index]) break;
+        if (reapWatched(index) <= 0) return;
+    }
+    if (!sweep) {
+        hidden = 1;
+        return;
+    }
+    int i = 0;
+    while (i < WATCH_SLOTS) {
+        int reaped = watched[i] ? reapWatched(i) : 0;
+        if (reaped < 0) return;
+        // a reaped child's slot may hold a pid that was probed past it now
+        if (!reaped) i++;
+    }
+}
+
+static void onChild(int sig) {
+    (void)sig;
+    int saved = errno;
+    reapChildren(0);
+    errno = saved;
+}
+
+int initChildExits() {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = onChild;
+    action.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGCHLD, &action, NULL) < 0) return -1;
+    installed = 1;
+    return 0;
+}
+
+void holdChildExits(int hold) {
+    if (!installed) return;
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(hold ? SIG_BLOCK : SIG_UNBLOCK, &mask, NULL);
+}
+
+int watchExit(pid_t pid) {
+    if (!installed || watchedCount == MAX_WATCHED) return -1;
+    int i = watchedSlot(pid);
+    if (!watched[i]) watchedCount++;
+    watched[i] = pid;
+    return 0;
+}
+
+int takeChildExits(ChildExit *exits, int max) {
+    int n = 0;
+    for (;;) {
+        unsigned at = __atomic_load_n(&tail, __ATOMIC_RELAXED);
+        unsigned end = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+        while (at != end && n < max) exits[n++] = ring[at++ % EXIT_RING_SIZE];
+        __atomic_store_n(&tail, at, __ATOMIC_RELEASE);
+        if ((!overflowed && !hidden) || at != end) return n;
+        // the children the handler left behind are reaped now that there is
+        // room, or that their zombies may be visible, the handler won't run
+        // for them again unless another child exits
+        sigset_t mask, old;
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGCHLD);
+        sigprocmask(SIG_BLOCK, &mask, &old);
+        overflowed = 0;
+        hidden = 0;
+        reapChildren(1);
+        sigprocmask(SIG_SETMASK, &old, NULL);
+    }
+}
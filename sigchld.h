@@ -0,0 +1,63 @@
+#ifndef EX2_SIGCHLD_H
+#define EX2_SIGCHLD_H
+
+#include <sys/types.h>
+#include <sys/resource.h>
+
+/* how many exits the handler queues before it leaves children unreaped */
+#define EXIT_RING_SIZE 1024
+/* how many background jobs the handler can watch at once */
+#define MAX_WATCHED 16384
+/* the slots of the handler's pid hash, twice MAX_WATCHED keeps probes short */
+#define WATCH_SLOTS (2 * MAX_WATCHED)
+
+typedef struct {
+    pid_t pid;
+    int status;
+    struct rusage usage;
+} ChildExit;
+
+/**
+ * The function spreads pids, which are mostly consecutive, over a hash's
+ * slots. The SIGCHLD handler's pid hash and the jobsQueue's use it.
+ * @param pid The pid.
+ * @return The hash, the caller masks it to the number of slots.
+ */
+static inline unsigned pidHash(pid_t pid) {
+    unsigned hash = (unsigned)pid;
+    hash ^= hash >> 16;
+    hash *= 0x45d9f3bu;
+    return hash ^ (hash >> 16);
+}
+/**
+ * The function installs the SIGCHLD handler. The handler reaps the watched
+ * children only, so code that waits for its own children keeps working, and
+ * queues their exits in a lock-free ring without allocating or touching the
+ * jobsQueue. When the ring is full, or a zombie the handler doesn't watch
+ * hides the watched ones, the handler leaves the children unreaped and
+ * takeChildExits reaps them, so no exit is lost.
+ * @return 0 on success or -1 on failure.
+ */
+int initChildExits();
+/**
+ * The function blocks or unblocks SIGCHLD, so the handler doesn't run while
+ * the watched children change.
+ * @param hold 1 to block and 0 to unblock.
+ */
+void holdChildExits(int hold);
+/**
+ * The function lets the handler reap a child. SIGCHLD must be held from
+ * before the fork until the child is watched, or an early exit is missed.
+ * @param pid The child's pid.
+ * @return 0 on success or -1 if too many children are watched.
+ */
+int watchExit(pid_t pid);
+/**
+ * The function takes queued exits from the ring, oldest first.
+ * @param exits The array to fill.
+ * @param max The array's size.
+ * @return The number of exits taken.
+ */
+int takeChildExits(ChildExit *exits, int max);
+
+#endif
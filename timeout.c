@@ -0,0 +1,281 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <wait.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include "metrics.h"
+#include "sigchld.h"
+#include "timeout.h"
+
+#define HEAP_INITIAL_CAPACITY 64
+
+typedef struct {
+    /* the monotonic time the group is signalled at in nanoseconds */
+    long long deadline;
+    Job *job;
+    pid_t pgid;
+    /* 1 once the group got SIGTERM, and the deadline is the SIGKILL's */
+    int terminated;
+} Timeout;
+
+/* the timeouts by deadline, heap[0] is the earliest and armed on timerFd */
+static Timeout *heap = NULL;
+static int heapSize = 0;
+static int heapCapacity = 0;
+static int timerFd = -1;
+/* the deadline timerFd is armed for, or 0 if it is disarmed */
+static long long armedDeadline = 0;
+/* the timeout of background jobs without one of their own, or 0 */
+static long long defaultTimeout = 0;
+static long long defaultGrace = DEFAULT_GRACE_NS;
+
+/**
+ * The function puts an entry at a heap index and tells its job where.
+ */
+static void place(int index, Timeout entry) {
+    heap[index] = entry;
+    entry.job->timer = index;
+}
+
+static void siftUp(int index) {
+    Timeout entry = heap[index];
+    while (index > 0) {
+        int parent = (index - 1) / 2;
+        if (heap[parent].deadline <= entry.deadline) break;
+        place(index, heap[parent]);
+        index = parent;
+    }
+    place(index, entry);
+}
+
+static void siftDown(int index) {
+    Timeout entry = heap[index];
+    while (2 * index + 1 < heapSize) {
+        int child = 2 * index + 1;
+        if (child + 1 < heapSize && heap[child + 1].deadline < heap[child].deadline) child++;
+        if (entry.deadline <= heap[child].deadline) break;
+        place(index, heap[child]);
+        index = child;
+    }
+    place(index, entry);
+}
+
+/**
+ * The function adds an entry to the heap.
+ * @return 0 on success or -1 on bad alloc.
+ */
+static int push(Timeout entry) {
+    if (heapSize == heapCapacity) {
+        int capacity = heapCapacity ? 2 * heapCapacity : HEAP_INITIAL_CAPACITY;
+        Timeout *grown = (Timeout *)realloc(heap, capacity * sizeof(Timeout));
+        if (!grown) return -1;
+        heap = grown;
+        heapCapacity = capacity;
+    }
+    place(heapSize++, entry);
+    siftUp(heapSize - 1);
+    return 0;
+}
+
+static void removeAt(int index) {
+    heap[index].job->timer = -1;
+    if (index == --heapSize) return;
+    place(index, heap[heapSize]);
+    if (index > 0 && heap[(index - 1) / 2].deadline > heap[index].deadline) siftUp(index);
+    else siftDown(index);
+}
+
+/**
+ * The function arms timerFd for the earliest deadline, or disarms it.
+ */
+static void arm() {
+    long long deadline = heapSize ? heap[0].deadline : 0;
+    if (timerFd < 0 || deadline == armedDeadline) return;
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_sec = deadline / 1000000000LL;
+    spec.it_value.tv_nsec = deadline % 1000000000LL;
+    if (timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &spec, NULL) == 0) armedDeadline = deadline;
+}
+
+
+int initTimeouts() {
+    timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (timerFd < 0) {
+        perror(SYS_CALL_ERR);
+        return -1;
+    }
+    const char *timeout = getenv("EX2_BG_TIMEOUT");
+    if (timeout && parseDuration(timeout, &defaultTimeout) < 0) {
+        fprintf(stderr, "EX2_BG_TIMEOUT: bad duration %s\n", timeout);
+        defaultTimeout = 0;
+    }
+    return 0;
+}
+
+int parseDuration(const char *word, long long *ns) {
+    char *end;
+    errno = 0;
+    double seconds = strtod(word, &end);
+    if (end == word || errno || !isfinite(seconds) || seconds < 0) return -1;
+    if (*end && end[1]) return -1;
+    switch (*end) {
+    case 0:
+    case 's':
+        break;
+    case 'm':
+        seconds *= 60;
+        break;
+    case 'h':
+        seconds *= 3600;
+        break;
+    case 'd':
+        seconds *= 86400;
+        break;
+    default:
+        return -1;
+    }
+    // a year is as good as forever, and keeps the deadline from overflowing
+    if (seconds > 365 * 86400.0) seconds = 365 * 86400.0;
+    *ns = (long long)(seconds * 1e9);
+    return 0;
+}
+
+void useDefaultTimeout(LaunchOptions *options) {
+    if (options->timeoutNs || !defaultTimeout) return;
+    options->timeoutNs = defaultTimeout;
+    options->graceNs = defaultGrace;
+}
+
+int addTimeout(Job *job) {
+    Timeout entry;
+    entry.deadline = nowNs() + job->launch.timeoutNs;
+    entry.job = job;
+    entry.pgid = job->pgid;
+    entry.terminated = 0;
+    if (push(entry) < 0) {
+        perror(BAD_ALLOC);
+        return -1;
+    }
+    arm();
+    return 0;
+}
+
+void cancelTimeout(Job *job) {
+    if (job->timer < 0) return;
+    removeAt(job->timer);
+    arm();
+}
+
+void expireTimeouts() {
+    if (!heapSize || heap[0].deadline > nowNs()) {
+        arm();
+        return;
+    }
+    // a job the SIGCHLD handler reaped isn't our child anymore and its pid
+    // may be reused, so it must not be reaped while the jobs are signalled
+    holdChildExits(1);
+    long long now = nowNs();
+    while (heapSize && heap[0].deadline <= now) {
+        Timeout entry = heap[0];
+        removeAt(0);
+        // a job that exited isn't signalled, even if it isn't reaped yet
+        siginfo_t info;
+        info.si_pid = 0;
+        if (waitid(P_PID, entry.job->pid, &info, WEXITED | WNOHANG | WNOWAIT) < 0 || info.si_pid) continue;
+        if (entry.terminated) {
+            kill(-entry.pgid, SIGKILL);
+            continue;
+        }
+        // a stopped group is continued, so it can handle the SIGTERM
+        kill(-entry.pgid, SIGTERM);
+        kill(-entry.pgid, SIGCONT);
+        fprintf(stderr, "%d\ttimed out\n", entry.job->pid);
+        metrics.jobsTimedOut++;
+        entry.terminated = 1;
+        entry.deadline = now + entry.job->launch.graceNs;
+        push(entry);
+    }
+    holdChildExits(0);
+    arm();
+}
+
+int timeoutFd() { return timerFd; }
+
+void fireTimeouts() {
+    uint64_t expirations;
+    // the expired timer is disarmed, so it is armed again for what is left
+    if (read(timerFd, &expirations, sizeof(expirations)) == sizeof(expirations)) armedDeadline = 0;
+    expireTimeouts();
+}
+
+pid_t waitChild(pid_t pid, int *status) {
+    pid_t reaped;
+    int fd = heapSize ? syscall(SYS_pidfd_open, pid, 0) : -1;
+    if (fd >= 0) {
+        struct pollfd fds[2] = {{fd, POLLIN, 0}, {timerFd, POLLIN, 0}};
+        while (1) {
+            int n = poll(fds, 2, -1);
+            if (n < 0 && errno != EINTR) break;
+            if (n > 0 && fds[1].revents) fireTimeouts();
+            if (n > 0 && fds[0].revents) break;
+        }
+        close(fd);
+    }
+    while ((reaped = waitpid(pid, status, 0)) < 0 && errno == EINTR);
+    return reaped;
+}
+
+void waitInput(int fd) {
+    if (!heapSize) return;
+    struct pollfd fds[2] = {{fd, POLLIN, 0}, {timerFd, POLLIN, 0}};
+    while (1) {
+        int n = poll(fds, 2, -1);
+        if (n < 0 && errno != EINTR) return;
+        if (n > 0 && fds[1].revents) fireTimeouts();
+        if (n > 0 && fds[0].revents) return;
+    }
+}
+
+void sleepFor(long long ns) {
+    long long deadline = nowNs() + ns, left;
+    struct pollfd fds[1] = {{timerFd, POLLIN, 0}};
+    // a disarmed or missing timerfd is never readable, so this is a plain sleep
+    while ((left = deadline - nowNs()) > 0) {
+        struct timespec spec = {left / 1000000000LL, left % 1000000000LL};
+        int n = ppoll(fds, 1, &spec, NULL);
+        if (n < 0 && errno != EINTR) return;
+        if (n > 0 && fds[0].revents) fireTimeouts();
+    }
+}
+
+int runTimeoutDefault(char **args) {
+    if (!args[2]) {
+        printf("timeout --default -k %gs %gs\n", defaultGrace / 1e9, defaultTimeout / 1e9);
+        return 0;
+    }
+    long long grace = DEFAULT_GRACE_NS, timeout;
+    int i = 2;
+    if (strcmp(args[i], "-k") == 0) {
+        if (!args[i + 1] || parseDuration(args[i + 1], &grace) < 0) {
+            fprintf(stderr, TIMEOUT_USAGE);
+            return 2;
+        }
+        i += 2;
+    }
+    if (!args[i] || args[i + 1] || parseDuration(args[i], &timeout) < 0) {
+        fprintf(stderr, TIMEOUT_USAGE);
+        return 2;
+    }
+    defaultTimeout = timeout;
+    defaultGrace = grace;
+    return 0;
+}
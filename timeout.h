@@ -0,0 +1,90 @@
+#ifndef EX2_TIMEOUT_H
+#define EX2_TIMEOUT_H
+
+#include <sys/types.h>
+#include "jobs.h"
+
+#define TIMEOUT_USAGE "usage: timeout [-k GRACE] DURATION CMD\n" \
+                      "       timeout --default [[-k GRACE] DURATION]\n"
+/* how long a job has between SIGTERM and SIGKILL unless -k says else */
+#define DEFAULT_GRACE_NS 5000000000LL
+
+/**
+ * The function creates the timerfd that the timeouts' deadlines are armed
+ * on, and reads the default timeout of background jobs from EX2_BG_TIMEOUT.
+ * @return 0 on success or -1 on failure.
+ */
+int initTimeouts();
+/**
+ * The function parses a duration like timeout(1) does: a decimal number
+ * with an optional s, m, h or d suffix.
+ * @param word The duration.
+ * @param ns Set to the duration in nanoseconds.
+ * @return 0 on success or -1 if the word isn't a duration.
+ */
+int parseDuration(const char *word, long long *ns);
+/**
+ * The function gives a background job without a timeout of its own the
+ * default timeout, if there is one.
+ * @param options The job's launch options.
+ */
+void useDefaultTimeout(LaunchOptions *options);
+/**
+ * The function starts a job's timeout. The deadlines are kept in a min-heap
+ * with the earliest one armed on the timerfd, so a timeout costs O(log n).
+ * When the deadline passes the job's process group gets SIGTERM, and
+ * SIGKILL if it is still there after the grace period.
+ * @param job The job, which leads its process group (job->pgid) or is in it.
+ * @return 0 on success or -1 on bad alloc.
+ */
+int addTimeout(Job *job);
+/**
+ * The function stops a job's timeout, once the job was reaped or deleted.
+ * @param job The job.
+ */
+void cancelTimeout(Job *job);
+/**
+ * The function signals the jobs whose deadlines passed. It doesn't block.
+ */
+void expireTimeouts();
+/**
+ * The function returns the timerfd, which is readable once a deadline
+ * passed, for a caller that waits on other fds too.
+ * @return The timerfd or -1.
+ */
+int timeoutFd();
+/**
+ * The function signals the jobs whose deadlines passed, once the timerfd is
+ * readable.
+ */
+void fireTimeouts();
+/**
+ * The function waits for a child like waitpid does, while it signals the
+ * jobs whose deadlines pass in the meantime, so a hung foreground job
+ * can't hold up the timeouts.
+ * @param pid The child's pid.
+ * @param status Set to the child's wait status.
+ * @return The pid on success or -1 on failure.
+ */
+pid_t waitChild(pid_t pid, int *status);
+/**
+ * The function waits until an fd is readable, while it signals the jobs
+ * whose deadlines pass in the meantime.
+ * @param fd The fd.
+ */
+void waitInput(int fd);
+/**
+ * The function sleeps for a duration, while it signals the jobs whose
+ * deadlines pass in the meantime.
+ * @param ns The duration in nanoseconds.
+ */
+void sleepFor(long long ns);
+/**
+ * The function runs timeout --default, which prints or sets the default
+ * timeout of background jobs, 0 for none.
+ * @param args The builtin's NULL terminated argv, starting with "timeout".
+ * @return 0 on success or 2 on a usage error.
+ */
+int runTimeoutDefault(char **args);
+
+#endif
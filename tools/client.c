@@ -0,0 +1,257 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "../daemon.h"
+
+#define USAGE "usage: ex2-client SOCKET run CMD [ARGS...]\n" \
+              "       ex2-client SOCKET jobs\n" \
+              "       ex2-client SOCKET bench [-c CLIENTS] [-n JOBS] [-d DEPTH] [CMD [ARGS...]]\n"
+
+extern char **environ;
+
+typedef struct {
+    char *data;
+    size_t size;
+    size_t capacity;
+} Buffer;
+
+/**
+ * The function appends bytes to a buffer, exiting on bad alloc.
+ */
+static void append(Buffer *buffer, const void *bytes, size_t size) {
+    if (buffer->size + size > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity : 4096;
+        while (buffer->size + size > capacity) capacity *= 2;
+        buffer->data = (char *)realloc(buffer->data, capacity);
+        if (!buffer->data) {
+            perror("realloc");
+            exit(1);
+        }
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->data + buffer->size, bytes, size);
+    buffer->size += size;
+}
+
+/**
+ * The function connects to the daemon's socket.
+ * @param path The socket's path.
+ * @return The connected socket, exits on failure.
+ */
+static int connectTo(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror(path);
+        exit(1);
+    }
+    return fd;
+}
+
+/**
+ * The function appends a framed DAEMON_RUN message to a buffer.
+ * @param buffer The buffer.
+ * @param argv The job's NULL terminated argv.
+ */
+static void appendRun(Buffer *buffer, char **argv) {
+    size_t start = buffer->size;
+    uint32_t length = 0;
+    append(buffer, &length, sizeof(length));
+    append(buffer, (char[]){DAEMON_RUN}, 1);
+    char cwd[4096];
+    if (!getcwd(cwd, sizeof(cwd))) cwd[0] = 0;
+    append(buffer, cwd, strlen(cwd) + 1);
+    int i;
+    for (i = 0; argv[i]; i++) append(buffer, argv[i], strlen(argv[i]) + 1);
+    append(buffer, "", 1);
+    for (i = 0; environ[i]; i++) append(buffer, environ[i], strlen(environ[i]) + 1);
+    length = buffer->size - start - sizeof(length);
+    memcpy(buffer->data + start, &length, sizeof(length));
+}
+
+/**
+ * The function writes a whole buffer, exiting on failure.
+ */
+static void writeAll(int fd, const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t n = write(fd, data, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            perror("write");
+            exit(1);
+        }
+        data += n;
+        size -= n;
+    }
+}
+
+/**
+ * The function reads the next message from the daemon.
+ * @param fd The socket.
+ * @param message The buffer the payload is read into, reused between calls.
+ * @return The payload's size or 0 when the daemon hung up.
+ */
+static size_t readMessage(int fd, Buffer *message) {
+    uint32_t length;
+    size_t got = 0;
+    while (got < sizeof(length)) {
+        ssize_t n = read(fd, (char *)&length + got, sizeof(length) - got);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 0;
+        got += n;
+    }
+    message->size = 0;
+    if (length > message->capacity) {
+        message->data = (char *)realloc(message->data, length);
+        if (!message->data) exit(1);
+        message->capacity = length;
+    }
+    while (message->size < length) {
+        ssize_t n = read(fd, message->data + message->size, length - message->size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 0;
+        message->size += n;
+    }
+    return length;
+}
+
+/**
+ * The function runs one job through the daemon and waits for it.
+ * @return The job's exit code.
+ */
+static int runOne(const char *path, char **argv) {
+    int fd = connectTo(path);
+    Buffer request = {NULL, 0, 0}, message = {NULL, 0, 0};
+    appendRun(&request, argv);
+    writeAll(fd, request.data, request.size);
+    while (readMessage(fd, &message)) {
+        int32_t values[2];
+        memcpy(values, message.data + 1, message.size - 1 < sizeof(values) ? message.size - 1 : sizeof(values));
+        if (message.data[0] == DAEMON_STARTED) {
+            if (values[0] < 0) {
+                fprintf(stderr, "%s: %s\n", argv[0], strerror(-values[0]));
+                return 127;
+            }
+            printf("%d\n", values[0]);
+            fflush(stdout);
+        } else if (message.data[0] == DAEMON_OUTPUT) {
+            fwrite(message.data + 1 + sizeof(int32_t), 1, message.size - 1 - sizeof(int32_t), stdout);
+        } else if (message.data[0] == DAEMON_EXITED) {
+            fflush(stdout);
+            int status = values[1];
+            return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+        }
+    }
+    return 1;
+}
+
+/**
+ * The function prints the daemon's jobs.
+ * @return The exit code.
+ */
+static int listJobs(const char *path) {
+    int fd = connectTo(path);
+    Buffer message = {NULL, 0, 0};
+    uint32_t length = 1;
+    char request[sizeof(length) + 1];
+    memcpy(request, &length, sizeof(length));
+    request[sizeof(length)] = DAEMON_JOBS;
+    writeAll(fd, request, sizeof(request));
+    while (readMessage(fd, &message)) {
+        if (message.data[0] != DAEMON_LISTING) continue;
+        fwrite(message.data + 1, 1, message.size - 1, stdout);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * The function submits jobs from one connection, keeping depth of them in
+ * flight, until all of them exited.
+ * @return 0 if every job started or 1 else.
+ */
+static int benchClient(const char *path, long jobs, int depth, char **argv) {
+    int fd = connectTo(path);
+    Buffer request = {NULL, 0, 0}, message = {NULL, 0, 0};
+    appendRun(&request, argv);
+    long sent = 0, done = 0, failed = 0;
+    while (done < jobs) {
+        Buffer batch = {NULL, 0, 0};
+        while (sent < jobs && sent - done < depth) {
+            append(&batch, request.data, request.size);
+            sent++;
+        }
+        if (batch.size) writeAll(fd, batch.data, batch.size);
+        free(batch.data);
+        if (!readMessage(fd, &message)) return 1;
+        int32_t pid;
+        memcpy(&pid, message.data + 1, sizeof(pid));
+        if (message.data[0] == DAEMON_EXITED) done++;
+        else if (message.data[0] == DAEMON_STARTED && pid < 0) {
+            done++;
+            failed++;
+        }
+    }
+    return failed ? 1 : 0;
+}
+
+/**
+ * The function measures how many submissions per second the daemon takes.
+ * @return The exit code.
+ */
+static int bench(const char *path, int argc, char **argv) {
+    int clients = 4, depth = 16, opt;
+    long jobs = 1000;
+    optind = 1;
+    while ((opt = getopt(argc, argv, "+c:n:d:")) != -1) {
+        if (opt == 'c') clients = atoi(optarg);
+        else if (opt == 'n') jobs = atol(optarg);
+        else if (opt == 'd') depth = atoi(optarg);
+        else {
+            fprintf(stderr, USAGE);
+            return 2;
+        }
+    }
+    char *defaultCmd[] = {"/bin/true", NULL};
+    char **cmd = optind < argc ? argv + optind : defaultCmd;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int i, failed = 0;
+    for (i = 0; i < clients; i++) {
+        pid_t pid = fork();
+        if (pid == 0) _exit(benchClient(path, jobs, depth, cmd));
+        if (pid < 0) failed = 1;
+    }
+    int status;
+    while (wait(&status) > 0) {
+        if (!WIFEXITED(status) || WEXITSTATUS(status)) failed = 1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    long total = jobs * clients;
+    printf("%ld jobs from %d clients (depth %d) in %.3fs: %.0f submissions/sec\n", total, clients, depth, seconds,
+           total / seconds);
+    return failed;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, USAGE);
+        return 2;
+    }
+    if (strcmp(argv[2], "run") == 0 && argc > 3) return runOne(argv[1], argv + 3);
+    if (strcmp(argv[2], "jobs") == 0) return listJobs(argv[1]);
+    if (strcmp(argv[2], "bench") == 0) return bench(argv[1], argc - 2, argv + 2);
+    fprintf(stderr, USAGE);
+    return 2;
+}
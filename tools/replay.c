@@ -0,0 +1,386 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <wait.h>
+#include <sys/syscall.h>
+#include "../record.h"
+
+/*
+ * Replays a session recorded with EX2_RECORD_FILE against a shell, so two
+ * builds can be compared on the same workload. The shell is started in the
+ * recorded directory with the recorded environment, and each line is sent
+ * once the shell shows its prompt and, unless -f is given, no earlier than
+ * it was read in the recording. Each command is timed from the line being
+ * sent until the next prompt, and the shell's own CPU time in between, read
+ * from /proc/PID/schedstat, is its overhead: unlike the latency it doesn't
+ * count the time a foreground job ran. The shell's output is discarded.
+ * usage: ex2-replay [-f] [-v] RECORDING SHELL [ARGS...]
+ */
+
+#define USAGE "usage: ex2-replay [-f] [-v] RECORDING SHELL [ARGS...]\n"
+#define PROMPT "prompt>"
+#define OUTPUT_CHUNK 65536
+
+typedef struct {
+    /* when the line was read in the recording, since the shell started */
+    long long at;
+    /* the line and its heredoc, each line ending with a newline */
+    char *input;
+    size_t inputSize;
+    /* the command's first word */
+    char *name;
+    long long latency;
+    long long cpu;
+} Command;
+
+typedef struct {
+    char *dir;
+    char **env;
+    int envCount;
+    Command *commands;
+    int count;
+} Recording;
+
+typedef struct {
+    pid_t pid;
+    int pidfd;
+    int input;
+    int output;
+    int schedFd;
+    /* how much of PROMPT the output ended with */
+    int matched;
+} Shell;
+
+typedef struct {
+    const char *name;
+    int count;
+    long long latency;
+    long long p50;
+    long long p99;
+    long long cpu;
+} Group;
+
+static long long nowNs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+/**
+ * The function allocates or grows memory, exiting on bad alloc.
+ */
+static void *grow(void *data, size_t size) {
+    data = realloc(data, size ? size : 1);
+    if (!data) {
+        perror("realloc");
+        exit(1);
+    }
+    return data;
+}
+
+/**
+ * The function undoes the escaping of a field in place.
+ */
+static void unescape(char *text) {
+    char *out = text;
+    for (; *text; text++) {
+        if (*text == '\\' && text[1]) {
+            text++;
+            *out++ = *text == 'n' ? '\n' : *text;
+        } else {
+            *out++ = *text;
+        }
+    }
+    *out = 0;
+}
+
+/**
+ * The function appends a line and its newline to a command's input.
+ */
+static void appendInput(Command *command, const char *line) {
+    size_t len = strlen(line);
+    command->input = (char *)grow(command->input, command->inputSize + len + 1);
+    memcpy(command->input + command->inputSize, line, len);
+    command->input[command->inputSize + len] = '\n';
+    command->inputSize += len + 1;
+}
+
+/**
+ * The function reads a recording.
+ * @return 0 on success or -1 if it isn't one.
+ */
+static int readRecording(const char *path, Recording *recording) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        perror(path);
+        return -1;
+    }
+    memset(recording, 0, sizeof(*recording));
+    char *line = NULL;
+    size_t capacity = 0;
+    ssize_t len = getline(&line, &capacity, file);
+    if (len < 0 || strncmp(line, RECORD_MAGIC, strlen(RECORD_MAGIC)) != 0) {
+        fprintf(stderr, "%s: not an ex2 recording\n", path);
+        free(line);
+        fclose(file);
+        return -1;
+    }
+    while ((len = getline(&line, &capacity, file)) > 0) {
+        if (line[len - 1] == '\n') line[--len] = 0;
+        if (len < 2 || line[1] != '\t') continue;
+        char *field = line + 2;
+        if (line[0] == 'C') {
+            unescape(field);
+            recording->dir = strdup(field);
+        } else if (line[0] == 'E') {
+            unescape(field);
+            // a replay isn't recorded over the recording
+            if (strncmp(field, "EX2_RECORD_FILE=", 16) == 0) continue;
+            recording->env = (char **)grow(recording->env, (recording->envCount + 2) * sizeof(char *));
+            recording->env[recording->envCount++] = strdup(field);
+        } else if (line[0] == 'L' || (line[0] == 'H' && recording->count)) {
+            char *text = strchr(field, '\t');
+            if (!text) continue;
+            *text++ = 0;
+            unescape(text);
+            if (line[0] == 'H') {
+                appendInput(&recording->commands[recording->count - 1], text);
+                continue;
+            }
+            recording->commands = (Command *)grow(recording->commands, (recording->count + 1) * sizeof(Command));
+            Command *command = &recording->commands[recording->count++];
+            memset(command, 0, sizeof(*command));
+            command->at = strtoll(field, NULL, 10);
+            appendInput(command, text);
+            size_t start = strspn(text, " "), end = strcspn(text + start, " ");
+            command->name = strndup(text + start, end);
+        }
+    }
+    if (recording->env) recording->env[recording->envCount] = NULL;
+    free(line);
+    fclose(file);
+    return 0;
+}
+
+/**
+ * The function starts the shell in the recorded directory with the recorded
+ * environment, its stdin and output on pipes.
+ * @return 0 on success or -1 on failure.
+ */
+static int startShell(Recording *recording, char **argv, Shell *shell) {
+    int input[2], output[2];
+    if (pipe2(input, O_CLOEXEC) < 0 || pipe2(output, O_CLOEXEC) < 0) {
+        perror("pipe2");
+        return -1;
+    }
+    char *noEnv[] = {NULL};
+    shell->pid = fork();
+    if (shell->pid == 0) {
+        dup2(input[0], 0);
+        dup2(output[1], 1);
+        dup2(output[1], 2);
+        if (recording->dir && chdir(recording->dir) < 0) perror(recording->dir);
+        execvpe(argv[0], argv, recording->env ? recording->env : noEnv);
+        perror(argv[0]);
+        _exit(127);
+    }
+    close(input[0]);
+    close(output[1]);
+    if (shell->pid < 0) {
+        perror("fork");
+        return -1;
+    }
+    shell->input = input[1];
+    shell->output = output[0];
+    shell->pidfd = syscall(SYS_pidfd_open, shell->pid, 0);
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/schedstat", (int)shell->pid);
+    shell->schedFd = open(path, O_RDONLY | O_CLOEXEC);
+    shell->matched = 0;
+    return 0;
+}
+
+/**
+ * The function returns the CPU time the shell used so far in nanoseconds,
+ * or -1 once it is gone.
+ */
+static long long shellCpu(Shell *shell) {
+    char buf[128];
+    ssize_t n = shell->schedFd >= 0 ? pread(shell->schedFd, buf, sizeof(buf) - 1, 0) : -1;
+    if (n <= 0) return -1;
+    buf[n] = 0;
+    return strtoll(buf, NULL, 10);
+}
+
+/**
+ * The function discards the shell's output until it shows its prompt or
+ * the deadline passes. The output is drained while waiting either way, so
+ * the shell and its jobs never block on a full pipe.
+ * @param deadline The time from nowNs() to stop at, or -1 for none.
+ * @param prompt 1 to stop at the prompt.
+ * @return 1 at the prompt, 0 at the deadline or -1 once the shell exited.
+ */
+static int pump(Shell *shell, long long deadline, int prompt) {
+    static char chunk[OUTPUT_CHUNK];
+    for (;;) {
+        int ms = -1;
+        if (deadline >= 0) {
+            long long left = deadline - nowNs();
+            if (left <= 0) return 0;
+            ms = (int)(left / 1000000) + 1;
+        }
+        struct pollfd fds[2] = {{shell->output, POLLIN, 0}, {shell->pidfd, POLLIN, 0}};
+        int n = poll(fds, 2, ms);
+        if (n < 0 && errno != EINTR) return -1;
+        if (n <= 0) continue;
+        if (fds[0].revents) {
+            ssize_t got = read(shell->output, chunk, sizeof(chunk));
+            if (got <= 0) {
+                // every writer is gone, so the shell is too
+                if (got == 0 || errno != EINTR) return -1;
+                continue;
+            }
+            ssize_t i;
+            int seen = 0;
+            for (i = 0; i < got; i++) {
+                if (chunk[i] == PROMPT[shell->matched]) shell->matched++;
+                else shell->matched = chunk[i] == PROMPT[0];
+                if (shell->matched == (int)strlen(PROMPT)) {
+                    shell->matched = 0;
+                    seen = 1;
+                }
+            }
+            if (prompt && seen) return 1;
+            continue;
+        }
+        // the output is read before the exit, so nothing it printed is lost
+        if (fds[1].revents) return -1;
+    }
+}
+
+/**
+ * The function writes a whole buffer.
+ * @return 0 on success or -1 on failure.
+ */
+static int writeAll(int fd, const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t n = write(fd, data, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        data += n;
+        size -= n;
+    }
+    return 0;
+}
+
+static int compareCommands(const void *a, const void *b) {
+    const Command *x = *(const Command *const *)a, *y = *(const Command *const *)b;
+    int names = strcmp(x->name, y->name);
+    if (names) return names;
+    return (x->latency > y->latency) - (x->latency < y->latency);
+}
+
+/**
+ * The function orders groups by their total latency, the slowest first.
+ */
+static int compareGroups(const void *a, const void *b) {
+    const Group *x = (const Group *)a, *y = (const Group *)b;
+    return (x->latency < y->latency) - (x->latency > y->latency);
+}
+
+/**
+ * The function prints the commands' latency and shell CPU time, summed up
+ * per command name.
+ * @param count The number of commands that were replayed.
+ */
+static void report(Recording *recording, int count) {
+    Command **order = (Command **)grow(NULL, (count + 1) * sizeof(Command *));
+    Group *groups = (Group *)grow(NULL, (count + 1) * sizeof(Group));
+    int i, groupCount = 0;
+    for (i = 0; i < count; i++) order[i] = &recording->commands[i];
+    qsort(order, count, sizeof(Command *), compareCommands);
+    for (i = 0; i < count;) {
+        int start = i;
+        Group *group = &groups[groupCount++];
+        memset(group, 0, sizeof(*group));
+        group->name = order[i]->name;
+        for (; i < count && strcmp(order[i]->name, group->name) == 0; i++) {
+            group->latency += order[i]->latency;
+            group->cpu += order[i]->cpu;
+        }
+        group->count = i - start;
+        // the group's commands are sorted by latency
+        group->p50 = order[start + (group->count - 1) / 2]->latency;
+        group->p99 = order[start + (group->count - 1) * 99 / 100]->latency;
+    }
+    qsort(groups, groupCount, sizeof(Group), compareGroups);
+    printf("%-16s %7s %12s %12s %12s %14s\n", "COMMAND", "COUNT", "MEAN ms", "P50 ms", "P99 ms", "SHELL CPU us");
+    for (i = 0; i < groupCount; i++) {
+        Group *group = &groups[i];
+        printf("%-16s %7d %12.3f %12.3f %12.3f %14.1f\n", group->name, group->count,
+               group->latency / 1e6 / group->count, group->p50 / 1e6, group->p99 / 1e6,
+               group->cpu / 1e3 / group->count);
+    }
+    free(order);
+    free(groups);
+}
+
+int main(int argc, char *argv[]) {
+    int fast = 0, verbose = 0, opt;
+    while ((opt = getopt(argc, argv, "+fv")) != -1) {
+        if (opt == 'f') fast = 1;
+        else if (opt == 'v') verbose = 1;
+        else {
+            fprintf(stderr, USAGE);
+            return 2;
+        }
+    }
+    if (argc - optind < 2) {
+        fprintf(stderr, USAGE);
+        return 2;
+    }
+    Recording recording;
+    if (readRecording(argv[optind], &recording) < 0) return 1;
+    // a shell that exits early must not kill the replay with SIGPIPE
+    signal(SIGPIPE, SIG_IGN);
+    Shell shell;
+    long long started = nowNs();
+    if (startShell(&recording, argv + optind + 1, &shell) < 0) return 1;
+    int alive = pump(&shell, -1, 1) > 0, replayed = 0;
+    long long startup = nowNs() - started, total = 0;
+    while (alive && replayed < recording.count) {
+        Command *command = &recording.commands[replayed];
+        if (!fast && pump(&shell, started + command->at, 0) < 0) break;
+        long long cpu = shellCpu(&shell), sent = nowNs();
+        if (writeAll(shell.input, command->input, command->inputSize) < 0) break;
+        alive = pump(&shell, -1, 1) > 0;
+        command->latency = nowNs() - sent;
+        long long used = shellCpu(&shell);
+        command->cpu = used >= 0 && cpu >= 0 ? used - cpu : 0;
+        if (used >= 0) total = used;
+        replayed++;
+        if (verbose) {
+            printf("%12.3f ms %10.1f us  %.*s\n", command->latency / 1e6, command->cpu / 1e3,
+                   (int)strcspn(command->input, "\n"), command->input);
+        }
+    }
+    long long cpu = shellCpu(&shell), closed = nowNs();
+    if (cpu >= 0) total = cpu;
+    close(shell.input);
+    // the shell's exit, with its shutdown policy, is timed too
+    while (pump(&shell, -1, 0) >= 0);
+    int status;
+    while (waitpid(shell.pid, &status, 0) < 0 && errno == EINTR);
+    long long ended = nowNs();
+    printf("replayed %d of %d commands in %.3fs (%s): startup %.3f ms, exit %.3f ms, shell CPU %.3fs\n", replayed,
+           recording.count, (ended - started) / 1e9, fast ? "as fast as possible" : "at recorded speed",
+           startup / 1e6, (ended - closed) / 1e6, total / 1e9);
+    report(&recording, replayed);
+    return replayed == recording.count ? 0 : 1;
+}
@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../trace.h"
+
+/*
+ * Converts a trace written with EX2_TRACE_FILE to Chrome trace JSON, for
+ * chrome://tracing or Perfetto. Every event is an instant event; each job
+ * also gets an async "job" span from fork until it exited, and a "spawn"
+ * span from fork until its exec succeeded or failed when that was recorded.
+ * usage: ex2-trace TRACE_FILE > trace.json
+ */
+
+static const char *names[] = {"?", "input read", "parse done", "builtin", "fork", "exec", "exec failed",
+                              "child exit", "reap"};
+
+/**
+ * The function compares pids for qsort and bsearch.
+ */
+static int comparePids(const void *a, const void *b) {
+    int32_t x = *(const int32_t *)a, y = *(const int32_t *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * The function reads a whole file.
+ * @return The contents or NULL on failure.
+ */
+static char *readFile(const char *path, size_t *size) {
+    FILE *file = fopen(path, "rb");
+    if (!file) return NULL;
+    char *data = NULL;
+    size_t capacity = 0;
+    *size = 0;
+    for (;;) {
+        if (*size == capacity) {
+            capacity = capacity ? capacity * 2 : 1 << 16;
+            char *grown = (char *)realloc(data, capacity);
+            if (!grown) break;
+            data = grown;
+        }
+        size_t n = fread(data + *size, 1, capacity - *size, file);
+        if (n == 0) break;
+        *size += n;
+    }
+    fclose(file);
+    return data;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: ex2-trace TRACE_FILE\n");
+        return 2;
+    }
+    size_t size;
+    char *data = readFile(argv[1], &size);
+    if (!data) {
+        perror(argv[1]);
+        return 1;
+    }
+    TraceHeader header;
+    if (size < sizeof(header) || (memcpy(&header, data, sizeof(header)), header.magic != TRACE_MAGIC) ||
+        header.version != TRACE_VERSION) {
+        fprintf(stderr, "%s: not an ex2 trace\n", argv[1]);
+        return 1;
+    }
+    TraceRecord *records = (TraceRecord *)(data + sizeof(header));
+    size_t count = (size - sizeof(header)) / sizeof(TraceRecord), i;
+    if (header.dropped) fprintf(stderr, "warning: %u events were dropped\n", header.dropped);
+    // the jobs whose exec outcome was recorded get a spawn span
+    int32_t *spawned = (int32_t *)malloc((count + 1) * sizeof(int32_t));
+    size_t spawnedCount = 0;
+    int64_t origin = count ? records[0].ts : 0;
+    for (i = 0; i < count; i++) {
+        if (records[i].kind == TRACE_EXEC || records[i].kind == TRACE_EXEC_FAILED) {
+            spawned[spawnedCount++] = records[i].pid;
+        }
+        if (records[i].ts < origin) origin = records[i].ts;
+    }
+    qsort(spawned, spawnedCount, sizeof(int32_t), comparePids);
+
+    printf("{\"traceEvents\":[\n");
+    printf("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":0,\"args\":{\"name\":\"ex2\"}}", header.pid);
+    for (i = 0; i < count; i++) {
+        const TraceRecord *record = &records[i];
+        uint32_t kind = record->kind < sizeof(names) / sizeof(names[0]) ? record->kind : 0;
+        double ts = (record->ts - origin) / 1e3;
+        printf(",\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"p\",\"ts\":%.3f,\"pid\":%d,\"tid\":0,"
+               "\"args\":{\"job\":%d,\"arg\":%d}}",
+               names[kind], ts, header.pid, record->pid, record->arg);
+        int hasSpawn = bsearch(&record->pid, spawned, spawnedCount, sizeof(int32_t), comparePids) != NULL;
+        const char *phase = NULL, *span = NULL;
+        if (kind == TRACE_FORK) {
+            printf(",\n{\"name\":\"job\",\"cat\":\"job\",\"ph\":\"b\",\"id\":%d,\"ts\":%.3f,\"pid\":%d,\"tid\":0}",
+                   record->pid, ts, header.pid);
+            if (hasSpawn) phase = "b", span = "spawn";
+        } else if ((kind == TRACE_EXEC || kind == TRACE_EXEC_FAILED) && hasSpawn) {
+            phase = "e", span = "spawn";
+        } else if (kind == TRACE_CHILD_EXIT) {
+            phase = "e", span = "job";
+        }
+        if (span) {
+            printf(",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%s\",\"id\":%d,\"ts\":%.3f,\"pid\":%d,\"tid\":0}",
+                   span, span, phase, record->pid, ts, header.pid);
+        }
+    }
+    printf("\n]}\n");
+    free(spawned);
+    free(data);
+    return 0;
+}
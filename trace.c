@@ -0,0 +1,72 @@
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "metrics.h"
+#include "trace.h"
+
+#define TRACE_WRITE_BATCH 1024
+
+int traceEnabled = 0;
+
+static TraceRecord ring[TRACE_RING_SIZE];
+/* the next sequence number to hand out and the next one to write out */
+static uint64_t head = 0, flushed = 0;
+static TraceHeader header;
+static int traceFd = -1;
+
+void initTrace() {
+#ifdef EX2_TRACE
+    const char *path = getenv("EX2_TRACE_FILE");
+    if (!path || !*path) return;
+    traceFd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (traceFd < 0) return;
+    header.magic = TRACE_MAGIC;
+    header.version = TRACE_VERSION;
+    header.pid = getpid();
+    header.dropped = 0;
+    if (write(traceFd, &header, sizeof(header)) != sizeof(header)) {
+        close(traceFd);
+        traceFd = -1;
+        return;
+    }
+    traceEnabled = 1;
+#endif
+}
+
+void traceEvent(int kind, long long ts, pid_t pid, int arg) {
+    uint64_t seq = __atomic_fetch_add(&head, 1, __ATOMIC_RELAXED);
+    TraceRecord *record = &ring[seq & (TRACE_RING_SIZE - 1)];
+    // a reader that sees the old seq knows the slot is being rewritten
+    __atomic_store_n(&record->seq, 0, __ATOMIC_RELAXED);
+    record->ts = ts ? ts : nowNs();
+    record->kind = kind;
+    record->pid = pid;
+    record->arg = arg;
+    __atomic_store_n(&record->seq, (uint32_t)(seq + 1), __ATOMIC_RELEASE);
+}
+
+void flushTrace(int force) {
+    if (traceFd < 0) return;
+    uint64_t end = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+    if (!force && end - flushed < TRACE_RING_SIZE / 2) return;
+    if (end - flushed > TRACE_RING_SIZE) {
+        header.dropped += end - flushed - TRACE_RING_SIZE;
+        flushed = end - TRACE_RING_SIZE;
+    }
+    TraceRecord batch[TRACE_WRITE_BATCH];
+    int count = 0;
+    for (; flushed < end; flushed++) {
+        TraceRecord *record = &ring[flushed & (TRACE_RING_SIZE - 1)];
+        if (__atomic_load_n(&record->seq, __ATOMIC_ACQUIRE) != (uint32_t)(flushed + 1)) {
+            header.dropped++;
+            continue;
+        }
+        batch[count] = *record;
+        if (++count == TRACE_WRITE_BATCH) {
+            if (write(traceFd, batch, sizeof(batch)) < 0) return;
+            count = 0;
+        }
+    }
+    if (count && write(traceFd, batch, count * sizeof(TraceRecord)) < 0) return;
+    if (pwrite(traceFd, &header, sizeof(header), 0) < 0) return;
+}
@@ -0,0 +1,77 @@
+#ifndef EX2_TRACE_H
+#define EX2_TRACE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/* kinds of events */
+#define TRACE_INPUT_READ 1
+#define TRACE_PARSE_DONE 2
+#define TRACE_BUILTIN 3
+#define TRACE_FORK 4
+#define TRACE_EXEC 5
+#define TRACE_EXEC_FAILED 6
+#define TRACE_CHILD_EXIT 7
+#define TRACE_REAP 8
+
+#define TRACE_MAGIC 0x54325845
+#define TRACE_VERSION 1
+/* a power of 2, the oldest events are overwritten once it is full */
+#define TRACE_RING_SIZE 65536
+
+/*
+ * The trace file is a TraceHeader followed by TraceRecords, both in host
+ * byte order. tools/trace2json.c turns it into Chrome trace JSON.
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    int32_t pid;
+    /* events overwritten in the ring before they were written out */
+    uint32_t dropped;
+} TraceHeader;
+
+typedef struct {
+    /* CLOCK_MONOTONIC in nanoseconds */
+    int64_t ts;
+    uint32_t kind;
+    /* the job's pid, or 0 before it has one */
+    int32_t pid;
+    /* TRACE_INPUT_READ: the line's length, TRACE_PARSE_DONE: argc,
+     * TRACE_EXEC_FAILED: errno, TRACE_CHILD_EXIT: the wait status */
+    int32_t arg;
+    /* the slot's sequence number plus 1, set once the record is complete */
+    uint32_t seq;
+} TraceRecord;
+
+#ifdef EX2_TRACE
+extern int traceEnabled;
+#define TRACE(kind, pid, arg) do { if (traceEnabled) traceEvent(kind, 0, pid, arg); } while (0)
+#define TRACE_AT(kind, ts, pid, arg) do { if (traceEnabled) traceEvent(kind, ts, pid, arg); } while (0)
+#else
+#define TRACE(kind, pid, arg) do { } while (0)
+#define TRACE_AT(kind, ts, pid, arg) do { } while (0)
+#endif
+
+/**
+ * The function enables tracing if EX2_TRACE_FILE names a file, which is
+ * truncated. Without EX2_TRACE at compile time it does nothing.
+ */
+void initTrace();
+/**
+ * The function records an event. It only takes a slot with an atomic add,
+ * so it is safe from a signal handler.
+ * @param kind The event's kind.
+ * @param ts The event's time from nowNs(), or 0 for now.
+ * @param pid The job's pid.
+ * @param arg The event's argument.
+ */
+void traceEvent(int kind, long long ts, pid_t pid, int arg);
+/**
+ * The function writes the events recorded since the last flush to the trace
+ * file.
+ * @param force 0 to only write once the ring is half full.
+ */
+void flushTrace(int force);
+
+#endif